@@ -44,9 +44,80 @@ set(sources
 
         src/camera_wrapper.h
         src/camera_wrapper.cpp
+        src/camera_options.cpp
+
+        src/sensor_modes.h
+        src/sensor_modes.cpp
+
+        src/buffer_depth_tuner.h
+        src/buffer_depth_tuner.cpp
+        src/buffer_pool_usage.hpp
+        src/memory_footprint.hpp
+
+        src/pipeline_statistics.hpp
+        src/pipeline_watchdog.h
+        src/pipeline_watchdog.cpp
+        src/metrics_server.h
+        src/metrics_server.cpp
+        src/frame_trace.h
+        src/frame_trace.cpp
+
+        src/rtp_output.h
+        src/rtp_output.cpp
+        src/datagram_output.h
+        src/datagram_output.cpp
+        src/datagram_socket.h
+        src/datagram_socket.cpp
+        src/rtsp_server.h
+        src/rtsp_server.cpp
+        src/rtsp_session.h
+        src/rtsp_session.cpp
+        src/frame_output.hpp
+        src/output_stage.h
+        src/output_stage.cpp
+        src/h264_packetizer.h
+        src/h264_packetizer.cpp
+        src/send_pacer.h
+        src/send_pacer.cpp
+        src/clock_conversion.h
+        src/clock_conversion.cpp
+        src/metadata_sei.h
+        src/metadata_sei.cpp
+        src/sps_rewriter.h
+        src/sps_rewriter.cpp
+        src/frame_fragment.hpp
+        src/nal_index.h
+        src/nal_index.cpp
+        src/parameter_set_cache.h
+        src/parameter_set_cache.cpp
+
+        src/warm_start.h
+        src/warm_start.cpp
+
+        src/placeholder_stream.h
+        src/placeholder_stream.cpp
+        src/h264_parameter_sets.h
+        src/h264_parameter_sets.cpp
+        src/bit_writer.hpp
+        src/bit_reader.hpp
 
         src/stream_info.hpp
         src/output_item.hpp
+        src/spsc_ring.hpp
+        src/v4l2_ioctl.hpp
+        src/v4l2_device.h
+        src/v4l2_device.cpp
+        src/fake_m2m_encoder.h
+        src/fake_m2m_encoder.cpp
+        src/encoded_file_source.h
+        src/mapped_file.h
+        src/mapped_file.cpp
+        src/encoded_file_source.cpp
+        src/raw_video_file.h
+        src/raw_video_file.cpp
+        src/dma_heap.h
+        src/dma_heap.cpp
+        src/startup_timeline.hpp
         )
 
 source_group(TREE "${CMAKE_CURRENT_SOURCE_DIR}" FILES ${sources})
@@ -0,0 +1,92 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Minimal timing harness for the microbenchmarks: runs the body in batches and reports the
+// median batch, which is robust against the odd preempted run on a busy Pi.
+struct BenchmarkResult
+{
+    std::string Name;
+    double NsPerIteration;
+    // 0 when the benchmark does not process bytes
+    double BytesPerSecond;
+};
+
+// Keeps the compiler from optimising away a result nobody reads
+template <typename T>
+inline void DoNotOptimize(T const &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Runs the selected benchmarks and collects their results for the JSON report
+class BenchmarkSuite
+{
+private:
+    std::string filter_;
+    std::vector<BenchmarkResult> results_;
+
+public:
+    explicit BenchmarkSuite(std::string filter) : filter_(std::move(filter))
+    {
+    }
+
+    // Whether a benchmark is selected, by substring of its name
+    bool Selected(std::string const &name) const { return name.find(filter_) != std::string::npos; }
+
+    template <typename Body>
+    void Run(std::string const &name, size_t bytesPerIteration, unsigned int iterations, Body body)
+    {
+        if (!Selected(name))
+        {
+            return;
+        }
+        constexpr int Batches = 15;
+        std::vector<double> batchNs;
+        for (int batch = 0; batch < Batches; batch++)
+        {
+            const auto begin = std::chrono::steady_clock::now();
+            for (unsigned int i = 0; i < iterations; i++)
+            {
+                body();
+            }
+            batchNs.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count());
+        }
+        std::nth_element(batchNs.begin(), batchNs.begin() + Batches / 2, batchNs.end());
+        const double ns = batchNs[Batches / 2] / iterations;
+        Record({name, ns, bytesPerIteration > 0 ? bytesPerIteration / ns * 1e9 : 0});
+    }
+
+    // For measurements taken outside Run(), such as latency percentiles
+    void Record(BenchmarkResult result)
+    {
+        std::printf("%-52s %12.1f ns", result.Name.c_str(), result.NsPerIteration);
+        if (result.BytesPerSecond > 0)
+        {
+            std::printf(" %10.1f MB/s", result.BytesPerSecond / 1e6);
+        }
+        std::printf("\n");
+        results_.push_back(std::move(result));
+    }
+
+    std::vector<BenchmarkResult> const &Results() const { return results_; }
+};
+
+// A group of related benchmarks, registered from its own file with REGISTER_BENCHMARKS
+using BenchmarkGroup = void (*)(BenchmarkSuite &suite);
+
+inline std::vector<BenchmarkGroup> &BenchmarkGroups()
+{
+    static std::vector<BenchmarkGroup> groups;
+    return groups;
+}
+
+#define REGISTER_BENCHMARKS(group) \
+    static const bool group##Registered = (BenchmarkGroups().push_back(group), true)
+
+#endif
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+"""Compares a benchmark run against a stored baseline and fails on regressions.
+
+    libcamera-streamer-benchmarks --json current.json
+    benchmarks/compare_benchmarks.py benchmarks/baseline.json current.json
+
+A benchmark regresses when it takes more than --threshold longer per iteration than in the
+baseline, and by at least --min-delta-ns so nanosecond benchmarks do not trip on timer noise.
+Wake-up latencies depend on the scheduler and get the looser --latency-threshold.
+Only runs on the same kind of machine compare; regenerate the baseline on the target when the
+context differs.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        report = json.load(f)
+    return report["context"], {b["name"]: b["ns_per_iteration"] for b in report["benchmarks"]}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=0.10, help="allowed slowdown, default 0.10")
+    parser.add_argument("--latency-threshold", type=float, default=1.0,
+                        help="allowed slowdown of the queue wake-up latencies, default 1.0")
+    parser.add_argument("--min-delta-ns", type=float, default=2.0,
+                        help="slowdowns smaller than this never count, default 2")
+    args = parser.parse_args()
+
+    baseline_context, baseline = load(args.baseline)
+    current_context, current = load(args.current)
+    if baseline_context != current_context:
+        print(f"warning: baseline from {baseline_context}, this run from {current_context}", file=sys.stderr)
+
+    regressions = 0
+    print(f"{'benchmark':<56} {'baseline ns':>14} {'current ns':>14} {'change':>8}")
+    for name, ns in current.items():
+        if name not in baseline:
+            print(f"{name:<56} {'-':>14} {ns:>14.1f}      new")
+            continue
+        change = ns / baseline[name] - 1
+        threshold = args.latency_threshold if name.startswith("queue/wakeup") else args.threshold
+        regressed = change > threshold and ns - baseline[name] > args.min_delta_ns
+        regressions += regressed
+        print(f"{name:<56} {baseline[name]:>14.1f} {ns:>14.1f} {change:>+7.1%}{'  REGRESSION' if regressed else ''}")
+    for name in baseline.keys() - current.keys():
+        print(f"{name:<56} {baseline[name]:>14.1f} {'-':>14}  missing")
+
+    if regressions:
+        print(f"{regressions} benchmark(s) regressed", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
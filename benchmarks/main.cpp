@@ -0,0 +1,83 @@
+// Runs the hot path microbenchmarks and optionally writes the results as JSON, for comparison
+// against a stored baseline with compare_benchmarks.py:
+//
+//   libcamera-streamer-benchmarks [--filter <substring>] [--json <file>]
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/utsname.h>
+
+#include "benchmark.hpp"
+
+namespace
+{
+    void writeJson(std::string const &path, std::vector<BenchmarkResult> const &results)
+    {
+        utsname host = {};
+        uname(&host);
+        std::ofstream out(path);
+        if (!out)
+        {
+            throw std::runtime_error("failed to open " + path);
+        }
+        // Results only compare between runs on the same kind of machine
+        out << "{\n  \"context\": {\"machine\": \"" << host.machine << "\", \"cpus\": "
+            << std::thread::hardware_concurrency() << ", \"compiler\": \"" << __VERSION__ << "\"},\n";
+        out << "  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            out << "    {\"name\": \"" << results[i].Name << "\", \"ns_per_iteration\": " << results[i].NsPerIteration
+                << ", \"bytes_per_second\": " << results[i].BytesPerSecond << "}"
+                << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string filter;
+    std::string jsonPath;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+        {
+            jsonPath = argv[++i];
+        }
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--filter <substring>] [--json <file>]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    BenchmarkSuite suite(filter);
+    try
+    {
+        for (const auto group : BenchmarkGroups())
+        {
+            group(suite);
+        }
+        if (!jsonPath.empty())
+        {
+            writeJson(jsonPath, suite.Results());
+        }
+    }
+    catch (std::exception const &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
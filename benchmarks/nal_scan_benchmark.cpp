@@ -0,0 +1,65 @@
+// Compares the vectorised start code search with the byte loop, and times building the NAL
+// index the output thread makes for every access unit.
+
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "synthetic_stream.hpp"
+#include "../src/nal_index.h"
+
+namespace
+{
+    size_t countScalar(std::vector<uint8_t> const &data)
+    {
+        size_t count = 0;
+        for (size_t position = FindStartCodeScalar(data.data(), data.size(), 0); position < data.size();
+             position = FindStartCodeScalar(data.data(), data.size(), position + 3))
+        {
+            count++;
+        }
+        return count;
+    }
+
+    size_t countVectorised(std::vector<uint8_t> const &data)
+    {
+        size_t count = 0;
+        for (size_t position = FindStartCode(data.data(), data.size(), 0); position < data.size();
+             position = FindStartCode(data.data(), data.size(), position + 3))
+        {
+            count++;
+        }
+        return count;
+    }
+
+    void nalScanBenchmarks(BenchmarkSuite &suite)
+    {
+        std::mt19937 random(42);
+        const auto keyframe = SyntheticAccessUnit(300 * 1024, true, random);
+        const auto pFrame = SyntheticAccessUnit(20 * 1024, false, random);
+
+        // Both searches must agree before their speed means anything
+        for (const auto *frame : {&keyframe, &pFrame})
+        {
+            if (countScalar(*frame) != countVectorised(*frame))
+            {
+                throw std::runtime_error("vectorised and scalar start code search disagree");
+            }
+        }
+
+        suite.Run("nal/start_codes_scalar/300KiB_keyframe", keyframe.size(), 50, [&] { DoNotOptimize(countScalar(keyframe)); });
+        suite.Run("nal/start_codes_vector/300KiB_keyframe", keyframe.size(), 50, [&] { DoNotOptimize(countVectorised(keyframe)); });
+        suite.Run("nal/start_codes_scalar/20KiB_p_frame", pFrame.size(), 500, [&] { DoNotOptimize(countScalar(pFrame)); });
+        suite.Run("nal/start_codes_vector/20KiB_p_frame", pFrame.size(), 500, [&] { DoNotOptimize(countVectorised(pFrame)); });
+
+        NalIndex index;
+        suite.Run("nal/index_build/300KiB_keyframe", keyframe.size(), 50, [&] {
+            index.Build(keyframe.data(), keyframe.size());
+            DoNotOptimize(index.Size());
+        });
+    }
+}
+
+REGISTER_BENCHMARKS(nalScanBenchmarks);
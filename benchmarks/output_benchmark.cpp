@@ -0,0 +1,76 @@
+// The cost of handing a keyframe to the kernel: RtpOutput's own packetizer with one sendmsg() per
+// packet, against DatagramOutput batching a frame's datagrams in sendmmsg(). Both send to a UDP
+// socket on loopback that is never read, so what is measured stays on the sending side.
+
+#include <netinet/in.h>
+#include <random>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "synthetic_stream.hpp"
+#include "../src/datagram_output.h"
+#include "../src/rtp_output.h"
+
+namespace
+{
+    // A bound socket for the outputs to send to, so loopback does not answer port unreachable
+    class Sink
+    {
+    private:
+        int fd_;
+        uint16_t port_ = 0;
+
+    public:
+        Sink()
+            : fd_(socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0))
+        {
+            sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            socklen_t length = sizeof(address);
+            if (fd_ < 0 || bind(fd_, reinterpret_cast<sockaddr *>(&address), length) < 0
+                || getsockname(fd_, reinterpret_cast<sockaddr *>(&address), &length) < 0)
+            {
+                throw std::runtime_error("failed to bind the loopback sink");
+            }
+            port_ = ntohs(address.sin_port);
+        }
+
+        ~Sink() { close(fd_); }
+
+        uint16_t Port() const { return port_; }
+    };
+
+    void outputBenchmarks(BenchmarkSuite &suite)
+    {
+        std::mt19937 random(42);
+        const auto keyframe = SyntheticAccessUnit(300 * 1024, true, random);
+        const FrameFragment fragment = {keyframe.data(), keyframe.size()};
+        Sink sink;
+
+        OutputOptions rtpOptions;
+        rtpOptions.Ip = "127.0.0.1";
+        rtpOptions.Port = sink.Port();
+        rtpOptions.SenderReports = false;
+        // Too small a fraction to ever sleep, leaving the packetizer and a send per packet
+        rtpOptions.PacingFraction = 1e-6f;
+        RtpOutput rtp(&rtpOptions);
+        int64_t captureUs = 0;
+        suite.Run("output/rtp_sendmsg/300KiB_keyframe", keyframe.size(), 500, [&] {
+            DoNotOptimize(rtp.SendFrame(&fragment, 1, captureUs += 33333));
+        });
+
+        OutputOptions datagramOptions = rtpOptions;
+        datagramOptions.Transport = OutputTransport::Udp;
+        datagramOptions.DatagramSize = RtpOutput::Mtu;
+        DatagramOutput datagrams(&datagramOptions);
+        suite.Run("output/datagram_sendmmsg/300KiB_keyframe", keyframe.size(), 500, [&] {
+            DoNotOptimize(datagrams.SendFrame(&fragment, 1, captureUs += 33333));
+        });
+    }
+}
+
+REGISTER_BENCHMARKS(outputBenchmarks);
@@ -0,0 +1,107 @@
+// What the output thread does to each access unit before handing it to RTP: indexing its NAL
+// units, learning the parameter sets, substituting the rewritten SPS, adding the metadata SEI
+// and gathering the fragments into one buffer, as RtpOutput does when there is more than one.
+// Then what paced sending adds: splitting the access unit into RTP packets and scheduling them.
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "synthetic_stream.hpp"
+#include "../src/h264_packetizer.h"
+#include "../src/metadata_sei.h"
+#include "../src/parameter_set_cache.h"
+#include "../src/rtp_output.h"
+#include "../src/send_pacer.h"
+#include "../src/sps_rewriter.h"
+
+namespace
+{
+    FrameMetadata allFields()
+    {
+        FrameMetadata metadata;
+        metadata.Fields = SeiAllFields;
+        metadata.TimestampUs = 123456789;
+        metadata.Sequence = 42;
+        metadata.ExposureTimeUs = 16000;
+        metadata.AnalogueGain = 2.0f;
+        metadata.DigitalGain = 1.0f;
+        metadata.Lux = 400.0f;
+        metadata.ColourTemperature = 5600;
+        return metadata;
+    }
+
+    void prepare(BenchmarkSuite &suite, std::string const &name, std::vector<uint8_t> const &accessUnit)
+    {
+        SpsRewriter spsRewriter(30);
+        ParameterSetCache parameterSets(&spsRewriter);
+        NalIndex index;
+        std::vector<uint8_t> sei;
+        sei.reserve(128);
+        std::vector<uint8_t> staging(accessUnit.size() + 1024);
+        const FrameMetadata metadata = allFields();
+        suite.Run(name, accessUnit.size(), 200, [&] {
+            index.Build(accessUnit.data(), accessUnit.size());
+            DoNotOptimize(parameterSets.Update(accessUnit.data(), index));
+            FrameFragment fragments[1 + SpsRewriter::MaxFragments];
+            sei.clear();
+            AppendMetadataSei(sei, metadata);
+            fragments[0] = {sei.data(), sei.size()};
+            const size_t count = 1 + spsRewriter.Rewrite(accessUnit.data(), accessUnit.size(), index, fragments + 1);
+            size_t offset = 0;
+            for (size_t i = 0; i < count; i++)
+            {
+                std::memcpy(staging.data() + offset, fragments[i].Data, fragments[i].Size);
+                offset += fragments[i].Size;
+            }
+            DoNotOptimize(RtpOutput::EstimatedPackets(offset));
+        });
+    }
+
+    void packetizationBenchmarks(BenchmarkSuite &suite)
+    {
+        std::mt19937 random(42);
+        prepare(suite, "packetization/prepare_access_unit/300KiB_keyframe", SyntheticAccessUnit(300 * 1024, true, random));
+        prepare(suite, "packetization/prepare_access_unit/20KiB_p_frame", SyntheticAccessUnit(20 * 1024, false, random));
+
+        std::vector<uint8_t> sei;
+        sei.reserve(128);
+        const FrameMetadata metadata = allFields();
+        suite.Run("packetization/metadata_sei", 0, 100000, [&] {
+            sei.clear();
+            AppendMetadataSei(sei, metadata);
+            DoNotOptimize(sei.size());
+        });
+
+        ParameterSetCache parameterSets(nullptr);
+        const auto keyframe = SyntheticAccessUnit(1024, true, random);
+        NalIndex index;
+        index.Build(keyframe.data(), keyframe.size());
+        parameterSets.Update(keyframe.data(), index);
+        suite.Run("packetization/stap_a", 0, 100000, [&] { DoNotOptimize(parameterSets.StapA().size()); });
+
+        H264Packetizer packetizer(RtpOutput::Mtu);
+        const auto large = SyntheticAccessUnit(300 * 1024, true, random);
+        suite.Run("packetization/rfc6184/300KiB_keyframe", large.size(), 2000, [&] {
+            DoNotOptimize(packetizer.Packetize(large.data(), large.size(), 0).size());
+        });
+
+        // A whole frame's schedule, on the pacer's own timeline so nothing sleeps
+        SendPacer pacer(0.5f, 16 * 1024);
+        const auto &packets = packetizer.Packetize(large.data(), large.size(), 0);
+        int64_t captureUs = 0;
+        suite.Run("packetization/pacer_schedule/300KiB_keyframe", 0, 2000, [&] {
+            captureUs += 33333;
+            pacer.BeginFrame(large.size(), captureUs);
+            int64_t departureUs = 0;
+            for (RtpPacket const &packet : packets)
+            {
+                departureUs = pacer.Schedule(packet.Size(), captureUs);
+            }
+            DoNotOptimize(departureUs);
+        });
+    }
+}
+
+REGISTER_BENCHMARKS(packetizationBenchmarks);
@@ -0,0 +1,185 @@
+// The handoffs between pipeline threads, for the vendored readerwriterqueue the pipeline used
+// to use and the SPSC ring with and without spinning:
+// * handoff: elements per second streamed from one thread to another
+// * wakeup: time from a push to the waiting consumer returning with it, after an idle gap where
+//   every consumer has gone to sleep, or with elements arriving shortly after each other
+// * output_item: the life of an encoded frame description, allocated and passed by pointer as
+//   it used to be, or copied by value through the ring
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "../readerwriterqueue/readerwriterqueue.h"
+#include "../src/output_item.hpp"
+#include "../src/spsc_ring.hpp"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    int64_t nowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    void waitFor(std::chrono::nanoseconds gap)
+    {
+        // Short gaps are busy-waited, sleeping would overshoot them
+        if (gap >= std::chrono::microseconds(500))
+        {
+            std::this_thread::sleep_for(gap);
+            return;
+        }
+        const auto until = Clock::now() + gap;
+        while (Clock::now() < until)
+        {
+        }
+    }
+
+    struct ReaderWriterQueue
+    {
+        static constexpr char const *Name = "readerwriterqueue";
+        moodycamel::BlockingReaderWriterQueue<int64_t> Queue;
+        void Push(int64_t value) { Queue.enqueue(value); }
+        int64_t Pop()
+        {
+            int64_t value;
+            Queue.wait_dequeue(value);
+            return value;
+        }
+    };
+
+    template <unsigned int SpinIterations>
+    struct Ring
+    {
+        static constexpr char const *Name = SpinIterations == 0 ? "ring_no_spin" : "ring_spin";
+        SpscRing<int64_t, 32> Queue{WaitStrategy{SpinIterations}};
+        void Push(int64_t value)
+        {
+            // Only fills when the consumer is starved of a core, the pipeline rings never do
+            while (!Queue.TryPush(value))
+            {
+                std::this_thread::yield();
+            }
+        }
+        int64_t Pop() { return *Queue.WaitPop(); }
+    };
+
+    template <typename Queue>
+    void handoff(BenchmarkSuite &suite)
+    {
+        const std::string name = std::string("queue/handoff/") + Queue::Name;
+        if (!suite.Selected(name))
+        {
+            return;
+        }
+        constexpr unsigned int Elements = 100000;
+        constexpr int Runs = 5;
+        std::vector<double> nsPerElement;
+        for (int run = 0; run < Runs; run++)
+        {
+            Queue queue;
+            const auto begin = Clock::now();
+            std::thread consumer([&] {
+                int64_t sum = 0;
+                for (unsigned int i = 0; i < Elements; i++)
+                {
+                    sum += queue.Pop();
+                }
+                DoNotOptimize(sum);
+            });
+            for (unsigned int i = 0; i < Elements; i++)
+            {
+                queue.Push(i);
+            }
+            consumer.join();
+            nsPerElement.push_back(std::chrono::duration<double, std::nano>(Clock::now() - begin).count() / Elements);
+        }
+        std::nth_element(nsPerElement.begin(), nsPerElement.begin() + Runs / 2, nsPerElement.end());
+        suite.Record({name, nsPerElement[Runs / 2], 0});
+    }
+
+    template <typename Queue>
+    void wakeup(BenchmarkSuite &suite, char const *pattern, std::chrono::nanoseconds gap, unsigned int samples)
+    {
+        const std::string name = std::string("queue/wakeup_") + pattern + "/" + Queue::Name;
+        if (!suite.Selected(name))
+        {
+            return;
+        }
+        Queue queue;
+        std::vector<double> latencyNs(samples);
+        std::thread consumer([&] {
+            for (auto &latency : latencyNs)
+            {
+                const int64_t pushed = queue.Pop();
+                latency = nowNs() - pushed;
+            }
+        });
+        for (unsigned int i = 0; i < samples; i++)
+        {
+            waitFor(gap);
+            queue.Push(nowNs());
+        }
+        consumer.join();
+
+        std::sort(latencyNs.begin(), latencyNs.end());
+        suite.Record({name + "/median", latencyNs[samples / 2], 0});
+        suite.Record({name + "/p99", latencyNs[samples * 99 / 100], 0});
+    }
+
+    template <typename Queue>
+    void queueBenchmarks(BenchmarkSuite &suite)
+    {
+        handoff<Queue>(suite);
+        wakeup<Queue>(suite, "idle", std::chrono::milliseconds(2), 1000);
+        wakeup<Queue>(suite, "20us", std::chrono::microseconds(20), 20000);
+    }
+
+    OutputItem encodedFrame(unsigned int index)
+    {
+        OutputItem item;
+        item.mem = nullptr;
+        item.bytes_used = 20000;
+        item.length = 65536;
+        item.index = index;
+        item.keyframe = false;
+        item.timestamp_us = 1000 * index;
+        item.sequence = index;
+        return item;
+    }
+
+    void outputItemBenchmarks(BenchmarkSuite &suite)
+    {
+        moodycamel::BlockingReaderWriterQueue<OutputItem *> pointers;
+        unsigned int index = 0;
+        suite.Run("output_item/heap_pointer", 0, 100000, [&] {
+            OutputItem *item = new OutputItem(encodedFrame(index++));
+            pointers.enqueue(item);
+            OutputItem *received;
+            pointers.wait_dequeue(received);
+            DoNotOptimize(received->sequence);
+            delete received;
+        });
+
+        SpscRing<OutputItem, 32> values;
+        suite.Run("output_item/ring_by_value", 0, 100000, [&] {
+            values.TryPush(encodedFrame(index++));
+            const OutputItem received = *values.WaitPop();
+            DoNotOptimize(received.sequence);
+        });
+    }
+
+    void allQueueBenchmarks(BenchmarkSuite &suite)
+    {
+        queueBenchmarks<ReaderWriterQueue>(suite);
+        queueBenchmarks<Ring<0>>(suite);
+        queueBenchmarks<Ring<WaitStrategy{}.SpinIterations>>(suite);
+        outputItemBenchmarks(suite);
+    }
+}
+
+REGISTER_BENCHMARKS(allQueueBenchmarks);
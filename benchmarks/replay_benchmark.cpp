@@ -0,0 +1,107 @@
+// The output half of the pipeline fed from a recorded stream, as the replay source does: indexing
+// the access units of a file once, then taking each one from the mapping through the output stage
+// and preparing it for RTP without touching the network.
+
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "synthetic_stream.hpp"
+#include "../src/encoded_file_source.h"
+#include "../src/output_stage.h"
+#include "../src/rtp_output.h"
+
+namespace
+{
+    constexpr unsigned int Frames = 300;
+    constexpr unsigned int KeyframeInterval = 30;
+
+    // Gathers each frame as a socket write would and counts its RTP packets, without sending
+    class GatheringOutput : public FrameOutput
+    {
+    private:
+        std::vector<uint8_t> staging_ = std::vector<uint8_t>(256 * 1024);
+        size_t lastPacketCount_ = 0;
+
+    public:
+        bool SendFrame(FrameFragment const *fragments, size_t count, int64_t) override
+        {
+            size_t offset = 0;
+            for (size_t i = 0; i < count; i++)
+            {
+                std::memcpy(staging_.data() + offset, fragments[i].Data, fragments[i].Size);
+                offset += fragments[i].Size;
+            }
+            lastPacketCount_ = RtpOutput::EstimatedPackets(offset);
+            return true;
+        }
+        void Reconnect() override {}
+
+        size_t LastPacketCount() const override { return lastPacketCount_; }
+        size_t HeapBytes() const override { return staging_.capacity(); }
+    };
+
+    // Ten seconds of 30 fps video: a 150 KiB keyframe every second, 20 KiB P frames between them
+    std::vector<uint8_t> syntheticStream()
+    {
+        std::mt19937 random(42);
+        std::vector<uint8_t> stream;
+        for (unsigned int frame = 0; frame < Frames; frame++)
+        {
+            const bool keyframe = frame % KeyframeInterval == 0;
+            const auto accessUnit = SyntheticAccessUnit(keyframe ? 150 * 1024 : 20 * 1024, keyframe, random);
+            stream.insert(stream.end(), accessUnit.begin(), accessUnit.end());
+        }
+        return stream;
+    }
+
+    void replayBenchmarks(BenchmarkSuite &suite)
+    {
+        const auto stream = syntheticStream();
+        if (EncodedFileSource::IndexAccessUnits(stream.data(), stream.size()).size() != Frames)
+        {
+            throw std::runtime_error("replay index does not match the synthetic stream");
+        }
+        suite.Run("replay/index_access_units/300_frames", stream.size(), 5, [&] {
+            DoNotOptimize(EncodedFileSource::IndexAccessUnits(stream.data(), stream.size()).size());
+        });
+
+        if (!suite.Selected("replay/output_path_per_frame"))
+        {
+            return;
+        }
+        // Through a real file mapping, as the example does
+        const int fd = memfd_create("replay", 0);
+        if (fd < 0 || write(fd, stream.data(), stream.size()) != static_cast<ssize_t>(stream.size()))
+        {
+            throw std::runtime_error("failed to write the replay file");
+        }
+        ReplayOptions options;
+        options.Framerate = 0;
+        options.Loop = true;
+        EncodedFileSource source("/proc/self/fd/" + std::to_string(fd), options);
+        close(fd);
+
+        OutputOptions outputOptions;
+        SpsRewriter spsRewriter(30);
+        ParameterSetCache parameterSets(&spsRewriter);
+        PipelineStatistics statistics;
+        OutputStage stage(&outputOptions, &spsRewriter, &parameterSets, &statistics, nullptr, nullptr, nullptr);
+        GatheringOutput output;
+        stage.Begin();
+        suite.Run("replay/output_path_per_frame", stream.size() / Frames, Frames, [&] {
+            const auto item = source.WaitForNextOutputItem();
+            if (stage.Accept(*item))
+            {
+                DoNotOptimize(stage.Send(*item, output));
+            }
+        });
+    }
+}
+
+REGISTER_BENCHMARKS(replayBenchmarks);
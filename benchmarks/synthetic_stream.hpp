@@ -0,0 +1,55 @@
+#ifndef SYNTHETIC_STREAM_H
+#define SYNTHETIC_STREAM_H
+
+#include <random>
+#include <vector>
+
+#include "../src/bit_writer.hpp"
+#include "../src/nal_index.h"
+
+// Access units shaped like the Pi encoder output at 720p: SPS, PPS and one large slice for
+// keyframes, one slice otherwise. Slice data is random, which entropy coded data is close to;
+// emulation prevention keeps it free of start codes.
+inline std::vector<uint8_t> SyntheticSps()
+{
+    BitWriter sps;
+    sps.WriteBits(77, 8); // profile_idc, Main like the encoder default
+    sps.WriteBits(0x40, 8); // constraint_set1_flag
+    sps.WriteBits(40, 8); // level_idc
+    sps.WriteUe(0); // seq_parameter_set_id
+    sps.WriteUe(0); // log2_max_frame_num_minus4
+    sps.WriteUe(0); // pic_order_cnt_type
+    sps.WriteUe(0); // log2_max_pic_order_cnt_lsb_minus4
+    sps.WriteUe(1); // max_num_ref_frames
+    sps.WriteBit(false); // gaps_in_frame_num_value_allowed_flag
+    sps.WriteUe(1280 / 16 - 1); // pic_width_in_mbs_minus1
+    sps.WriteUe(720 / 16 - 1); // pic_height_in_map_units_minus1
+    sps.WriteBit(true); // frame_mbs_only_flag
+    sps.WriteBit(true); // direct_8x8_inference_flag
+    sps.WriteBit(false); // frame_cropping_flag
+    sps.WriteBit(false); // vui_parameters_present_flag
+    sps.WriteTrailingBits();
+    return sps.Bytes();
+}
+
+inline std::vector<uint8_t> SyntheticAccessUnit(size_t sliceBytes, bool keyframe, std::mt19937 &random)
+{
+    std::vector<uint8_t> out;
+    if (keyframe)
+    {
+        AppendNalUnit(out, 3, NalUnitTypeSps, SyntheticSps());
+        AppendNalUnit(out, 3, NalUnitTypePps, {0xee, 0x3c, 0x80});
+    }
+    std::vector<uint8_t> slice(sliceBytes);
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (auto &value : slice)
+    {
+        value = static_cast<uint8_t>(byte(random));
+    }
+    // first_mb_in_slice 0: every slice starts a new picture
+    slice[0] |= 0x80;
+    AppendNalUnit(out, keyframe ? 3 : 2, keyframe ? NalUnitTypeIdr : 1, slice);
+    return out;
+}
+
+#endif
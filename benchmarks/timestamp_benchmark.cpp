@@ -0,0 +1,26 @@
+// The timestamp conversions made for every frame: into the V4L2 buffer and back out of the
+// encoded one, then into RTP and NTP time for sending.
+
+#include <cstdint>
+
+#include "benchmark.hpp"
+#include "../src/clock_conversion.h"
+#include "../src/rtp_output.h"
+
+namespace
+{
+    void timestampBenchmarks(BenchmarkSuite &suite)
+    {
+        int64_t timestampUs = 1234567890123;
+        suite.Run("timestamp/v4l2_round_trip", 0, 1000000, [&] {
+            DoNotOptimize(TimevalToMicroseconds(MicrosecondsToTimeval(timestampUs++)));
+        });
+        suite.Run("timestamp/rtp", 0, 1000000, [&] {
+            DoNotOptimize(MonotonicToRtp(timestampUs++, RtpOutput::ClockRate, 0x12345678));
+        });
+        // Reads the realtime and monotonic clocks for every frame
+        suite.Run("timestamp/ntp", 0, 100000, [&] { DoNotOptimize(MonotonicToNtp(timestampUs++)); });
+    }
+}
+
+REGISTER_BENCHMARKS(timestampBenchmarks);
@@ -0,0 +1,68 @@
+// Cost of the V4L2 calls the encoder makes per frame (QBUF and DQBUF on both queues). /dev/null
+// stands in for the kernel device: it rejects V4L2 requests straight away, leaving the syscall
+// round trip and the wrapper itself. A frame sent through H264Encoder and FakeM2mEncoder with no
+// processing latency times the encoder's own buffer handling and thread handoffs.
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "benchmark.hpp"
+#include "../src/fake_m2m_encoder.h"
+#include "../src/h264_encoder.h"
+#include "../src/v4l2_ioctl.hpp"
+
+namespace
+{
+    void encoderRoundTrip(BenchmarkSuite &suite)
+    {
+        if (!suite.Selected("v4l2/encoder_round_trip_fake"))
+        {
+            return;
+        }
+        EncoderOptions options;
+        options.width = 1280;
+        options.height = 720;
+        options.framerate = 30;
+        options.bitrate = 5000000;
+        FakeEncoderOptions fakeOptions;
+        fakeOptions.LatencyUs = 0;
+        H264Encoder encoder(&options, [](uint64_t) {}, std::make_unique<FakeM2mEncoder>(fakeOptions));
+        encoder.Configure(StreamInfo(options.width, options.height, options.width, std::nullopt));
+        encoder.Start();
+        // Any descriptor will do, the fake never reads the raw frame
+        const int fd = open("/dev/null", O_RDWR);
+        int64_t timestampUs = 0;
+        uint32_t sequence = 0;
+        suite.Run("v4l2/encoder_round_trip_fake", 0, 1000, [&] {
+            encoder.EncodeBuffer(fd, options.width * options.height * 3 / 2, timestampUs++, sequence++, 0);
+            encoder.OutputDone(encoder.WaitForNextOutputItem().value());
+        });
+        encoder.Stop();
+        close(fd);
+    }
+
+    void v4l2Benchmarks(BenchmarkSuite &suite)
+    {
+        const int fd = open("/dev/null", O_RDWR);
+        if (fd < 0)
+        {
+            throw std::runtime_error("failed to open /dev/null");
+        }
+        suite.Run("v4l2/xioctl_qbuf", 0, 100000, [&] {
+            v4l2_buffer buffer = {};
+            v4l2_plane planes[VIDEO_MAX_PLANES] = {};
+            buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+            buffer.memory = V4L2_MEMORY_MMAP;
+            buffer.length = 1;
+            buffer.m.planes = planes;
+            DoNotOptimize(Xioctl(fd, VIDIOC_QBUF, &buffer));
+        });
+        close(fd);
+        encoderRoundTrip(suite);
+    }
+}
+
+REGISTER_BENCHMARKS(v4l2Benchmarks);
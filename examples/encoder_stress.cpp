@@ -0,0 +1,198 @@
+// Drives H264Encoder against FakeM2mEncoder at a high frame rate with randomised frame, codec
+// and consumer timing, then checks that every accepted frame came out exactly once and in order,
+// and reports the throughput, latency and where frames were lost.
+//
+//   libcamera-streamer-encoder-stress [fps] [seconds] [codec latency us] [codec jitter us] [hold us]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <optional>
+#include <random>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+#include "../src/fake_m2m_encoder.h"
+#include "../src/h264_encoder.h"
+#include "../src/spsc_ring.hpp"
+
+namespace
+{
+    constexpr unsigned int Width = 1280;
+    constexpr unsigned int Height = 720;
+    // Buffers of the simulated camera, each handed back once the codec is done with it
+    constexpr unsigned int CameraBuffers = 8;
+    // Sequence of the frame that tells the consumer to stop
+    constexpr uint32_t LastSequence = UINT32_MAX;
+
+    int64_t nowUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    unsigned int argument(int argc, char **argv, int index, unsigned int fallback)
+    {
+        return argc > index ? std::stoul(argv[index]) : fallback;
+    }
+}
+
+auto main(int argc, char **argv) -> int
+{
+    const unsigned int fps = argument(argc, argv, 1, 1000);
+    const unsigned int seconds = argument(argc, argv, 2, 5);
+    FakeEncoderOptions fakeOptions;
+    fakeOptions.LatencyUs = argument(argc, argv, 3, 800);
+    fakeOptions.JitterUs = argument(argc, argv, 4, 400);
+    const unsigned int maxHoldUs = argument(argc, argv, 5, 1500);
+
+    EncoderOptions options;
+    options.width = Width;
+    options.height = Height;
+    options.framerate = fps;
+    options.bitrate = 20000000;
+    // Frame sizes in line with the bitrate, as the capture buffers are sized from it
+    fakeOptions.FrameBytes = options.bitrate / 8 / fps;
+    fakeOptions.KeyframeBytes = fakeOptions.FrameBytes * 8;
+
+    auto device = std::make_unique<FakeM2mEncoder>(fakeOptions);
+    FakeM2mEncoder *fake = device.get();
+    SpscRing<uint64_t, 32> freeCameraBuffers;
+    H264Encoder encoder(&options, [&](uint64_t cookie) { freeCameraBuffers.TryPush(cookie); }, std::move(device));
+    encoder.Configure(StreamInfo(Width, Height, Width, std::nullopt));
+
+    std::vector<int> cameraFds;
+    const size_t frameSize = Width * Height * 3 / 2;
+    for (unsigned int i = 0; i < CameraBuffers; i++)
+    {
+        const int fd = memfd_create("camera buffer", 0);
+        if (fd < 0 || ftruncate(fd, frameSize) < 0)
+        {
+            std::fprintf(stderr, "failed to create camera buffer\n");
+            return 1;
+        }
+        cameraFds.push_back(fd);
+        freeCameraBuffers.TryPush(i);
+    }
+    encoder.Start();
+
+    uint64_t cameraDrops = 0;
+    uint64_t encoderSkips = 0;
+    uint64_t accepted = 0;
+    std::thread producer([&] {
+        std::mt19937 random(7);
+        // Frame intervals vary by half a period either way
+        const double intervalUs = 1e6 / fps;
+        std::uniform_real_distribution<double> interval(intervalUs / 2, intervalUs * 3 / 2);
+        const int64_t end = nowUs() + seconds * 1000000ll;
+        auto next = std::chrono::steady_clock::now();
+        // A buffer the encoder had no room for is kept for the next frame: only the encoder's
+        // callback gives buffers back to the ring
+        std::optional<uint64_t> held;
+        // The encoder finds frames by timestamp, which a camera never repeats even when the
+        // producer catches up after a stall
+        int64_t lastTimestampUs = 0;
+        const auto timestamp = [&]() { return lastTimestampUs = std::max(nowUs(), lastTimestampUs + 1); };
+        const auto takeBuffer = [&]() -> std::optional<uint64_t> {
+            uint64_t cookie;
+            if (held)
+            {
+                return std::exchange(held, std::nullopt);
+            }
+            return freeCameraBuffers.TryPop(cookie) ? std::optional(cookie) : std::nullopt;
+        };
+        for (uint32_t sequence = 0; nowUs() < end; sequence++)
+        {
+            next += std::chrono::microseconds(static_cast<int64_t>(interval(random)));
+            std::this_thread::sleep_until(next);
+            const auto cookie = takeBuffer();
+            if (!cookie)
+            {
+                cameraDrops++;
+                continue;
+            }
+            if (!encoder.EncodeBuffer(cameraFds[*cookie], frameSize, timestamp(), sequence, *cookie))
+            {
+                encoderSkips++;
+                held = cookie;
+                continue;
+            }
+            accepted++;
+        }
+        while (true)
+        {
+            const auto cookie = takeBuffer();
+            if (cookie && encoder.EncodeBuffer(cameraFds[*cookie], frameSize, timestamp(), LastSequence, *cookie))
+            {
+                break;
+            }
+            held = cookie;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    uint64_t received = 0;
+    uint64_t outOfOrder = 0;
+    std::vector<int64_t> latencyUs;
+    std::mt19937 random(11);
+    std::uniform_int_distribution<unsigned int> hold(0, maxHoldUs);
+    std::optional<uint32_t> lastSequence;
+    const int64_t begin = nowUs();
+    while (true)
+    {
+        const OutputItem item = encoder.WaitForNextOutputItem().value();
+        if (item.sequence == LastSequence)
+        {
+            encoder.OutputDone(item);
+            break;
+        }
+        latencyUs.push_back(nowUs() - item.timestamp_us);
+        if (lastSequence && item.sequence <= *lastSequence)
+        {
+            outOfOrder++;
+        }
+        lastSequence = item.sequence;
+        received++;
+        // The application holding on to the encoded frame, such as while sending it
+        std::this_thread::sleep_for(std::chrono::microseconds(hold(random)));
+        encoder.OutputDone(item);
+    }
+    const double elapsedS = (nowUs() - begin) / 1e6;
+    producer.join();
+    encoder.Stop();
+
+    std::sort(latencyUs.begin(), latencyUs.end());
+    const auto percentile = [&](unsigned int p) { return latencyUs.empty() ? 0 : latencyUs[latencyUs.size() * p / 100]; };
+    const FakeEncoderStatistics codec = fake->Statistics();
+    std::printf("target %u fps, codec %u +/- %u us, hold up to %u us\n", fps, fakeOptions.LatencyUs, fakeOptions.JitterUs,
+                maxHoldUs);
+    std::printf("encoded %llu frames at %.1f fps, %llu keyframes\n", static_cast<unsigned long long>(received),
+                received / elapsedS, static_cast<unsigned long long>(codec.Keyframes));
+    std::printf("lost: %llu without a camera buffer, %llu without an encoder input buffer\n",
+                static_cast<unsigned long long>(cameraDrops), static_cast<unsigned long long>(encoderSkips));
+    std::printf("codec waited for a capture buffer %llu times, %llu frames truncated\n",
+                static_cast<unsigned long long>(codec.CaptureStalls), static_cast<unsigned long long>(codec.Truncated));
+    std::printf("latency: median %lld us, p99 %lld us, max %lld us\n", static_cast<long long>(percentile(50)),
+                static_cast<long long>(percentile(99)), static_cast<long long>(latencyUs.empty() ? 0 : latencyUs.back()));
+
+    for (const int fd : cameraFds)
+    {
+        close(fd);
+    }
+    // Every frame the encoder accepted must come out once, in capture order
+    if (received != accepted || outOfOrder > 0)
+    {
+        std::fprintf(stderr, "FAILED: %llu frames accepted, %llu received, %llu out of order\n",
+                     static_cast<unsigned long long>(accepted), static_cast<unsigned long long>(received),
+                     static_cast<unsigned long long>(outOfOrder));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+// Sends a recorded H.264 Annex-B file through the streamer's own output stage, the steps taken for
+// every encoded frame: indexing the NAL units, caching and injecting the parameter sets, rewriting
+// the SPS VUI and sending through the configured transport, counted in the pipeline statistics.
+// No camera or encoder is needed, so the output half of the pipeline can be measured on any
+// machine with a real bitstream.
+//
+//   libcamera-streamer-replay <file.h264> <ip or socket path> <port> [fps, 0 for as fast as possible] [loop 0/1]
+//                             [rtp|udp|unix|rtsp]
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "spdlog/spdlog.h"
+
+#include "../src/encoded_file_source.h"
+#include "../src/output_stage.h"
+
+namespace
+{
+    OutputTransport parseTransport(std::string const &name)
+    {
+        if (name == "udp")
+        {
+            return OutputTransport::Udp;
+        }
+        if (name == "unix")
+        {
+            return OutputTransport::UnixDatagram;
+        }
+        if (name == "rtsp")
+        {
+            return OutputTransport::Rtsp;
+        }
+        return OutputTransport::Rtp;
+    }
+}
+
+auto main(int argc, char **argv) -> int
+{
+    if (argc < 4)
+    {
+        std::fprintf(stderr,
+                     "usage: %s <file.h264> <ip or socket path> <port> [fps, 0 for as fast as possible] [loop 0/1]"
+                     " [rtp|udp|unix|rtsp]\n",
+                     argv[0]);
+        return 1;
+    }
+    ReplayOptions replayOptions;
+    replayOptions.Framerate = argc > 4 ? std::stof(argv[4]) : 30;
+    replayOptions.Loop = argc > 5 && std::stoi(argv[5]) != 0;
+
+    OutputOptions outputOptions;
+    outputOptions.Transport = parseTransport(argc > 6 ? argv[6] : "rtp");
+    if (outputOptions.Transport == OutputTransport::UnixDatagram)
+    {
+        outputOptions.SocketPath = argv[2];
+    }
+    else
+    {
+        outputOptions.Ip = argv[2];
+    }
+    outputOptions.Port = static_cast<uint16_t>(std::stoul(argv[3]));
+
+    EncodedFileSource source(argv[1], replayOptions);
+    // The VUI rewrite needs a frame rate to declare, the nominal one when replaying unpaced
+    SpsRewriter spsRewriter(replayOptions.Framerate > 0 ? replayOptions.Framerate : 30);
+    ParameterSetCache parameterSets(outputOptions.RewriteVui ? &spsRewriter : nullptr);
+    PipelineStatistics statistics;
+    OutputStage stage(&outputOptions, outputOptions.RewriteVui ? &spsRewriter : nullptr, &parameterSets, &statistics,
+                      nullptr, nullptr, nullptr);
+    // The file's keyframes come when they come; an RTSP client joining gets the next one with the
+    // parameter sets
+    const auto output = MakeFrameOutput(&outputOptions, &parameterSets, [&stage]() { stage.RequestParameterSets(); });
+
+    const auto begin = std::chrono::steady_clock::now();
+    auto reported = begin;
+    stage.Begin();
+    while (const auto item = source.WaitForNextOutputItem())
+    {
+        if (stage.Accept(*item))
+        {
+            stage.Send(*item, *output);
+        }
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now - reported >= std::chrono::seconds(1))
+        {
+            const auto snapshot = statistics.Snapshot();
+            const double elapsedS = std::chrono::duration<double>(now - begin).count();
+            spdlog::info("{} frames, {:.1f} fps, {:.2f} Mbit/s", snapshot.FramesSent, snapshot.FramesSent / elapsedS,
+                         snapshot.BytesSent * 8 / elapsedS / 1e6);
+            reported = now;
+        }
+    }
+    const double elapsedS = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    const auto snapshot = statistics.Snapshot();
+    const uint64_t frames = snapshot.FramesSent + snapshot.SendErrors;
+    std::printf("sent %llu frames (%llu failed) in %.2f s: %.1f fps, %.2f Mbit/s, %.1f us per frame, %llu packets\n",
+                static_cast<unsigned long long>(frames), static_cast<unsigned long long>(snapshot.SendErrors), elapsedS,
+                frames / elapsedS, snapshot.BytesSent * 8 / elapsedS / 1e6, frames > 0 ? elapsedS * 1e6 / frames : 0,
+                static_cast<unsigned long long>(snapshot.PacketsSent));
+    return snapshot.SendErrors > 0 ? 1 : 0;
+}
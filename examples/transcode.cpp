@@ -0,0 +1,239 @@
+// Encodes raw YUV 4:2:0 footage to an H.264 file as fast as the encoder allows, keeping every
+// encoder input buffer filled, and reports the throughput, per-frame latency and CPU use. Run on
+// each board at the resolutions and bitrates of interest to see which frame rates it sustains.
+//
+//   libcamera-streamer-transcode [--size WxH] [--fps F] [--bitrate N] [--fake] <input.y4m|input.yuv> <output.h264>
+//
+// Headerless .yuv files need --size and --fps, .y4m files --fps when their header has no frame
+// rate. --fake encodes with FakeM2mEncoder instead of the Pi's codec, to try the tool on machines
+// without one; its output is not decodable video.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <linux/dma-buf.h>
+#include <memory>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+#include "../src/dma_heap.h"
+#include "../src/fake_m2m_encoder.h"
+#include "../src/h264_encoder.h"
+#include "../src/raw_video_file.h"
+#include "../src/spsc_ring.hpp"
+
+namespace
+{
+    struct InputBuffer
+    {
+        int Fd;
+        uint8_t *Mapping;
+    };
+
+    int64_t nowUs()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    double cpuSeconds()
+    {
+        rusage usage = {};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+
+    // Brackets CPU writes to a dma-buf so cached heaps are flushed before the codec reads it
+    void syncDmabuf(int fd, uint64_t flags)
+    {
+        dma_buf_sync sync = {flags | DMA_BUF_SYNC_WRITE};
+        ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+    }
+}
+
+auto main(int argc, char **argv) -> int
+{
+    unsigned int width = 0;
+    unsigned int height = 0;
+    float framerate = 0;
+    uint32_t bitrate = 10000000;
+    bool fake = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            if (std::sscanf(argv[++i], "%ux%u", &width, &height) != 2)
+            {
+                paths.clear();
+                break;
+            }
+        }
+        else if (std::strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+        {
+            framerate = std::stof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--bitrate") == 0 && i + 1 < argc)
+        {
+            bitrate = std::stoul(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--fake") == 0)
+        {
+            fake = true;
+        }
+        else if (argv[i][0] != '-')
+        {
+            paths.emplace_back(argv[i]);
+        }
+        else
+        {
+            paths.clear();
+            break;
+        }
+    }
+    if (paths.size() != 2)
+    {
+        std::fprintf(stderr, "usage: %s [--size WxH] [--fps F] [--bitrate N] [--fake] <input.y4m|input.yuv> <output.h264>\n",
+                     argv[0]);
+        return 1;
+    }
+
+    const RawVideoFile input(paths[0], width, height, framerate);
+    FILE *output = std::fopen(paths[1].c_str(), "wb");
+    if (!output)
+    {
+        std::fprintf(stderr, "failed to open %s\n", paths[1].c_str());
+        return 1;
+    }
+
+    EncoderOptions options;
+    options.width = input.Width();
+    options.height = input.Height();
+    options.framerate = input.Framerate();
+    options.bitrate = bitrate;
+
+    std::unique_ptr<V4l2Device> device;
+    std::unique_ptr<DmaHeap> heap;
+    if (fake)
+    {
+        FakeEncoderOptions fakeOptions;
+        fakeOptions.FrameBytes = bitrate / 8 / input.Framerate();
+        fakeOptions.KeyframeBytes = fakeOptions.FrameBytes * 8;
+        device = std::make_unique<FakeM2mEncoder>(fakeOptions);
+    }
+    else
+    {
+        device = std::make_unique<KernelV4l2Device>("/dev/video11");
+        heap = std::make_unique<DmaHeap>();
+    }
+
+    // Raw frame buffers go back on the ring as soon as the codec is done with them
+    SpscRing<uint64_t, 32> freeInputBuffers;
+    H264Encoder encoder(&options, [&](uint64_t cookie) { freeInputBuffers.TryPush(cookie); }, std::move(device));
+    encoder.Configure(StreamInfo(input.Width(), input.Height(), input.Width(), std::nullopt));
+
+    // One raw frame per encoder input buffer: the encoder frees its buffer before handing back the
+    // frame, so the producer finds one whenever it has a frame to queue
+    std::vector<InputBuffer> inputBuffers;
+    const size_t frameSize = input.FrameSize();
+    for (unsigned int i = 0; i < options.output_buffers; i++)
+    {
+        // The fake never reads the frames, any shareable memory will do
+        const int fd = heap ? heap->Allocate(frameSize, "transcode input") : memfd_create("transcode input", 0);
+        if (fd < 0 || (!heap && ftruncate(fd, frameSize) < 0))
+        {
+            std::fprintf(stderr, "failed to allocate an input buffer\n");
+            return 1;
+        }
+        void *mapping = mmap(nullptr, frameSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            std::fprintf(stderr, "failed to map an input buffer\n");
+            return 1;
+        }
+        inputBuffers.push_back({fd, static_cast<uint8_t *>(mapping)});
+        freeInputBuffers.TryPush(i);
+    }
+
+    // Written by the producer before the frame is queued, read once it has come out encoded
+    std::vector<int64_t> queuedUs(input.FrameCount());
+    uint64_t retries = 0;
+    const double cpuBegin = cpuSeconds();
+    const int64_t begin = nowUs();
+    encoder.Start();
+    std::thread producer([&] {
+        // Unique and evenly spaced, as from a camera at the footage's frame rate
+        const double intervalUs = 1e6 / input.Framerate();
+        for (uint32_t sequence = 0; sequence < input.FrameCount(); sequence++)
+        {
+            const uint64_t cookie = *freeInputBuffers.WaitPop();
+            InputBuffer const &buffer = inputBuffers[cookie];
+            syncDmabuf(buffer.Fd, DMA_BUF_SYNC_START);
+            std::memcpy(buffer.Mapping, input.Frame(sequence), frameSize);
+            syncDmabuf(buffer.Fd, DMA_BUF_SYNC_END);
+            queuedUs[sequence] = nowUs();
+            const int64_t timestampUs = begin + static_cast<int64_t>(sequence * intervalUs);
+            // Only when buffers are taken out of circulation; try again once the codec may have released one
+            while (!encoder.EncodeBuffer(buffer.Fd, frameSize, timestampUs, sequence, cookie))
+            {
+                retries++;
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                queuedUs[sequence] = nowUs();
+            }
+        }
+    });
+
+    std::vector<int64_t> latencyUs;
+    latencyUs.reserve(input.FrameCount());
+    uint64_t bytes = 0;
+    uint64_t keyframes = 0;
+    bool writeFailed = false;
+    while (latencyUs.size() < input.FrameCount())
+    {
+        const OutputItem item = encoder.WaitForNextOutputItem().value();
+        latencyUs.push_back(nowUs() - queuedUs[item.sequence]);
+        writeFailed |= std::fwrite(item.mem, 1, item.bytes_used, output) != item.bytes_used;
+        bytes += item.bytes_used;
+        keyframes += item.keyframe;
+        encoder.OutputDone(item);
+    }
+    const double elapsedS = (nowUs() - begin) / 1e6;
+    const double cpuS = cpuSeconds() - cpuBegin;
+    producer.join();
+    encoder.Stop();
+    writeFailed |= std::fclose(output) != 0;
+
+    for (InputBuffer const &buffer : inputBuffers)
+    {
+        munmap(buffer.Mapping, frameSize);
+        close(buffer.Fd);
+    }
+
+    std::sort(latencyUs.begin(), latencyUs.end());
+    const auto percentile = [&](unsigned int p) { return latencyUs[latencyUs.size() * p / 100]; };
+    const double fps = latencyUs.size() / elapsedS;
+    std::printf("%ux%u at %.2f Mbit/s: %zu frames (%llu keyframes) in %.2f s, %.1f fps (%.2fx real time)\n",
+                input.Width(), input.Height(), bitrate / 1e6, latencyUs.size(), static_cast<unsigned long long>(keyframes),
+                elapsedS, fps, fps / input.Framerate());
+    std::printf("output %.2f Mbit/s at the footage's %.2f fps, %llu retries for a free encoder input buffer\n",
+                bytes * 8 / (latencyUs.size() / input.Framerate()) / 1e6, input.Framerate(),
+                static_cast<unsigned long long>(retries));
+    std::printf("latency queued to encoded: median %lld us, p99 %lld us, max %lld us\n",
+                static_cast<long long>(percentile(50)), static_cast<long long>(percentile(99)),
+                static_cast<long long>(latencyUs.back()));
+    std::printf("cpu %.2f s, %.1f%% of one core\n", cpuS, cpuS / elapsedS * 100);
+    if (writeFailed)
+    {
+        std::fprintf(stderr, "failed to write %s\n", paths[1].c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -53,6 +53,8 @@ struct CameraOptions
   unsigned int width = 0;
   unsigned int height = 0;
   unsigned int framerate = 30;
+  // Number of camera buffers and requests, 0 leaves the libcamera default
+  unsigned int buffer_count = 0;
   libcamera::Transform transform;
   float gain = 0;
 
@@ -91,8 +93,19 @@ struct CameraOptions
   // Sets the Denoise operating mode: auto, off, cdn_off, cdn_fast, cdn_hq
   std::string denoise = "off";
 
+  // Sensor mode as W:H:bit-depth:packing, where packing is P (packed) or U (unpacked), or
+  // "auto" to pick the mode with the shortest readout that reaches the framerate. Empty
+  // leaves the choice to libcamera.
   std::string mode_string;
   Mode mode;
+
+  // File caching the enumerated sensor modes, which otherwise costs a sensor configuration
+  // per mode on every start. Empty disables the cache.
+  std::string sensor_mode_cache_file;
+
+  // File where the converged exposure, gain and colour gains are kept between runs to seed
+  // AE/AWB on the next start. Empty disables warm starting.
+  std::string warm_start_file;
 };
 
 enum DenoiseMode
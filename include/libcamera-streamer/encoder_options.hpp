@@ -23,8 +23,18 @@ struct EncoderOptions
     //Set the intra frame period
     unsigned int intra = 30;
 
-    // Force PPS/SPS header with every I frame (h264 only)
+    // Force PPS/SPS header with every I frame (h264 only). When off, the output inserts the cached
+    // headers where receivers need them, see OutputOptions::ParameterSetRepeatMs.
     bool inline_headers = true;
+
+    // Number of raw frame buffers the encoder can have queued at once
+    unsigned int output_buffers = 6;
+
+    // Number of buffers for the encoded bitstream
+    unsigned int capture_buffers = 12;
+
+    // Size of each encoded bitstream buffer in bytes, 0 sizes them from the resolution and bitrate
+    uint32_t capture_buffer_size = 0;
 };
 
 #endif
\ No newline at end of file
@@ -1,14 +1,43 @@
 #ifndef LIBCAMERA_STREAMER_H
 #define LIBCAMERA_STREAMER_H
 
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <optional>
 #include <thread>
 
-#include <uvgrtp/context.hh>
-#include <uvgrtp/media_stream.hh>
+#include "../../src/buffer_depth_tuner.h"
 #include "../../src/camera_wrapper.h"
+#include "../../src/frame_trace.h"
 #include "../../src/h264_encoder.h"
+#include "../../src/metadata_sei.h"
+#include "../../src/metrics_server.h"
+#include "../../src/output_stage.h"
+#include "../../src/parameter_set_cache.h"
+#include "../../src/pipeline_statistics.hpp"
+#include "../../src/pipeline_watchdog.h"
+#include "../../src/placeholder_stream.h"
+#include "../../src/sps_rewriter.h"
+#include "../../src/startup_timeline.hpp"
 #include "streamer_configuration.hpp"
 
+// What Reconfigure() had to redo, and how long the video stopped for
+struct ReconfigurationReport
+{
+    // Bitrate or intra period changed through the codec controls
+    bool EncoderControls = false;
+    // Frame rate changed on the sensor and the codec while streaming
+    bool Framerate = false;
+    // Camera and codec stopped, reconfigured and restarted for a new geometry or buffer setup
+    bool Restreamed = false;
+    // Time Reconfigure() took
+    float ApplyMs = 0;
+    // From the last frame sent before the change to the first one after it, -1 until that is sent
+    float GapMs = -1;
+};
+
 class LibcameraStreamer
 {
 private:
@@ -19,19 +48,101 @@ private:
     std::thread fromCameraToEncoderThread_;
     std::thread fromEncoderToOutputThread_;
 
-    uvgrtp::context ctx_;
-    uvgrtp::session *sess_;
-    uvgrtp::media_stream *stream_;
-    bool stop_requested=false;
+    std::unique_ptr<FrameOutput> output_;
+    // Heap held by the output, published by the thread sending through it so GetMemoryFootprint()
+    // never reads buffers being resized
+    mutable std::atomic<size_t> outputHeapBytes_{0};
+    // Camera metadata waiting for its frame to come out of the encoder
+    mutable FrameMetadataTable frameMetadata_;
+    std::unique_ptr<SpsRewriter> spsRewriter_;
+    mutable ParameterSetCache parameterSets_;
+    // Set when an RTSP client starts playing or starts dropping frames, the output thread asks the
+    // encoder for a keyframe
+    mutable std::atomic<bool> clientKeyframeRequested_{false};
+    std::unique_ptr<PlaceholderStream> placeholder_;
+    std::unique_ptr<BufferDepthTuner> bufferDepthTuner_;
+    mutable PipelineStatistics statistics_;
+    // Takes each encoded frame from the encoder's buffer to the output
+    std::unique_ptr<OutputStage> outputStage_;
+    std::unique_ptr<MetricsServer> metricsServer_;
+    std::unique_ptr<FrameTrace> frameTrace_;
+    // Anomaly dumps are written off the output thread; waited for before the trace goes away
+    mutable std::future<void> traceDump_;
+    std::atomic<bool> stop_requested{false};
+    mutable StartupTimeline startupTimeline_;
+
+    // Serialises Start(), Stop(), Reconfigure() and GetMemoryFootprint()
+    mutable std::mutex controlMutex_;
+    bool running_ = false;
+    // Pipeline threads not yet returned, for Stop() to wait on with its deadline
+    mutable std::mutex pipelineThreadsMutex_;
+    mutable std::condition_variable pipelineThreadsExited_;
+    mutable unsigned int pipelineThreadsRunning_ = 0;
+
+    std::unique_ptr<PipelineWatchdog> watchdog_;
+    std::thread watchdogThread_;
+    std::mutex watchdogMutex_;
+    std::condition_variable watchdogCondition_;
+    bool watchdogStopRequested_ = false;
+    mutable std::atomic<int64_t> lastFrameSentUs_{0};
+    // Send time of the last frame before a reconfiguration, until the first one after it is sent
+    mutable std::atomic<int64_t> reconfigurationGapStartUs_{0};
+    mutable std::mutex reconfigurationReportMutex_;
+    mutable std::optional<ReconfigurationReport> lastReconfiguration_;
 
 public:
     explicit LibcameraStreamer(StreamerConfiguration configuration);
 
     ~LibcameraStreamer();
+
+    // Stops the camera, then the codec, and the pipeline threads within ShutdownTimeoutMs, throwing
+    // when a thread is stuck past it. The camera, codec device, buffers and output are kept for
+    // Start().
+    void Stop();
+    // Restarts the pipeline after Stop(), in a fraction of the time construction takes
+    void Start();
+
+    // Per-phase startup durations, complete once the first packet has been sent
+    std::vector<StartupPhase> GetStartupTimeline() const;
+    // Frames the AE/AWB algorithms needed to converge after the camera started
+    ConvergenceStats GetConvergenceStats() const;
+    // Chosen buffer depths once auto-tuning has finished
+    std::optional<BufferTuningReport> GetBufferTuningReport() const;
+    // Buffer and heap memory held per component
+    MemoryFootprint GetMemoryFootprint() const;
+    // Consistent copy of the pipeline counters, cheap enough to poll from any thread
+    PipelineStatisticsSnapshot GetStatistics() const;
+    // Makes the encoder produce a keyframe as soon as possible, preceded by SPS/PPS
+    void RequestKeyframe();
+    // Writes the recorded frames as Chrome trace JSON, throws when tracing is disabled
+    void WriteFrameTrace(std::string const &path) const;
+    // Applies a new configuration redoing only what changed, keeping the camera manager, the codec
+    // device and the output: bitrate and intra period through the codec controls and the
+    // frame rate through the next requests' frame duration limits, both without interrupting the
+    // video. A new resolution, or any other encoder option or camera buffer or mode change, stops
+    // and reconfigures the camera and codec streams. Other camera options only take effect with
+    // such a restream, output options are kept. While stopped, the pipeline is only reconfigured
+    // for the next Start(). The pipeline is unusable if this throws.
+    ReconfigurationReport Reconfigure(StreamerConfiguration const &configuration);
+    // The last reconfiguration, with its gap once the first frame after it was sent
+    std::optional<ReconfigurationReport> GetLastReconfiguration() const;
 private:
-    void completedRequestsProcessor() const;
-    void encodedFramesProcessor() const;
-    void inputBufferProcessedCallback() const;
+    // The startup timeline is only recorded on the first start
+    void completedRequestsProcessor(bool firstStart) const;
+    void encodedFramesProcessor(bool firstStart) const;
+    void inputBufferProcessedCallback(uint64_t cookie) const;
+    void dumpFrameTrace(uint32_t sequence) const;
+    void startPipeline(bool firstStart);
+    void stopPipeline();
+    // Runs a processor, reporting a failure to the watchdog instead of ending the process
+    void runPipelineThread(void (LibcameraStreamer::*processor)(bool) const, bool firstStart) const;
+    void pipelineThreadExited() const;
+    void watchdogLoop();
+    void recover(PipelineComponent component);
+    void restream(StreamerConfiguration const &configuration, ReconfigurationReport const &report);
+    // Publishes the report and measures the gap from the last frame sent to the next one
+    void startGapMeasurement(ReconfigurationReport const &report);
+    void frameSent(int64_t nowUs) const;
 };
 
 #endif
\ No newline at end of file
@@ -1,12 +1,74 @@
 #ifndef OUTPUT_OPTIONS_H
 #define OUTPUT_OPTIONS_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
+// Camera metadata fields which can be carried in a per-frame SEI message
+enum MetadataSeiField : uint32_t
+{
+  SeiTimestamp = 1 << 0,
+  SeiSequence = 1 << 1,
+  SeiExposureTime = 1 << 2,
+  SeiAnalogueGain = 1 << 3,
+  SeiDigitalGain = 1 << 4,
+  SeiLux = 1 << 5,
+  SeiColourTemperature = 1 << 6,
+  SeiAllFields = (1 << 7) - 1,
+};
+
+enum class OutputTransport
+{
+  // RTP to Ip:Port, for receivers on the network
+  Rtp,
+  // NAL-aligned datagrams with a minimal header (see DatagramOutput) to Ip:Port, for a forwarder
+  // such as wfb-ng on the same host
+  Udp,
+  // The same datagrams to the Unix datagram socket at SocketPath
+  UnixDatagram,
+  // An RTSP server listening on Ip:Port (Ip empty for all interfaces), from which any number of
+  // viewers pull the stream
+  Rtsp,
+};
+
 struct OutputOptions
 {
+  OutputTransport Transport = OutputTransport::Rtp;
   std::string Ip;
   uint16_t Port;
+  // Socket of the forwarder for OutputTransport::UnixDatagram; a leading '@' names an abstract one
+  std::string SocketPath;
+  // Largest datagram the Udp and UnixDatagram transports send, header included. Set it to the
+  // payload the radio link carries per packet, so the forwarder never splits one.
+  size_t DatagramSize = 1400;
+  // Encoded bytes an RTSP client may fall behind by before frames are dropped for it, up to the
+  // next keyframe
+  size_t RtspClientQueueBytes = 1024 * 1024;
+  // RTSP clients served at once, further SETUPs are refused
+  unsigned int RtspMaxClients = 8;
+  // Send a grey placeholder stream from construction until the first live keyframe
+  bool SendPlaceholder = false;
+  // Send RTCP sender reports on Port + 1, mapping the sensor-clock RTP timestamps to wall-clock time
+  bool SenderReports = true;
+  // MetadataSeiField bits to send in a user_data_unregistered SEI ahead of every frame. 0 disables it.
+  uint32_t MetadataSeiFields = 0;
+  // Add bitstream_restriction (no reordering, minimal DPB) and timing info to the encoder's SPS so
+  // decoders output every frame immediately
+  bool RewriteVui = true;
+  // Resend the cached SPS/PPS before keyframes at most this often when the encoder does not
+  // repeat them itself (EncoderOptions::inline_headers off). 0 only sends them at the start of
+  // the stream and after RequestKeyframe().
+  unsigned int ParameterSetRepeatMs = 0;
+  // Spread the packets of each frame over this fraction of the frame interval, so keyframes do
+  // not overflow WiFi driver queues in one burst. Paced frames go through the streamer's own
+  // RFC 6184 packetizer and socket instead of uvgRTP. 0 sends every frame as a single burst.
+  float PacingFraction = 0;
+  // Bytes that may leave back to back; frames up to this size are not delayed
+  size_t PacingBurstBytes = 16 * 1024;
+  // Hand the kernel each packet's departure time (SO_TXTIME) instead of sleeping between packets.
+  // Only the fq qdisc honours it, other qdiscs send the packets at once.
+  bool PacingTxTime = false;
 };
 
 #endif
\ No newline at end of file
@@ -10,6 +10,41 @@ struct StreamerConfiguration
     CameraOptions Camera;
     EncoderOptions Encoder;
     OutputOptions Output;
+
+    // Find the smallest camera and encoder buffer depths sustaining the framerate without drops
+    bool AutoTuneBuffers = false;
+    // Frames spent in each of the warm-up, calibration and verification phases
+    unsigned int BufferCalibrationFrames = 120;
+
+    // Upper bound for the buffers and heap held by the streamer, checked once configured. 0 is unlimited.
+    size_t MemoryBudgetBytes = 0;
+
+    // Polls a pipeline thread makes on its empty queue before sleeping, trading a little CPU for
+    // wake-up latency. 0 sleeps straight away.
+    unsigned int QueueSpinIterations = 2000;
+
+    // Upper bound for Stop(), Reconfigure() and the watchdog's restarts to stop the pipeline
+    // threads. A thread still stuck past it, in a driver call for instance, is left running and
+    // the call fails instead of hanging; the pipeline counts as running until a later stop finds
+    // the thread gone. 0 waits indefinitely.
+    unsigned int ShutdownTimeoutMs = 0;
+
+    // Frame periods a pipeline stage may go without progress before the watchdog restarts the
+    // camera stream, reopens the encoder or reconnects the output, whichever stalled first.
+    // The encoder is also reopened when a pipeline thread fails. 0 disables the watchdog, a
+    // failing pipeline thread then ends the process.
+    unsigned int WatchdogStallFrames = 10;
+
+    // Serve the pipeline statistics (Prometheus text, JSON on /json) on host:port or on a Unix
+    // socket when this is an absolute path. Empty disables the endpoint.
+    std::string MetricsEndpoint;
+
+    // Record per-frame stage timestamps for the last TraceFrames frames. 0 disables tracing.
+    unsigned int TraceFrames = 0;
+    // Chrome trace JSON written here when a frame takes longer than TraceAnomalyMs from capture
+    // to sent, or fails to send. 0 only writes the trace on demand.
+    std::string TraceFile = "/tmp/libcamera-streamer-trace.json";
+    unsigned int TraceAnomalyMs = 0;
 };
 
 #endif
\ No newline at end of file
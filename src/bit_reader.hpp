@@ -0,0 +1,89 @@
+#ifndef BIT_READER_H
+#define BIT_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// Strips the emulation prevention bytes from a NAL unit payload, giving its RBSP
+inline void NalUnitToRbsp(const uint8_t *data, size_t size, std::vector<uint8_t> &rbsp)
+{
+    rbsp.clear();
+    unsigned int zeros = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        if (zeros == 2 && data[i] == 3)
+        {
+            zeros = 0;
+            continue;
+        }
+        rbsp.push_back(data[i]);
+        zeros = data[i] == 0 ? zeros + 1 : 0;
+    }
+}
+
+// Reads an H.264 RBSP bit by bit, MSB first; the counterpart of BitWriter
+class BitReader
+{
+private:
+    const std::vector<uint8_t> &bytes_;
+    size_t position_ = 0;
+
+public:
+    explicit BitReader(const std::vector<uint8_t> &bytes) : bytes_(bytes) {}
+
+    bool ReadBit()
+    {
+        if (position_ >= bytes_.size() * 8)
+        {
+            throw std::runtime_error("bitstream ended unexpectedly");
+        }
+        const bool bit = (bytes_[position_ / 8] >> (7 - position_ % 8)) & 1;
+        position_++;
+        return bit;
+    }
+
+    uint32_t ReadBits(unsigned int count)
+    {
+        uint32_t value = 0;
+        while (count > 0)
+        {
+            value = (value << 1) | ReadBit();
+            count--;
+        }
+        return value;
+    }
+
+    uint32_t ReadUe()
+    {
+        unsigned int leadingZeros = 0;
+        while (!ReadBit())
+        {
+            if (++leadingZeros > 31)
+            {
+                throw std::runtime_error("Exp-Golomb code too long");
+            }
+        }
+        return static_cast<uint32_t>((uint64_t(1) << leadingZeros) - 1 + ReadBits(leadingZeros));
+    }
+
+    int32_t ReadSe()
+    {
+        const uint32_t codeNum = ReadUe();
+        return codeNum & 1 ? static_cast<int32_t>((codeNum + 1) / 2) : -static_cast<int32_t>(codeNum / 2);
+    }
+
+    void Skip(size_t count)
+    {
+        if (position_ + count > bytes_.size() * 8)
+        {
+            throw std::runtime_error("bitstream ended unexpectedly");
+        }
+        position_ += count;
+    }
+
+    size_t Position() const { return position_; }
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef BIT_WRITER_H
+#define BIT_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Writes an H.264 RBSP bit by bit, MSB first, with the Exp-Golomb codes used by the
+// parameter sets and slice headers.
+class BitWriter
+{
+private:
+    std::vector<uint8_t> bytes_;
+    unsigned int bitCount_ = 0;
+
+public:
+    void WriteBits(uint32_t value, unsigned int count)
+    {
+        while (count > 0)
+        {
+            count--;
+            WriteBit((value >> count) & 1);
+        }
+    }
+
+    void WriteBit(bool bit)
+    {
+        if (bitCount_ % 8 == 0)
+        {
+            bytes_.push_back(0);
+        }
+        if (bit)
+        {
+            bytes_.back() |= 0x80 >> (bitCount_ % 8);
+        }
+        bitCount_++;
+    }
+
+    void WriteUe(uint32_t value)
+    {
+        const uint64_t codeNum = static_cast<uint64_t>(value) + 1;
+        unsigned int length = 0;
+        while ((codeNum >> (length + 1)) != 0)
+        {
+            length++;
+        }
+        WriteBits(0, length);
+        // The leading one and the info bits together are length + 1 bits wide
+        for (int i = static_cast<int>(length); i >= 0; i--)
+        {
+            WriteBit((codeNum >> i) & 1);
+        }
+    }
+
+    void WriteSe(int32_t value)
+    {
+        WriteUe(value > 0 ? 2 * static_cast<uint32_t>(value) - 1 : 2 * static_cast<uint32_t>(-value));
+    }
+
+    // rbsp_trailing_bits(): a stop bit followed by zero bits up to the byte boundary
+    void WriteTrailingBits()
+    {
+        WriteBit(true);
+        while (bitCount_ % 8 != 0)
+        {
+            WriteBit(false);
+        }
+    }
+
+    bool IsByteAligned() const { return bitCount_ % 8 == 0; }
+    const std::vector<uint8_t> &Bytes() const { return bytes_; }
+};
+
+// Appends a NAL unit in Annex-B form: start code, header byte and the RBSP with emulation
+// prevention bytes inserted.
+inline void AppendNalUnit(std::vector<uint8_t> &out, uint8_t nalRefIdc, uint8_t nalUnitType,
+                          const uint8_t *rbsp, size_t size)
+{
+    out.insert(out.end(), {0, 0, 0, 1});
+    out.push_back(static_cast<uint8_t>((nalRefIdc << 5) | nalUnitType));
+    unsigned int zeros = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        const uint8_t byte = rbsp[i];
+        if (zeros == 2 && byte <= 3)
+        {
+            out.push_back(3);
+            zeros = 0;
+        }
+        out.push_back(byte);
+        zeros = byte == 0 ? zeros + 1 : 0;
+    }
+}
+
+inline void AppendNalUnit(std::vector<uint8_t> &out, uint8_t nalRefIdc, uint8_t nalUnitType,
+                          const std::vector<uint8_t> &rbsp)
+{
+    AppendNalUnit(out, nalRefIdc, nalUnitType, rbsp.data(), rbsp.size());
+}
+
+#endif
@@ -0,0 +1,144 @@
+#include "buffer_depth_tuner.h"
+
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+BufferDepthTuner::BufferDepthTuner(CameraWrapper *camera, H264Encoder *encoder, unsigned int calibrationFrames) :
+    camera_(camera)
+    , encoder_(encoder)
+    , phaseFrames_(std::max(1u, calibrationFrames))
+{
+    report_.Allocated = allocatedDepths();
+}
+
+void BufferDepthTuner::OnCameraFrame(bool dropped, double cameraLatencyMs)
+{
+    if (phase_ == Phase::Done)
+    {
+        return;
+    }
+
+    frames_++;
+    drops_ += dropped ? 1 : 0;
+    cameraLatencySumMs_ += cameraLatencyMs;
+    if (frames_ < phaseFrames_)
+    {
+        return;
+    }
+
+    switch (phase_)
+    {
+        case Phase::Warmup:
+            // Startup transients would inflate the peaks, so they are measured from here on
+            startPhase(Phase::Calibrating);
+            break;
+        case Phase::Calibrating:
+        {
+            report_.CalibrationLatencyMs = meanLatencyMs();
+            if (drops_ > 0)
+            {
+                spdlog::warn("Buffer tuning: {} frames dropped with all buffers, keeping the allocated depths", drops_);
+                report_.Chosen = report_.Allocated;
+                finish(false);
+                break;
+            }
+
+            const auto requests = camera_->GetRequestUsage();
+            const auto outputBuffers = encoder_->GetOutputBufferUsage();
+            const auto captureBuffers = encoder_->GetCaptureBufferUsage();
+            BufferDepths chosen;
+            chosen.CameraRequests = std::min(requests.Allocated, requests.PeakInUse + MinCameraRequestsQueued);
+            chosen.EncoderOutputBuffers = std::min(outputBuffers.Allocated, outputBuffers.PeakInUse + 1);
+            // Every frame in the codec needs somewhere to land on top of the ones being sent
+            chosen.EncoderCaptureBuffers = std::min(captureBuffers.Allocated,
+                                                    captureBuffers.PeakInUse + outputBuffers.PeakInUse + 1);
+            report_.Chosen = chosen;
+            apply(chosen);
+            startPhase(Phase::Verifying);
+            break;
+        }
+        case Phase::Verifying:
+            report_.TunedLatencyMs = meanLatencyMs();
+            if (drops_ > 0)
+            {
+                spdlog::warn("Buffer tuning: {} frames dropped with the reduced depths, restoring them", drops_);
+                report_.Chosen = report_.Allocated;
+                apply(report_.Allocated);
+                finish(false);
+                break;
+            }
+            finish(true);
+            break;
+        case Phase::Done:
+            break;
+    }
+}
+
+void BufferDepthTuner::OnFrameEncoded(double captureLatencyMs)
+{
+    captureLatencySumUs_.fetch_add(static_cast<int64_t>(captureLatencyMs * 1000), std::memory_order_relaxed);
+    encodedFrames_.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::optional<BufferTuningReport> BufferDepthTuner::Report() const
+{
+    const std::lock_guard lock(reportMutex_);
+    if (!reportReady_)
+    {
+        return std::nullopt;
+    }
+    return report_;
+}
+
+void BufferDepthTuner::startPhase(Phase phase)
+{
+    phase_ = phase;
+    frames_ = 0;
+    drops_ = 0;
+    cameraLatencySumMs_ = 0;
+    captureLatencySumUs_ = 0;
+    encodedFrames_ = 0;
+    camera_->ResetRequestUsagePeak();
+    encoder_->ResetBufferUsagePeaks();
+}
+
+double BufferDepthTuner::meanLatencyMs() const
+{
+    // Encoded frames carry their sensor timestamp, so their latency already covers the camera side
+    const unsigned int encodedFrames = encodedFrames_.load(std::memory_order_relaxed);
+    if (encodedFrames > 0)
+    {
+        return captureLatencySumUs_.load(std::memory_order_relaxed) / 1000.0 / encodedFrames;
+    }
+    return cameraLatencySumMs_ / frames_;
+}
+
+BufferDepths BufferDepthTuner::allocatedDepths() const
+{
+    BufferDepths depths;
+    depths.CameraRequests = camera_->GetRequestUsage().Allocated;
+    depths.EncoderOutputBuffers = encoder_->GetOutputBufferUsage().Allocated;
+    depths.EncoderCaptureBuffers = encoder_->GetCaptureBufferUsage().Allocated;
+    return depths;
+}
+
+void BufferDepthTuner::apply(BufferDepths const &depths)
+{
+    camera_->SetActiveRequests(depths.CameraRequests);
+    encoder_->SetActiveBuffers(depths.EncoderOutputBuffers, depths.EncoderCaptureBuffers);
+}
+
+void BufferDepthTuner::finish(bool tuned)
+{
+    phase_ = Phase::Done;
+    const std::lock_guard lock(reportMutex_);
+    report_.Tuned = tuned;
+    reportReady_ = true;
+    spdlog::info("Buffer depths: camera {}/{}, encoder input {}/{}, encoder output {}/{}; "
+                 "latency {:.1f} ms with all buffers, {:.1f} ms with the chosen depths",
+                 report_.Chosen.CameraRequests, report_.Allocated.CameraRequests,
+                 report_.Chosen.EncoderOutputBuffers, report_.Allocated.EncoderOutputBuffers,
+                 report_.Chosen.EncoderCaptureBuffers, report_.Allocated.EncoderCaptureBuffers,
+                 report_.CalibrationLatencyMs, tuned ? report_.TunedLatencyMs : report_.CalibrationLatencyMs);
+}
@@ -0,0 +1,80 @@
+#ifndef BUFFER_DEPTH_TUNER_H
+#define BUFFER_DEPTH_TUNER_H
+
+#include <atomic>
+#include <mutex>
+#include <optional>
+
+#include "camera_wrapper.h"
+#include "h264_encoder.h"
+
+struct BufferDepths
+{
+    unsigned int CameraRequests = 0;
+    unsigned int EncoderOutputBuffers = 0;
+    unsigned int EncoderCaptureBuffers = 0;
+};
+
+struct BufferTuningReport
+{
+    BufferDepths Allocated;
+    BufferDepths Chosen;
+    // False when frames were dropped and the allocated depths were kept
+    bool Tuned = false;
+    // Mean sensor-to-encoded latency with every buffer circulating and with the chosen depths
+    double CalibrationLatencyMs = 0;
+    double TunedLatencyMs = 0;
+};
+
+// Watches peak buffer usage while every allocated buffer circulates, then parks the surplus so
+// that no more buffers than needed can hold frames. If frames drop with the reduced depths, the
+// full depths are restored.
+class BufferDepthTuner
+{
+private:
+    enum class Phase
+    {
+        Warmup,
+        Calibrating,
+        Verifying,
+        Done
+    };
+
+    // libcamera needs a few requests queued to never miss a frame while the rest are held by us
+    static constexpr unsigned int MinCameraRequestsQueued = 2;
+
+    CameraWrapper *camera_;
+    H264Encoder *encoder_;
+    unsigned int phaseFrames_;
+
+    Phase phase_ = Phase::Warmup;
+    unsigned int frames_ = 0;
+    unsigned int drops_ = 0;
+    double cameraLatencySumMs_ = 0;
+    // Written by the output thread
+    std::atomic<int64_t> captureLatencySumUs_{0};
+    std::atomic<unsigned int> encodedFrames_{0};
+
+    mutable std::mutex reportMutex_;
+    BufferTuningReport report_;
+    bool reportReady_ = false;
+
+public:
+    BufferDepthTuner(CameraWrapper *camera, H264Encoder *encoder, unsigned int calibrationFrames);
+
+    // Called from the camera thread for every completed request
+    void OnCameraFrame(bool dropped, double cameraLatencyMs);
+    // Called from the output thread with the time from sensor capture to the encoded frame
+    void OnFrameEncoded(double captureLatencyMs);
+
+    std::optional<BufferTuningReport> Report() const;
+
+private:
+    void startPhase(Phase phase);
+    double meanLatencyMs() const;
+    BufferDepths allocatedDepths() const;
+    void apply(BufferDepths const &depths);
+    void finish(bool tuned);
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef BUFFER_POOL_USAGE_H
+#define BUFFER_POOL_USAGE_H
+
+#include <atomic>
+
+struct BufferPoolUsage
+{
+    // Buffers allocated for the pool
+    unsigned int Allocated = 0;
+    // Buffers allowed to circulate; the rest are parked and cost no queueing
+    unsigned int Active = 0;
+    // Highest number of buffers in use at once since the peak was last reset
+    unsigned int PeakInUse = 0;
+};
+
+// Counts buffers currently in use and remembers the peak, from any thread
+class BufferUseCounter
+{
+private:
+    std::atomic<unsigned int> inUse_{0};
+    std::atomic<unsigned int> peak_{0};
+
+public:
+    void Acquire()
+    {
+        const unsigned int inUse = inUse_.fetch_add(1, std::memory_order_relaxed) + 1;
+        unsigned int peak = peak_.load(std::memory_order_relaxed);
+        while (inUse > peak && !peak_.compare_exchange_weak(peak, inUse, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void Release() { inUse_.fetch_sub(1, std::memory_order_relaxed); }
+
+    unsigned int InUse() const { return inUse_.load(std::memory_order_relaxed); }
+    unsigned int Peak() const { return peak_.load(std::memory_order_relaxed); }
+    void ResetPeak() { peak_.store(InUse(), std::memory_order_relaxed); }
+    // For a pool freed and allocated again, with nothing in use
+    void Reset()
+    {
+        inUse_.store(0, std::memory_order_relaxed);
+        peak_.store(0, std::memory_order_relaxed);
+    }
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "libcamera-streamer/camera_options.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+
+Mode::Mode(std::string const &mode_string) :
+    Mode()
+{
+    if (mode_string.empty())
+    {
+        return;
+    }
+
+    char packing;
+    const int fields = sscanf(mode_string.c_str(), "%u:%u:%u:%c", &width, &height, &bit_depth, &packing);
+    if (fields < 2)
+    {
+        throw std::runtime_error("invalid mode " + mode_string);
+    }
+    if (fields == 2)
+    {
+        bit_depth = 12;
+        packed = true;
+    }
+    else if (fields == 3)
+    {
+        packed = true;
+    }
+    else if (toupper(packing) == 'P')
+    {
+        packed = true;
+    }
+    else if (toupper(packing) == 'U')
+    {
+        packed = false;
+    }
+    else
+    {
+        throw std::runtime_error("packing indicator should be P or U in mode " + mode_string);
+    }
+}
+
+std::string Mode::ToString() const
+{
+    if (bit_depth == 0)
+    {
+        return "unspecified";
+    }
+
+    std::stringstream ss;
+    ss << width << ":" << height << ":" << bit_depth << ":" << (packed ? "P" : "U");
+    return ss.str();
+}
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <chrono>
 #include <mutex>
 #include <sys/mman.h>
 
@@ -26,9 +28,59 @@ CameraWrapper::CameraWrapper(
 
     spdlog::trace("Camera acquired");
 
+    generateConfiguration();
+}
+
+CameraWrapper::~CameraWrapper()
+{
+    releaseBuffers();
+    if (camera_)
+    {
+        camera_->release();
+        camera_.reset();
+    }
+    cameraManager_->stop();
+}
+
+void CameraWrapper::ResetConfiguration()
+{
+    releaseBuffers();
+    frame_buffers_.clear();
+    pendingFrameDuration_.reset();
+    controls_.clear();
+    generateConfiguration();
+}
+
+void CameraWrapper::releaseBuffers()
+{
+    // Requests reference the buffers, and the buffers must be unmapped before they are freed
+    requests_.clear();
+    {
+        const std::lock_guard lock(mappingMutex_);
+        for (const auto &[buffer, spans] : mapped_buffers_)
+        {
+            for (const auto &span : spans)
+            {
+                munmap(span.data(), span.size());
+            }
+        }
+        mapped_buffers_.clear();
+    }
+    allocator_.reset();
+}
+
+void CameraWrapper::generateConfiguration()
+{
+    const std::optional<SensorMode> sensorMode = selectSensorMode();
+
     spdlog::trace("START Configuring video");
 
-    const libcamera::StreamRoles streamRoles = {libcamera::StreamRole::VideoRecording};
+    // A raw stream is what pins the sensor mode; otherwise libcamera picks one from the output size
+    libcamera::StreamRoles streamRoles = {libcamera::StreamRole::VideoRecording};
+    if (sensorMode)
+    {
+        streamRoles.push_back(libcamera::StreamRole::Raw);
+    }
     configuration_ = camera_->generateConfiguration(streamRoles);
     if (!configuration_)
     {
@@ -37,7 +89,10 @@ CameraWrapper::CameraWrapper(
 
     libcamera::StreamConfiguration &streamConfiguration = configuration_->at(0);
     streamConfiguration.pixelFormat = libcamera::formats::YUV420;
-    // TODO: cfg.bufferCount = ???;
+    if (options_->buffer_count > 0)
+    {
+        streamConfiguration.bufferCount = options_->buffer_count;
+    }
     streamConfiguration.size.width = options_->width;
     streamConfiguration.size.height = options_->height;
     if (streamConfiguration.size.width >= 1280 || streamConfiguration.size.height >= 720)
@@ -49,8 +104,15 @@ CameraWrapper::CameraWrapper(
         streamConfiguration.colorSpace = libcamera::ColorSpace::Smpte170m;
     }
 
+    if (sensorMode)
+    {
+        libcamera::StreamConfiguration &rawConfiguration = configuration_->at(1);
+        rawConfiguration.pixelFormat = libcamera::PixelFormat::fromString(sensorMode->PixelFormat);
+        rawConfiguration.size = libcamera::Size(sensorMode->Width, sensorMode->Height);
+        rawConfiguration.bufferCount = streamConfiguration.bufferCount;
+    }
+
     configuration_->transform = options_->transform;
-    controls_.set(libcamera::controls::draft::NoiseReductionMode, libcamera::controls::draft::NoiseReductionModeOff);
 
     const libcamera::CameraConfiguration::Status validationResult = configuration_->validate();
     if (validationResult == libcamera::CameraConfiguration::Invalid)
@@ -61,7 +123,14 @@ CameraWrapper::CameraWrapper(
     {
         spdlog::info("Stream configuration adjusted");
     }
+    if (sensorMode && configuration_->at(1).size != libcamera::Size(sensorMode->Width, sensorMode->Height))
+    {
+        spdlog::warn("Sensor mode adjusted to {}", configuration_->at(1).toString());
+    }
+}
 
+void CameraWrapper::Configure()
+{
     if (camera_->configure(configuration_.get()) < 0)
     {
         throw std::runtime_error("failed to configure streams");
@@ -75,10 +144,6 @@ CameraWrapper::CameraWrapper(
     makeRequests();
 }
 
-CameraWrapper::~CameraWrapper()
-{
-}
-
 void CameraWrapper::StartCamera()
 {
     // Framerate is a bit weird. If it was set programmatically, we go with
@@ -96,6 +161,19 @@ void CameraWrapper::StartCamera()
         }
     }
 
+    bool warmStarted = false;
+    if (!options_->warm_start_file.empty())
+    {
+        if (const auto state = LoadWarmStartState(options_->warm_start_file))
+        {
+            warmStarted = applyWarmStart(*state);
+        }
+    }
+    {
+        const std::lock_guard lock(convergenceMutex_);
+        convergence_.Reset(warmStarted);
+    }
+
     if (!controls_.get(libcamera::controls::AnalogueGain))
     {
         controls_.set(libcamera::controls::AnalogueGain, options_->gain);
@@ -116,6 +194,10 @@ void CameraWrapper::StartCamera()
     {
         controls_.set(libcamera::controls::AwbMode, options_->awb);
     }
+    if (!controls_.get(libcamera::controls::draft::NoiseReductionMode))
+    {
+        controls_.set(libcamera::controls::draft::NoiseReductionMode, libcamera::controls::draft::NoiseReductionModeOff);
+    }
 
     if (!controls_.get(libcamera::controls::ColourGains) && options_->awb_gain_r
         && options_->awb_gain_b)
@@ -136,9 +218,24 @@ void CameraWrapper::StartCamera()
     controls_.clear();
 
     camera_->requestCompleted.connect(this, &CameraWrapper::requestComplete);
-
+    started_ = true;
+
+    // Every request is ours again, whatever the last run left behind
+    completedRequestsQueue_.Clear();
+    completedRequestsQueue_.Resume();
+    requestsInFlight_ = 0;
+    requestsHeld_.Reset();
+    parkedRequests_.clear();
     for (std::unique_ptr<libcamera::Request> &request : requests_)
     {
+        if (requestsInFlight_ == activeRequests_)
+        {
+            parkedRequests_.push_back(request.get());
+            continue;
+        }
+        // Requeued after a stop, the request still holds its last completion
+        request->reuse(libcamera::Request::ReuseBuffers);
+        requestsInFlight_++;
         if (camera_->queueRequest(request.get()) < 0)
             throw std::runtime_error("Failed to queue request");
     }
@@ -146,8 +243,22 @@ void CameraWrapper::StartCamera()
 
 void CameraWrapper::StopCamera()
 {
-    camera_.reset();
-    cameraManager_->stop();
+    if (!started_)
+    {
+        return;
+    }
+    started_ = false;
+    if (!options_->warm_start_file.empty())
+    {
+        const std::lock_guard lock(convergenceMutex_);
+        if (convergence_.Converged())
+        {
+            SaveWarmStartState(options_->warm_start_file, *convergence_.Converged());
+        }
+    }
+    // Buffers, requests and the camera itself are released on destruction
+    camera_->stop();
+    camera_->requestCompleted.disconnect(this, &CameraWrapper::requestComplete);
 }
 
 void CameraWrapper::makeRequests()
@@ -163,28 +274,35 @@ void CameraWrapper::makeRequests()
         for (libcamera::StreamConfiguration &config : *configuration_)
         {
             libcamera::Stream *stream = config.stream();
+            auto &stream_buffers = free_buffers[stream];
 
             if (stream == configuration_->at(0).stream())
             {
-                if (free_buffers.empty())
+                if (stream_buffers.empty())
                 {
                     spdlog::trace("Requests created");
                     return;
                 }
-                std::unique_ptr<libcamera::Request> request = camera_->createRequest();
+                if (requests_.size() == MaxRequests)
+                {
+                    throw std::runtime_error("more than " + std::to_string(MaxRequests) + " frame buffers");
+                }
+                // The cookie identifies the request when the encoder hands the frame back
+                std::unique_ptr<libcamera::Request> request = camera_->createRequest(requests_.size());
                 if (!request)
                 {
                     throw std::runtime_error("failed to make request");
                 }
                 requests_.push_back(std::move(request));
+                activeRequests_ = requests_.size();
             }
-            else if (free_buffers.empty())
+            else if (stream_buffers.empty())
             {
                 throw std::runtime_error("concurrent streams need matching numbers of buffers");
             }
 
-            libcamera::FrameBuffer *buffer = free_buffers.front();
-            free_buffers.pop();
+            libcamera::FrameBuffer *buffer = stream_buffers.front();
+            stream_buffers.pop();
             if (requests_.back()->addBuffer(stream, buffer) < 0)
             {
                 throw std::runtime_error("failed to add buffer to request");
@@ -196,21 +314,38 @@ void CameraWrapper::makeRequests()
 void CameraWrapper::requestComplete(libcamera::Request *request)
 {
     spdlog::trace("CameraWrapper: Request complete");
+    requestsInFlight_--;
     if (request->status() == libcamera::Request::RequestCancelled)
     {
         return;
     }
-    
-        completedRequestsQueue_.enqueue(request);
-        requestsToReuseQueue_.enqueue(request);
-    
+    if (trace_)
+    {
+        trace_->Begin(request->sequence());
+    }
+    requestsHeld_.Acquire();
+
+    {
+        const std::lock_guard lock(convergenceMutex_);
+        convergence_.Update(request->metadata());
+    }
+
+    // Never full, every request made has a slot
+    if (!completedRequestsQueue_.TryPush(request->cookie()))
+    {
+        spdlog::error("CameraWrapper: completed request queue full");
+    }
 }
 
 libcamera::Request *CameraWrapper::WaitForCompletedRequest()
 {
-    libcamera::Request *request;
-    completedRequestsQueue_.wait_dequeue(request);
-    return request;
+    const std::optional<uint64_t> cookie = completedRequestsQueue_.WaitPop();
+    return cookie ? requests_[*cookie].get() : nullptr;
+}
+
+void CameraWrapper::InterruptCompletedRequestWait()
+{
+    completedRequestsQueue_.Interrupt();
 }
 
 StreamInfo CameraWrapper::GetStreamInfo()
@@ -233,59 +368,254 @@ libcamera::FrameBuffer *CameraWrapper::GetFrameBufferForRequest(const libcamera:
 
 std::vector<libcamera::Span<uint8_t>> CameraWrapper::Mmap(libcamera::FrameBuffer *buffer) const
 {
+    // The pipeline itself never touches pixels, so buffers are only mapped on first use
+    const std::lock_guard lock(mappingMutex_);
     const auto item = mapped_buffers_.find(buffer);
-    if (item == mapped_buffers_.end())
+    if (item != mapped_buffers_.end())
+    {
+        return item->second;
+    }
+    return mmapBuffer(buffer);
+}
+
+size_t CameraWrapper::GetFrameBufferSize(const libcamera::FrameBuffer *buffer) const
+{
+    // Planes sharing the first plane's fd form the image handed over as a single DMABUF
+    size_t size = 0;
+    for (const auto &plane : buffer->planes())
+    {
+        if (plane.fd.get() == buffer->planes()[0].fd.get())
+        {
+            size += plane.length;
+        }
+    }
+    return size;
+}
+
+ComponentFootprint CameraWrapper::GetMemoryFootprint() const
+{
+    ComponentFootprint footprint;
+    for (const auto &config : *configuration_)
+    {
+        for (const auto &buffer : allocator_->buffers(config.stream()))
+        {
+            for (const auto &plane : buffer->planes())
+            {
+                footprint.DmabufBytes += plane.length;
+            }
+        }
+    }
+    const std::lock_guard lock(mappingMutex_);
+    for (const auto &[buffer, spans] : mapped_buffers_)
+    {
+        for (const auto &span : spans)
+        {
+            footprint.MmapBytes += span.size();
+        }
+    }
+    // Parked requests grow on the encoder's thread, giving them back
+    const std::lock_guard reuseLock(reuseMutex_);
+    footprint.HeapBytes = requests_.size() * sizeof(libcamera::Request) + parkedRequests_.capacity() * sizeof(void *)
+                          + sizeof(completedRequestsQueue_);
+    return footprint;
+}
+
+void CameraWrapper::ReuseRequest(uint64_t cookie)
+{
+    // Called both by the encoder once a frame is consumed and directly for skipped frames
+    const std::lock_guard lock(reuseMutex_);
+    libcamera::Request *request = requests_.at(cookie).get();
+    requestsHeld_.Release();
+    if (!started_)
+    {
+        // The codec hands frames back until it is stopped too; StartCamera() queues them again
+        return;
+    }
+    if (requests_.size() - parkedRequests_.size() > activeRequests_)
+    {
+        parkedRequests_.push_back(request);
+        return;
+    }
+    queueReusedRequest(request);
+    while (!parkedRequests_.empty() && requests_.size() - parkedRequests_.size() < activeRequests_)
     {
-        return {};
+        queueReusedRequest(parkedRequests_.back());
+        parkedRequests_.pop_back();
     }
-    return item->second;
 }
 
-void CameraWrapper::ReuseRequest()
+BufferPoolUsage CameraWrapper::GetRequestUsage() const
+{
+    BufferPoolUsage usage;
+    usage.Allocated = requests_.size();
+    usage.Active = activeRequests_;
+    usage.PeakInUse = requestsHeld_.Peak();
+    return usage;
+}
+
+void CameraWrapper::ResetRequestUsagePeak()
+{
+    requestsHeld_.ResetPeak();
+}
+
+void CameraWrapper::SetActiveRequests(unsigned int count)
+{
+    activeRequests_ = std::clamp<unsigned int>(count, 1, requests_.size());
+}
+
+void CameraWrapper::SetFramerate(float framerate)
+{
+    const int64_t frameTime = 1000000 / framerate; // in us
+    const std::lock_guard lock(reuseMutex_);
+    pendingFrameDuration_ = frameTime;
+}
+
+void CameraWrapper::queueReusedRequest(libcamera::Request *request)
 {
-    libcamera::Request *request;
-    requestsToReuseQueue_.wait_dequeue(request);
     request->reuse(libcamera::Request::ReuseBuffers);
+    // On the Raspberry Pi, zero exposure, gain and colour gains return control to AE/AWB, which
+    // then continue from the seeded values rather than from their defaults.
+    if (releaseWarmStartExposure_)
+    {
+        request->controls().set(libcamera::controls::ExposureTime, 0);
+        request->controls().set(libcamera::controls::AnalogueGain, 0.0f);
+        releaseWarmStartExposure_ = false;
+    }
+    if (releaseWarmStartColourGains_)
+    {
+        request->controls().set(libcamera::controls::ColourGains, libcamera::Span<const float, 2>({0.0f, 0.0f}));
+        releaseWarmStartColourGains_ = false;
+    }
+    if (pendingFrameDuration_)
+    {
+        // The sensor follows within a few frames, as the requests ahead of this one drain
+        request->controls().set(libcamera::controls::FrameDurationLimits,
+                                libcamera::Span<const int64_t, 2>({*pendingFrameDuration_, *pendingFrameDuration_}));
+        pendingFrameDuration_.reset();
+    }
+    requestsInFlight_++;
     camera_->queueRequest(request);
 }
 
+ConvergenceStats CameraWrapper::GetConvergenceStats() const
+{
+    const std::lock_guard lock(convergenceMutex_);
+    return convergence_.Stats();
+}
+
+bool CameraWrapper::applyWarmStart(WarmStartState const &state)
+{
+    // Explicit settings from the options always win over the persisted ones
+    if (options_->gain == 0)
+    {
+        controls_.set(libcamera::controls::ExposureTime, state.ExposureTime);
+        controls_.set(libcamera::controls::AnalogueGain, state.AnalogueGain);
+        releaseWarmStartExposure_ = true;
+    }
+    if (!options_->awb_gain_r && !options_->awb_gain_b && state.ColourGainRed > 0 && state.ColourGainBlue > 0)
+    {
+        controls_.set(libcamera::controls::ColourGains,
+                      libcamera::Span<const float, 2>({state.ColourGainRed, state.ColourGainBlue}));
+        releaseWarmStartColourGains_ = true;
+    }
+    spdlog::info("Warm start: exposure {} us, gain {}, colour gains {} {}",
+                 state.ExposureTime, state.AnalogueGain, state.ColourGainRed, state.ColourGainBlue);
+    return releaseWarmStartExposure_ || releaseWarmStartColourGains_;
+}
+
 void CameraWrapper::allocateBuffers()
 {
     spdlog::trace("START Frame buffers allocation");
 
-    allocator_ = new libcamera::FrameBufferAllocator(camera_);
-    libcamera::Stream *stream = configuration_->at(0).stream();
-
-    if (allocator_->allocate(stream) < 0)
+    allocator_ = std::make_unique<libcamera::FrameBufferAllocator>(camera_);
+    for (libcamera::StreamConfiguration &config : *configuration_)
     {
-        throw std::runtime_error("failed to allocate capture buffers");
+        libcamera::Stream *stream = config.stream();
+        if (allocator_->allocate(stream) < 0)
+        {
+            throw std::runtime_error("failed to allocate capture buffers");
+        }
+
+        for (const std::unique_ptr<libcamera::FrameBuffer> &buffer : allocator_->buffers(stream))
+        {
+            frame_buffers_[stream].push(buffer.get());
+        }
     }
 
-    for (const std::unique_ptr<libcamera::FrameBuffer> &buffer : allocator_->buffers(stream))
+    spdlog::trace("END Frame buffers allocation");
+}
+
+std::vector<libcamera::Span<uint8_t>> &CameraWrapper::mmapBuffer(libcamera::FrameBuffer *buffer) const
+{
+    // "Single plane" buffers appear as multi-plane here, but we can spot them because then
+    // planes all share the same fd. We accumulate them so as to mmap the buffer only once.
+    size_t buffer_size = 0;
+    for (unsigned i = 0; i < buffer->planes().size(); i++)
     {
-        // "Single plane" buffers appear as multi-plane here, but we can spot them because then
-        // planes all share the same fd. We accumulate them so as to mmap the buffer only once.
-        size_t buffer_size = 0;
-        for (unsigned i = 0; i < buffer->planes().size(); i++)
+        const auto &plane = buffer->planes()[i];
+        buffer_size += plane.length;
+        if (i == buffer->planes().size() - 1 || plane.fd.get() != buffer->planes()[i + 1].fd.get())
         {
-            const auto &plane = buffer->planes()[i];
-            buffer_size += plane.length;
-            if (i == buffer->planes().size() - 1 || plane.fd.get() != buffer->planes()[i + 1].fd.get())
+            void *memory = mmap(nullptr,
+                                buffer_size,
+                                PROT_READ | PROT_WRITE,
+                                MAP_SHARED,
+                                plane.fd.get(),
+                                0);
+            if (memory == MAP_FAILED)
             {
-                void *memory = mmap(nullptr,
-                                    buffer_size,
-                                    PROT_READ | PROT_WRITE,
-                                    MAP_SHARED,
-                                    plane.fd.get(),
-                                    0);
-                mapped_buffers_[buffer.get()].push_back(
-                    libcamera::Span<uint8_t>(static_cast<uint8_t *>(memory), buffer_size));
-                buffer_size = 0;
+                throw std::runtime_error("failed to mmap camera buffer");
             }
+            mapped_buffers_[buffer].push_back(
+                libcamera::Span<uint8_t>(static_cast<uint8_t *>(memory), buffer_size));
+            buffer_size = 0;
         }
-        frame_buffers_.push(buffer.get());
     }
-
-    spdlog::trace("END Frame buffers allocation");
+    return mapped_buffers_[buffer];
 }
 
+std::optional<SensorMode> CameraWrapper::selectSensorMode() const
+{
+    if (options_->mode_string.empty())
+    {
+        return std::nullopt;
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    std::optional<std::vector<SensorMode>> modes;
+    if (!options_->sensor_mode_cache_file.empty())
+    {
+        modes = LoadSensorModeCache(options_->sensor_mode_cache_file, camera_->id());
+    }
+    if (!modes)
+    {
+        modes = EnumerateSensorModes(*camera_);
+        if (!options_->sensor_mode_cache_file.empty())
+        {
+            SaveSensorModeCache(options_->sensor_mode_cache_file, camera_->id(), *modes);
+        }
+    }
+    spdlog::debug("Sensor modes ready in {} ms",
+                  std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin)
+                      .count());
+    for (const auto &mode : *modes)
+    {
+        spdlog::debug("Sensor mode {}", mode.ToString());
+    }
+
+    std::optional<SensorMode> sensorMode;
+    if (options_->mode_string == "auto")
+    {
+        sensorMode = ChooseSensorMode(*modes, options_->width, options_->height, options_->framerate);
+    }
+    else
+    {
+        sensorMode = FindSensorMode(*modes, Mode(options_->mode_string));
+    }
+    if (!sensorMode)
+    {
+        throw std::runtime_error("no sensor mode matches " + options_->mode_string);
+    }
+    spdlog::info("Using sensor mode {}", sensorMode->ToString());
+    return sensorMode;
+}
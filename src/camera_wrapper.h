@@ -1,45 +1,106 @@
 #ifndef CAMERA_WRAPPER_H
 #define CAMERA_WRAPPER_H
+#include <mutex>
 #include <queue>
-#include "readerwriterqueue/readerwriterqueue.h"
 
 #include <libcamera/libcamera.h>
 
+#include "frame_trace.h"
+#include "sensor_modes.h"
+#include "spsc_ring.hpp"
 #include "stream_info.hpp"
+#include "buffer_pool_usage.hpp"
+#include "memory_footprint.hpp"
+#include "warm_start.h"
 #include "libcamera-streamer/camera_options.hpp"
 
 class CameraWrapper
 {
+public:
+    // Upper bound on the requests made, one per frame buffer, which sizes the completion ring
+    static constexpr size_t MaxRequests = 32;
+
 private:
     std::unique_ptr<libcamera::CameraManager> cameraManager_;
     std::shared_ptr<libcamera::Camera> camera_;
     libcamera::ControlList controls_;
     CameraOptions *options_;
-    std::queue<libcamera::FrameBuffer *> frame_buffers_;
-    std::map<libcamera::FrameBuffer *, std::vector<libcamera::Span<uint8_t>>> mapped_buffers_;
+    std::map<libcamera::Stream *, std::queue<libcamera::FrameBuffer *>> frame_buffers_;
+    mutable std::mutex mappingMutex_;
+    mutable std::map<libcamera::FrameBuffer *, std::vector<libcamera::Span<uint8_t>>> mapped_buffers_;
     std::vector<std::unique_ptr<libcamera::Request>> requests_;
     std::unique_ptr<libcamera::CameraConfiguration> configuration_;
-    libcamera::FrameBufferAllocator *allocator_ = nullptr;
+    std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
+
+    // Cookies of completed requests, from the libcamera thread to the pipeline
+    SpscRing<uint64_t, MaxRequests> completedRequestsQueue_;
+
+    // Requests queued in libcamera and requests completed but not yet given back
+    std::atomic<unsigned int> requestsInFlight_{0};
+    BufferUseCounter requestsHeld_;
+    std::atomic<unsigned int> activeRequests_{0};
+    std::atomic<bool> started_{false};
+    mutable std::mutex reuseMutex_;
+    std::vector<libcamera::Request *> parkedRequests_;
+    // Applied to the next request requeued, then the sensor keeps it
+    std::optional<int64_t> pendingFrameDuration_;
 
-    moodycamel::BlockingReaderWriterQueue<libcamera::Request *> completedRequestsQueue_;
-    moodycamel::BlockingReaderWriterQueue<libcamera::Request *> requestsToReuseQueue_;
+    mutable std::mutex convergenceMutex_;
+    ConvergenceTracker convergence_;
+    // Seeded values to hand back to the AE/AWB algorithms with the first reused request
+    bool releaseWarmStartExposure_ = false;
+    bool releaseWarmStartColourGains_ = false;
+    FrameTrace *trace_ = nullptr;
 
 public:
     CameraWrapper(std::unique_ptr<libcamera::CameraManager> cameraManager, std::string const &cameraId,
                   CameraOptions *options);
     ~CameraWrapper();
 
+    // Applies the validated configuration, allocates frame buffers and makes the requests.
+    // Split from the constructor so the stream geometry is known before this slow part runs.
+    void Configure();
+    // Frees the buffers and requests and generates a new configuration from the options, which
+    // Configure() then applies as after construction. Only while the camera is stopped.
+    void ResetConfiguration();
+    // Queues every active request, also to restart after StopCamera(): requests completed but
+    // not given back by then are abandoned, so only once nothing waits for or holds them
     void StartCamera();
+    // Waits for libcamera to complete or cancel the requests in flight; does nothing if stopped
     void StopCamera();
+    // nullptr once InterruptCompletedRequestWait() was called, until the next StartCamera()
     libcamera::Request *WaitForCompletedRequest();
+    // From any thread, wakes the waiter in WaitForCompletedRequest() for it to stop
+    void InterruptCompletedRequestWait();
+    size_t CompletedRequestsQueued() const { return completedRequestsQueue_.SizeApprox(); }
     StreamInfo GetStreamInfo();
     libcamera::FrameBuffer *GetFrameBufferForRequest(const libcamera::Request *request) const;
     std::vector<libcamera::Span<uint8_t>> Mmap(libcamera::FrameBuffer *buffer) const;
-    void ReuseRequest();
+    size_t GetFrameBufferSize(const libcamera::FrameBuffer *buffer) const;
+    ComponentFootprint GetMemoryFootprint() const;
+    // Requeues the request created with the given cookie
+    void ReuseRequest(uint64_t cookie);
+    BufferPoolUsage GetRequestUsage() const;
+    void ResetRequestUsagePeak();
+    // Limits how many requests circulate, without freeing the others
+    void SetActiveRequests(unsigned int count);
+    // Changes the frame duration limits from the next request queued, without stopping
+    void SetFramerate(float framerate);
+    ConvergenceStats GetConvergenceStats() const;
+    // Starts a trace record for every completed frame; set before the camera is started
+    void SetFrameTrace(FrameTrace *trace) { trace_ = trace; }
+    // How the pipeline waits for completed requests; set before the camera is started
+    void SetQueueWaitStrategy(WaitStrategy strategy) { completedRequestsQueue_.SetWaitStrategy(strategy); }
 
 private:
+    void generateConfiguration();
+    void releaseBuffers();
     void makeRequests();
+    void queueReusedRequest(libcamera::Request *request);
     void requestComplete(libcamera::Request *request);
     void allocateBuffers();
+    std::vector<libcamera::Span<uint8_t>> &mmapBuffer(libcamera::FrameBuffer *buffer) const;
+    std::optional<SensorMode> selectSensorMode() const;
+    bool applyWarmStart(WarmStartState const &state);
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,32 @@
+#include "clock_conversion.h"
+
+#include <time.h>
+
+namespace
+{
+    // Seconds from the NTP epoch (1900) to the Unix epoch
+    constexpr uint64_t NtpUnixOffsetSeconds = 2208988800ull;
+
+    int64_t toNs(timespec const &time)
+    {
+        return time.tv_sec * 1000000000ll + time.tv_nsec;
+    }
+
+    // CLOCK_REALTIME minus CLOCK_MONOTONIC, read between two monotonic samples to halve the error
+    int64_t realtimeOffsetNs()
+    {
+        timespec before, realtime, after;
+        clock_gettime(CLOCK_MONOTONIC, &before);
+        clock_gettime(CLOCK_REALTIME, &realtime);
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        return toNs(realtime) - (toNs(before) + toNs(after)) / 2;
+    }
+}
+
+uint64_t MonotonicToNtp(int64_t timestampUs)
+{
+    const int64_t realtimeNs = timestampUs * 1000 + realtimeOffsetNs();
+    const uint64_t seconds = realtimeNs / 1000000000 + NtpUnixOffsetSeconds;
+    const uint64_t fraction = (static_cast<uint64_t>(realtimeNs % 1000000000) << 32) / 1000000000;
+    return (seconds << 32) | fraction;
+}
@@ -0,0 +1,42 @@
+#ifndef CLOCK_CONVERSION_H
+#define CLOCK_CONVERSION_H
+
+#include <cstdint>
+#include <sys/time.h>
+#include <time.h>
+
+// Conversions of the sensor timestamp (CLOCK_MONOTONIC, microseconds) into the forms it takes
+// on its way through the pipeline: V4L2 buffer timestamps, RTP timestamps and NTP time.
+
+// V4L2 buffers carry the timestamp as a timeval, which the codec copies to the encoded frame
+inline timeval MicrosecondsToTimeval(int64_t timestampUs)
+{
+    timeval time = {};
+    time.tv_sec = timestampUs / 1000000;
+    time.tv_usec = timestampUs % 1000000;
+    return time;
+}
+
+inline int64_t TimevalToMicroseconds(timeval const &time)
+{
+    return time.tv_sec * static_cast<int64_t>(1000000) + time.tv_usec;
+}
+
+// RTP timestamp at a clock rate that is a multiple of 100 Hz, from a random start. Wraps modulo
+// 2^32 like the RTP timestamp itself.
+inline uint32_t MonotonicToRtp(int64_t timestampUs, uint32_t clockRate, uint32_t offset)
+{
+    return offset + static_cast<uint32_t>(timestampUs * (clockRate / 10000) / 100);
+}
+
+inline int64_t MonotonicNowUs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * static_cast<int64_t>(1000000) + now.tv_nsec / 1000;
+}
+
+// 32.32 fixed point NTP time of a CLOCK_MONOTONIC timestamp
+uint64_t MonotonicToNtp(int64_t timestampUs);
+
+#endif
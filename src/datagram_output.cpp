@@ -0,0 +1,246 @@
+#include "datagram_output.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "clock_conversion.h"
+#include "datagram_socket.h"
+#include "nal_index.h"
+
+namespace
+{
+    // A forwarder that stopped reading costs the frame rather than blocking the output thread
+    // until the watchdog steps in
+    constexpr int SendTimeoutMs = 200;
+    constexpr uint32_t ClockRate = 90000;
+
+    bool endsWithStartCode(const uint8_t *data, size_t size)
+    {
+        return size >= 3 && data[size - 3] == 0 && data[size - 2] == 0 && data[size - 1] == 1;
+    }
+}
+
+DatagramOutput::DatagramOutput(OutputOptions const *options)
+    : options_(options)
+{
+    if (options_->DatagramSize <= HeaderSize)
+    {
+        throw std::runtime_error("datagram size " + std::to_string(options_->DatagramSize) + " leaves no room for a payload");
+    }
+    payloadSize_ = options_->DatagramSize - HeaderSize;
+    open();
+}
+
+DatagramOutput::~DatagramOutput()
+{
+    close();
+}
+
+void DatagramOutput::Reconnect()
+{
+    close();
+    open();
+    spdlog::info("DatagramOutput: reconnected");
+}
+
+void DatagramOutput::open()
+{
+    if (options_->Transport == OutputTransport::UnixDatagram)
+    {
+        socket_ = ConnectUnixDatagramSocket(options_->SocketPath);
+    }
+    else
+    {
+        socket_ = ConnectUdpSocket(options_->Ip, options_->Port);
+    }
+    const timeval timeout = {0, SendTimeoutMs * 1000};
+    setsockopt(socket_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (options_->Transport == OutputTransport::UnixDatagram)
+    {
+        spdlog::debug("DatagramOutput: sending {} byte datagrams to {}", options_->DatagramSize, options_->SocketPath);
+    }
+    else
+    {
+        spdlog::debug("DatagramOutput: sending {} byte datagrams to {}:{}", options_->DatagramSize, options_->Ip,
+                      options_->Port);
+    }
+}
+
+void DatagramOutput::close()
+{
+    if (socket_ >= 0)
+    {
+        ::close(socket_);
+        socket_ = -1;
+    }
+}
+
+bool DatagramOutput::SendFrame(FrameFragment const *fragments, size_t count, int64_t captureTimestampUs)
+{
+    lastPacketCount_ = 0;
+    if (socket_ < 0)
+    {
+        return false;
+    }
+    headers_.clear();
+    parts_.clear();
+    const uint32_t timestamp = MonotonicToRtp(captureTimestampUs, ClockRate, 0);
+    if (nalAligned(fragments, count))
+    {
+        // The SEI, the injected parameter sets and the pieces the SPS rewrite cuts the access unit
+        // into each hold whole NAL units, sent from where they are
+        bool inNalUnit = false;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (fragments[i].Size > 0)
+            {
+                addNalUnits(fragments[i].Data, fragments[i].Size, inNalUnit, timestamp);
+                inNalUnit = endsWithStartCode(fragments[i].Data, fragments[i].Size);
+            }
+        }
+    }
+    else
+    {
+        // Cut anywhere else, NAL units and even start codes may straddle fragments
+        size_t size = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            size += fragments[i].Size;
+        }
+        if (staging_.size() < size)
+        {
+            staging_.resize(size);
+        }
+        size_t offset = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            std::memcpy(staging_.data() + offset, fragments[i].Data, fragments[i].Size);
+            offset += fragments[i].Size;
+        }
+        addNalUnits(staging_.data(), size, false, timestamp);
+    }
+    if (headers_.empty())
+    {
+        return true;
+    }
+    headers_.back()[2] |= FrameEnd;
+    return sendDatagrams();
+}
+
+bool DatagramOutput::nalAligned(FrameFragment const *fragments, size_t count)
+{
+    bool inNalUnit = false;
+    bool first = true;
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8_t *data = fragments[i].Data;
+        const size_t size = fragments[i].Size;
+        if (size == 0)
+        {
+            continue;
+        }
+        // Each fragment after the first starts with a start code, or with the NAL unit whose start
+        // code ended the one before and which it holds whole
+        if (!first && !inNalUnit && FindStartCode(data, size, 0) != 0)
+        {
+            return false;
+        }
+        inNalUnit = endsWithStartCode(data, size);
+        first = false;
+    }
+    return true;
+}
+
+void DatagramOutput::addNalUnits(const uint8_t *data, size_t size, bool inNalUnit, uint32_t timestamp)
+{
+    size_t startCode = FindStartCode(data, size, 0);
+    if (inNalUnit)
+    {
+        addNalUnit(data, startCode, timestamp);
+    }
+    while (startCode < size)
+    {
+        size_t nal = startCode;
+        while (data[nal] == 0)
+        {
+            nal++;
+        }
+        nal++;
+        startCode = FindStartCode(data, size, nal);
+        addNalUnit(data + nal, startCode - nal, timestamp);
+    }
+}
+
+void DatagramOutput::addNalUnit(const uint8_t *nal, size_t size, uint32_t timestamp)
+{
+    // Trailing zero bytes belong to the byte stream, not to the NAL unit: each one ends at a start
+    // code or at the end of the access unit
+    while (size > 0 && nal[size - 1] == 0)
+    {
+        size--;
+    }
+    if (size > 0)
+    {
+        addDatagrams(nal, size, timestamp);
+    }
+}
+
+void DatagramOutput::addDatagrams(const uint8_t *nal, size_t size, uint32_t timestamp)
+{
+    for (size_t offset = 0; offset < size; offset += payloadSize_)
+    {
+        const uint16_t sequence = sequence_++;
+        const uint8_t flags = (offset == 0 ? NalStart : 0) | (offset + payloadSize_ >= size ? NalEnd : 0);
+        headers_.push_back({static_cast<uint8_t>(sequence >> 8), static_cast<uint8_t>(sequence & 0xff), flags,
+                            HeaderVersion, static_cast<uint8_t>(timestamp >> 24),
+                            static_cast<uint8_t>((timestamp >> 16) & 0xff), static_cast<uint8_t>((timestamp >> 8) & 0xff),
+                            static_cast<uint8_t>(timestamp & 0xff)});
+        // The header's iovec is filled in once headers_ has stopped growing
+        parts_.push_back({nullptr, HeaderSize});
+        parts_.push_back({const_cast<uint8_t *>(nal + offset), std::min(payloadSize_, size - offset)});
+    }
+}
+
+bool DatagramOutput::sendDatagrams()
+{
+    const size_t datagrams = headers_.size();
+    messages_.resize(datagrams);
+    for (size_t i = 0; i < datagrams; i++)
+    {
+        parts_[2 * i].iov_base = headers_[i].data();
+        messages_[i] = {};
+        messages_[i].msg_hdr.msg_iov = &parts_[2 * i];
+        messages_[i].msg_hdr.msg_iovlen = 2;
+    }
+    size_t sent = 0;
+    while (sent < datagrams)
+    {
+        // The kernel takes at most UIO_MAXIOV messages per call and says how many it took
+        const int result = sendmmsg(socket_, messages_.data() + sent, datagrams - sent, 0);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            spdlog::debug("DatagramOutput: {} of {} datagrams sent, errno {}", sent, datagrams, errno);
+            lastPacketCount_ = sent;
+            return false;
+        }
+        sent += result;
+    }
+    lastPacketCount_ = sent;
+    return true;
+}
+
+size_t DatagramOutput::HeapBytes() const
+{
+    return staging_.capacity() + headers_.capacity() * sizeof(headers_[0]) + parts_.capacity() * sizeof(iovec)
+           + messages_.capacity() * sizeof(mmsghdr);
+}
@@ -0,0 +1,69 @@
+#ifndef DATAGRAM_OUTPUT_H
+#define DATAGRAM_OUTPUT_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "frame_output.hpp"
+#include "libcamera-streamer/output_options.hpp"
+
+// Hands encoded frames to a forwarder on the same host, such as wfb-ng, as plain datagrams over a
+// Unix datagram socket or UDP, without the RTP session or its extra copy. Every datagram carries
+// part of one NAL unit, without its start code, behind an 8 byte header (big endian):
+//
+//   uint16  sequence number, counting datagrams
+//   uint8   flags: NalStart, NalEnd, FrameEnd
+//   uint8   HeaderVersion
+//   uint32  capture time on the 90 kHz RTP clock
+//
+// so a receiver rebuilds the Annex-B stream by putting a start code ahead of each NalStart
+// payload. A frame's datagrams leave in as few sendmmsg() calls as the kernel accepts.
+class DatagramOutput : public FrameOutput
+{
+public:
+    static constexpr size_t HeaderSize = 8;
+    static constexpr uint8_t HeaderVersion = 1;
+    static constexpr uint8_t NalStart = 1 << 0;
+    static constexpr uint8_t NalEnd = 1 << 1;
+    static constexpr uint8_t FrameEnd = 1 << 2;
+
+private:
+    OutputOptions const *options_;
+    int socket_ = -1;
+    size_t payloadSize_;
+    uint16_t sequence_ = 0;
+    // Gathers frames whose fragments are not NAL-aligned, which the streamer's own never are
+    std::vector<uint8_t> staging_;
+    // Per datagram, reused from frame to frame
+    std::vector<std::array<uint8_t, HeaderSize>> headers_;
+    std::vector<iovec> parts_;
+    std::vector<mmsghdr> messages_;
+    size_t lastPacketCount_ = 0;
+
+public:
+    explicit DatagramOutput(OutputOptions const *options);
+    ~DatagramOutput() override;
+
+    bool SendFrame(FrameFragment const *fragments, size_t count, int64_t captureTimestampUs) override;
+    void Reconnect() override;
+
+    size_t LastPacketCount() const override { return lastPacketCount_; }
+    size_t HeapBytes() const override;
+
+private:
+    void open();
+    void close();
+    // Every fragment after the first starts on a start code or a NAL unit boundary
+    static bool nalAligned(FrameFragment const *fragments, size_t count);
+    // The NAL units of an Annex-B buffer, the first one running from its start when inNalUnit
+    void addNalUnits(const uint8_t *data, size_t size, bool inNalUnit, uint32_t timestamp);
+    // Adds the datagrams of a NAL unit, trailing zero bytes dropped
+    void addNalUnit(const uint8_t *nal, size_t size, uint32_t timestamp);
+    void addDatagrams(const uint8_t *nal, size_t size, uint32_t timestamp);
+    bool sendDatagrams();
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "datagram_socket.h"
+
+#include <cstddef>
+#include <cstring>
+#include <netdb.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int ConnectUdpSocket(std::string const &host, uint16_t port)
+{
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo *addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0 || !addresses)
+    {
+        throw std::runtime_error("failed to resolve " + host);
+    }
+    const int fd = socket(addresses->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, addresses->ai_addr, addresses->ai_addrlen) < 0)
+    {
+        freeaddrinfo(addresses);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        throw std::runtime_error("failed to connect to " + host + ":" + std::to_string(port));
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+int ConnectUnixDatagramSocket(std::string const &path)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path))
+    {
+        throw std::runtime_error("invalid Unix socket path \"" + path + "\"");
+    }
+    std::memcpy(address.sun_path, path.data(), path.size());
+    socklen_t length = sizeof(address);
+    if (path[0] == '@')
+    {
+        // Abstract names are not null-terminated, their length is the address length
+        address.sun_path[0] = '\0';
+        length = offsetof(sockaddr_un, sun_path) + path.size();
+    }
+    const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address), length) < 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        throw std::runtime_error("failed to connect to " + path);
+    }
+    return fd;
+}
@@ -0,0 +1,16 @@
+#ifndef DATAGRAM_SOCKET_H
+#define DATAGRAM_SOCKET_H
+
+#include <cstdint>
+#include <string>
+
+// Blocking datagram sockets connected to a single destination, so sends need no address. Both
+// throw std::runtime_error when the destination cannot be resolved or connected to.
+
+// UDP to a host name or address, IPv4 or IPv6
+int ConnectUdpSocket(std::string const &host, uint16_t port);
+// A Unix datagram socket bound by a process on the same host; a leading '@' names one in the
+// abstract namespace
+int ConnectUnixDatagramSocket(std::string const &path);
+
+#endif
@@ -0,0 +1,54 @@
+#include "dma_heap.h"
+
+#include <fcntl.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "spdlog/spdlog.h"
+
+#include "v4l2_ioctl.hpp"
+
+namespace
+{
+    // The names differ between kernel versions and device trees
+    constexpr const char *HeapPaths[] = {"/dev/dma_heap/vidbuf_cached", "/dev/dma_heap/linux,cma",
+                                         "/dev/dma_heap/reserved"};
+}
+
+DmaHeap::DmaHeap()
+{
+    for (const char *path : HeapPaths)
+    {
+        fd_ = open(path, O_RDWR | O_CLOEXEC, 0);
+        if (fd_ >= 0)
+        {
+            path_ = path;
+            spdlog::debug("DmaHeap: allocating from {}", path_);
+            return;
+        }
+    }
+    throw std::runtime_error("no DMA heap available, tried /dev/dma_heap/{vidbuf_cached,linux,cma,reserved}");
+}
+
+DmaHeap::~DmaHeap()
+{
+    close(fd_);
+}
+
+int DmaHeap::Allocate(size_t size, std::string const &name) const
+{
+    dma_heap_allocation_data allocation = {};
+    allocation.len = size;
+    allocation.fd_flags = O_RDWR | O_CLOEXEC;
+    if (Xioctl(fd_, DMA_HEAP_IOCTL_ALLOC, &allocation) < 0)
+    {
+        throw std::runtime_error("failed to allocate " + std::to_string(size) + " bytes from " + path_);
+    }
+    const int fd = static_cast<int>(allocation.fd);
+    // Only shows up in debugfs, failing to name the buffer is harmless
+    ioctl(fd, DMA_BUF_SET_NAME, name.c_str());
+    return fd;
+}
@@ -0,0 +1,29 @@
+#ifndef DMA_HEAP_H
+#define DMA_HEAP_H
+
+#include <cstddef>
+#include <string>
+
+// Allocates dma-buf file descriptors from a kernel DMA heap, for frames that do not come from the
+// camera but must be handed to the encoder as DMABUF. The Pi's codec needs physically contiguous
+// memory, so the CMA heaps are tried first.
+class DmaHeap
+{
+private:
+    int fd_ = -1;
+    std::string path_;
+
+public:
+    // Opens the first heap available, throws when there is none
+    DmaHeap();
+    ~DmaHeap();
+
+    DmaHeap(DmaHeap const &) = delete;
+    DmaHeap &operator=(DmaHeap const &) = delete;
+
+    // A new dma-buf of at least size bytes, throws on failure. The caller owns the descriptor.
+    int Allocate(size_t size, std::string const &name) const;
+    std::string const &Path() const { return path_; }
+};
+
+#endif
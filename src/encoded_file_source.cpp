@@ -0,0 +1,124 @@
+#include "encoded_file_source.h"
+
+#include <stdexcept>
+#include <thread>
+
+#include "spdlog/spdlog.h"
+
+#include "nal_index.h"
+
+namespace
+{
+    constexpr uint8_t NalUnitTypeAud = 9;
+
+    int64_t toMicroseconds(std::chrono::steady_clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+    }
+}
+
+EncodedFileSource::EncodedFileSource(std::string const &path, ReplayOptions const &options)
+    : file_(path), options_(options)
+{
+    accessUnits_ = IndexAccessUnits(file_.Data(), file_.Size());
+    if (accessUnits_.empty())
+    {
+        throw std::runtime_error(path + " holds no H.264 access units");
+    }
+    spdlog::info("Replaying {}: {} access units, {} KiB", path, accessUnits_.size(), file_.Size() >> 10);
+}
+
+std::optional<OutputItem> EncodedFileSource::WaitForNextOutputItem()
+{
+    if (next_ == accessUnits_.size())
+    {
+        if (!options_.Loop)
+        {
+            return std::nullopt;
+        }
+        next_ = 0;
+    }
+
+    auto timestamp = std::chrono::steady_clock::now();
+    if (options_.Framerate > 0)
+    {
+        const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(1 / options_.Framerate));
+        // Paced against the schedule rather than the previous frame, so a late frame does not
+        // delay every one after it
+        due_ = due_ ? *due_ + interval : timestamp;
+        std::this_thread::sleep_until(*due_);
+        timestamp = *due_;
+    }
+
+    AccessUnit const &accessUnit = accessUnits_[next_];
+    OutputItem item{};
+    item.mem = const_cast<uint8_t *>(file_.Data() + accessUnit.Offset);
+    item.bytes_used = accessUnit.Size;
+    item.length = accessUnit.Size;
+    item.index = static_cast<unsigned int>(next_);
+    item.keyframe = accessUnit.Keyframe;
+    item.timestamp_us = toMicroseconds(timestamp);
+    item.sequence = sequence_++;
+    next_++;
+    return item;
+}
+
+std::vector<EncodedFileSource::AccessUnit> EncodedFileSource::IndexAccessUnits(const uint8_t *data, size_t size)
+{
+    std::vector<AccessUnit> accessUnits;
+    std::optional<AccessUnit> current;
+    bool hasPicture = false;
+    const auto finish = [&](size_t end) {
+        if (current && hasPicture)
+        {
+            current->Size = end - current->Offset;
+            accessUnits.push_back(*current);
+        }
+        current.reset();
+        hasPicture = false;
+    };
+
+    size_t startCode = FindStartCode(data, size, 0);
+    while (startCode < size)
+    {
+        const size_t header = startCode + (data[startCode + 2] == 1 ? 3 : 4);
+        if (header >= size)
+        {
+            break;
+        }
+        const size_t next = FindStartCode(data, size, header + 1);
+        const uint8_t type = data[header] & 0x1f;
+        if (IsVclNalUnit(type))
+        {
+            // first_mb_in_slice is ue(v) coded, a leading 1 bit is 0
+            const bool firstSlice = header + 1 < next && (data[header + 1] & 0x80) != 0;
+            if (hasPicture && firstSlice)
+            {
+                finish(startCode);
+            }
+            if (!current)
+            {
+                current = AccessUnit{startCode, 0, false};
+            }
+            hasPicture = true;
+            current->Keyframe |= type == NalUnitTypeIdr;
+        }
+        else
+        {
+            const bool startsAccessUnit = type == NalUnitTypeAud || type == NalUnitTypeSei || type == NalUnitTypeSps
+                                          || type == NalUnitTypePps;
+            if (hasPicture && startsAccessUnit)
+            {
+                finish(startCode);
+            }
+            if (!current)
+            {
+                current = AccessUnit{startCode, 0, false};
+            }
+        }
+        startCode = next;
+    }
+    finish(size);
+    return accessUnits;
+}
@@ -0,0 +1,61 @@
+#ifndef ENCODED_FILE_SOURCE_H
+#define ENCODED_FILE_SOURCE_H
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+#include "output_item.hpp"
+
+struct ReplayOptions
+{
+    // Frames per second to pace the replay at, 0 to emit frames as fast as they are taken
+    float Framerate = 30;
+    // Start over from the first access unit at the end of the file instead of ending the replay
+    bool Loop = false;
+};
+
+// Replays a recorded H.264 Annex-B file in place of the camera and encoder, to measure the output
+// half of the pipeline with a real bitstream. The file is memory-mapped and its access units are
+// indexed once at construction; the OutputItems handed out point straight into the mapping,
+// which stays valid for the lifetime of the source. Consumers must not write to them.
+//
+// Timestamps are on CLOCK_MONOTONIC like the sensor's: the time each frame was due when paced,
+// the time it was taken otherwise.
+class EncodedFileSource
+{
+public:
+    struct AccessUnit
+    {
+        size_t Offset;
+        size_t Size;
+        bool Keyframe;
+    };
+
+private:
+    MappedFile file_;
+    ReplayOptions options_;
+    std::vector<AccessUnit> accessUnits_;
+
+    size_t next_ = 0;
+    uint32_t sequence_ = 0;
+    std::optional<std::chrono::steady_clock::time_point> due_;
+
+public:
+    EncodedFileSource(std::string const &path, ReplayOptions const &options);
+
+    // The next access unit, waiting for its time when paced. Empty at the end of the file.
+    std::optional<OutputItem> WaitForNextOutputItem();
+
+    std::vector<AccessUnit> const &AccessUnits() const { return accessUnits_; }
+    size_t FileBytes() const { return file_.Size(); }
+
+    // Splits an Annex-B byte stream into access units at access unit delimiters, parameter sets or
+    // SEI following a picture, and slices starting a new picture (first_mb_in_slice 0)
+    static std::vector<AccessUnit> IndexAccessUnits(const uint8_t *data, size_t size);
+};
+
+#endif
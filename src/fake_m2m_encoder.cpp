@@ -0,0 +1,399 @@
+#include "fake_m2m_encoder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/mman.h>
+
+#include <spdlog/spdlog.h>
+
+#include "bit_writer.hpp"
+#include "h264_parameter_sets.h"
+
+namespace
+{
+    constexpr size_t PageSize = 4096;
+    // Start code and NAL unit header of the slice
+    constexpr size_t SliceHeaderBytes = 5;
+
+    int fail(int error)
+    {
+        errno = error;
+        return -1;
+    }
+}
+
+FakeM2mEncoder::FakeM2mEncoder(FakeEncoderOptions const &options) : options_(options), random_(options.Seed)
+{
+    worker_ = std::thread(&FakeM2mEncoder::encodeFrames, this);
+}
+
+FakeM2mEncoder::~FakeM2mEncoder()
+{
+    {
+        const std::lock_guard lock(mutex_);
+        stop_requested = true;
+    }
+    workCondition_.notify_all();
+    worker_.join();
+}
+
+int FakeM2mEncoder::Ioctl(unsigned long request, void *arg)
+{
+    const std::lock_guard lock(mutex_);
+    switch (request)
+    {
+        case VIDIOC_S_FMT:
+            return setFormat(static_cast<v4l2_format *>(arg));
+        case VIDIOC_S_PARM:
+            return 0;
+        case VIDIOC_S_CTRL:
+            return setControl(static_cast<v4l2_control const *>(arg));
+        case VIDIOC_REQBUFS:
+            return requestBuffers(static_cast<v4l2_requestbuffers *>(arg));
+        case VIDIOC_QUERYBUF:
+            return queryBuffer(static_cast<v4l2_buffer *>(arg));
+        case VIDIOC_QBUF:
+            return queueBuffer(static_cast<v4l2_buffer const *>(arg));
+        case VIDIOC_DQBUF:
+            return dequeueBuffer(static_cast<v4l2_buffer *>(arg));
+        case VIDIOC_STREAMON:
+            return setStreaming(*static_cast<uint32_t const *>(arg), true);
+        case VIDIOC_STREAMOFF:
+            return setStreaming(*static_cast<uint32_t const *>(arg), false);
+        default:
+            return fail(ENOTTY);
+    }
+}
+
+int FakeM2mEncoder::Poll(short events, short *revents, int timeoutMs)
+{
+    std::unique_lock lock(mutex_);
+    const auto ready = [&]() {
+        short ready = 0;
+        if (!doneCaptures_.empty())
+        {
+            ready |= POLLIN | POLLRDNORM;
+        }
+        if (!doneOutputs_.empty())
+        {
+            ready |= POLLOUT | POLLWRNORM;
+        }
+        return static_cast<short>(ready & events);
+    };
+    doneCondition_.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&]() { return ready() != 0; });
+    *revents = ready();
+    return *revents != 0 ? 1 : 0;
+}
+
+void *FakeM2mEncoder::Mmap(size_t length, off_t offset)
+{
+    const std::lock_guard lock(mutex_);
+    const size_t index = captureStride_ > 0 ? offset / captureStride_ : captureBuffers_.size();
+    if (index >= captureBuffers_.size() || length > captureBuffers_[index].size())
+    {
+        errno = EINVAL;
+        return MAP_FAILED;
+    }
+    return captureBuffers_[index].data();
+}
+
+void FakeM2mEncoder::Munmap(void *, size_t)
+{
+}
+
+std::unique_ptr<V4l2Device> FakeM2mEncoder::Reopen() const
+{
+    return std::make_unique<FakeM2mEncoder>(options_);
+}
+
+FakeEncoderStatistics FakeM2mEncoder::Statistics() const
+{
+    const std::lock_guard lock(mutex_);
+    return statistics_;
+}
+
+int FakeM2mEncoder::setFormat(v4l2_format *format)
+{
+    if (format->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+    {
+        width_ = format->fmt.pix_mp.width;
+        height_ = format->fmt.pix_mp.height;
+        return 0;
+    }
+    if (format->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+    {
+        if (!captureBuffers_.empty())
+        {
+            return fail(EBUSY);
+        }
+        if (format->fmt.pix_mp.plane_fmt[0].sizeimage > 0)
+        {
+            captureSize_ = format->fmt.pix_mp.plane_fmt[0].sizeimage;
+        }
+        format->fmt.pix_mp.plane_fmt[0].sizeimage = captureSize_;
+        return 0;
+    }
+    return fail(EINVAL);
+}
+
+int FakeM2mEncoder::setControl(v4l2_control const *control)
+{
+    switch (control->id)
+    {
+        case V4L2_CID_MPEG_VIDEO_H264_I_PERIOD:
+            intraPeriod_ = control->value;
+            return 0;
+        case V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER:
+            inlineHeaders_ = control->value != 0;
+            return 0;
+        case V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME:
+            forceKeyframe_ = true;
+            return 0;
+        case V4L2_CID_MPEG_VIDEO_H264_LEVEL:
+            level_ = H264LevelIdc(static_cast<v4l2_mpeg_video_h264_level>(control->value));
+            return 0;
+        case V4L2_CID_MPEG_VIDEO_BITRATE:
+        case V4L2_CID_MPEG_VIDEO_H264_PROFILE:
+            return 0;
+        default:
+            return fail(EINVAL);
+    }
+}
+
+int FakeM2mEncoder::requestBuffers(v4l2_requestbuffers *request)
+{
+    const unsigned int count = std::min<unsigned int>(request->count, VIDEO_MAX_FRAME);
+    if (request->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE && request->memory == V4L2_MEMORY_DMABUF)
+    {
+        if (outputStreaming_)
+        {
+            return fail(EBUSY);
+        }
+        outputBufferCount_ = count;
+        outputQueued_.assign(count, false);
+    }
+    else if (request->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE && request->memory == V4L2_MEMORY_MMAP)
+    {
+        if (captureStreaming_)
+        {
+            return fail(EBUSY);
+        }
+        captureStride_ = (captureSize_ + PageSize - 1) / PageSize * PageSize;
+        captureBuffers_.assign(count, std::vector<uint8_t>(captureSize_));
+        captureQueued_.assign(count, false);
+        filler_.resize(count > 0 ? captureSize_ : 0);
+        std::uniform_int_distribution<int> byte(1, 255);
+        for (auto &value : filler_)
+        {
+            value = static_cast<uint8_t>(byte(random_));
+        }
+    }
+    else
+    {
+        return fail(EINVAL);
+    }
+    request->count = count;
+    return 0;
+}
+
+int FakeM2mEncoder::queryBuffer(v4l2_buffer *buffer) const
+{
+    if (buffer->type != V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE || buffer->index >= captureBuffers_.size()
+        || buffer->length < 1 || !buffer->m.planes)
+    {
+        return fail(EINVAL);
+    }
+    buffer->m.planes[0].length = captureSize_;
+    buffer->m.planes[0].m.mem_offset = buffer->index * captureStride_;
+    return 0;
+}
+
+int FakeM2mEncoder::queueBuffer(v4l2_buffer const *buffer)
+{
+    if (buffer->length < 1 || !buffer->m.planes)
+    {
+        return fail(EINVAL);
+    }
+    if (buffer->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+    {
+        if (buffer->index >= outputBufferCount_ || outputQueued_[buffer->index] || buffer->m.planes[0].m.fd < 0)
+        {
+            return fail(EINVAL);
+        }
+        outputQueued_[buffer->index] = true;
+        pendingOutputs_.push_back({buffer->index, buffer->timestamp});
+    }
+    else if (buffer->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+    {
+        if (buffer->index >= captureBuffers_.size() || captureQueued_[buffer->index])
+        {
+            return fail(EINVAL);
+        }
+        captureQueued_[buffer->index] = true;
+        freeCaptures_.push_back(buffer->index);
+    }
+    else
+    {
+        return fail(EINVAL);
+    }
+    workCondition_.notify_one();
+    return 0;
+}
+
+int FakeM2mEncoder::dequeueBuffer(v4l2_buffer *buffer)
+{
+    if (buffer->length < 1 || !buffer->m.planes)
+    {
+        return fail(EINVAL);
+    }
+    if (buffer->type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+    {
+        if (doneOutputs_.empty())
+        {
+            return fail(EAGAIN);
+        }
+        buffer->index = doneOutputs_.front();
+        doneOutputs_.pop_front();
+        outputQueued_[buffer->index] = false;
+        return 0;
+    }
+    if (buffer->type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+    {
+        if (doneCaptures_.empty())
+        {
+            return fail(EAGAIN);
+        }
+        EncodedFrame const &frame = doneCaptures_.front();
+        buffer->index = frame.Index;
+        buffer->flags = frame.Flags;
+        buffer->timestamp = frame.Timestamp;
+        buffer->m.planes[0].bytesused = frame.BytesUsed;
+        buffer->m.planes[0].length = captureSize_;
+        captureQueued_[frame.Index] = false;
+        doneCaptures_.pop_front();
+        return 0;
+    }
+    return fail(EINVAL);
+}
+
+int FakeM2mEncoder::setStreaming(uint32_t type, bool on)
+{
+    if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE)
+    {
+        outputStreaming_ = on;
+        if (!on)
+        {
+            // Stopping a queue hands every buffer back to the application
+            pendingOutputs_.clear();
+            doneOutputs_.clear();
+            outputQueued_.assign(outputBufferCount_, false);
+        }
+    }
+    else if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
+    {
+        captureStreaming_ = on;
+        if (on)
+        {
+            headers_.clear();
+            AppendNalUnit(headers_, 3, 7, MakeBaselineSps(width_, height_, level_));
+            AppendNalUnit(headers_, 3, 8, MakeBaselinePps());
+        }
+        else
+        {
+            freeCaptures_.clear();
+            doneCaptures_.clear();
+            captureQueued_.assign(captureBuffers_.size(), false);
+        }
+    }
+    else
+    {
+        return fail(EINVAL);
+    }
+    workCondition_.notify_one();
+    return 0;
+}
+
+bool FakeM2mEncoder::readyToEncode() const
+{
+    return outputStreaming_ && captureStreaming_ && !pendingOutputs_.empty() && !freeCaptures_.empty();
+}
+
+std::chrono::microseconds FakeM2mEncoder::frameLatency()
+{
+    const int jitter = static_cast<int>(options_.JitterUs);
+    std::uniform_int_distribution<int> offset(-jitter, jitter);
+    return std::chrono::microseconds(std::max(0, static_cast<int>(options_.LatencyUs) + offset(random_)));
+}
+
+void FakeM2mEncoder::encodeFrame()
+{
+    const PendingFrame input = pendingOutputs_.front();
+    pendingOutputs_.pop_front();
+    const unsigned int index = freeCaptures_.front();
+    freeCaptures_.pop_front();
+
+    const bool keyframe = frameCount_ == 0 || forceKeyframe_ || (intraPeriod_ > 0 && frameCount_ % intraPeriod_ == 0);
+    forceKeyframe_ = false;
+    frameCount_++;
+
+    std::vector<uint8_t> &capture = captureBuffers_[index];
+    size_t size = 0;
+    if (keyframe && inlineHeaders_)
+    {
+        std::memcpy(capture.data(), headers_.data(), headers_.size());
+        size = headers_.size();
+    }
+    const double mean = keyframe ? options_.KeyframeBytes : options_.FrameBytes;
+    std::uniform_real_distribution<double> variation(1 - options_.SizeJitter, 1 + options_.SizeJitter);
+    size_t sliceBytes = std::max<size_t>(1, static_cast<size_t>(mean * variation(random_)));
+    if (size + SliceHeaderBytes + sliceBytes > capture.size())
+    {
+        sliceBytes = capture.size() - size - SliceHeaderBytes;
+        statistics_.Truncated++;
+    }
+    const uint8_t slice[SliceHeaderBytes] = {0, 0, 0, 1, static_cast<uint8_t>(keyframe ? 0x65 : 0x41)};
+    std::memcpy(capture.data() + size, slice, SliceHeaderBytes);
+    std::memcpy(capture.data() + size + SliceHeaderBytes, filler_.data(), sliceBytes);
+    size += SliceHeaderBytes + sliceBytes;
+
+    doneOutputs_.push_back(input.Index);
+    doneCaptures_.push_back({index, static_cast<uint32_t>(size),
+                             static_cast<uint32_t>(keyframe ? V4L2_BUF_FLAG_KEYFRAME : V4L2_BUF_FLAG_PFRAME),
+                             input.Timestamp});
+    statistics_.FramesEncoded++;
+    statistics_.Keyframes += keyframe;
+}
+
+void FakeM2mEncoder::encodeFrames()
+{
+    std::unique_lock lock(mutex_);
+    while (!stop_requested)
+    {
+        bool stalled = false;
+        workCondition_.wait(lock, [this, &stalled]() {
+            if (!pendingOutputs_.empty() && freeCaptures_.empty() && captureStreaming_)
+            {
+                stalled = true;
+            }
+            return stop_requested || readyToEncode();
+        });
+        if (stop_requested)
+        {
+            break;
+        }
+        statistics_.CaptureStalls += stalled;
+
+        // The frame is taken once encoded, a STREAMOFF meanwhile drops it
+        const auto done = std::chrono::steady_clock::now() + frameLatency();
+        workCondition_.wait_until(lock, done, [this]() { return stop_requested; });
+        if (readyToEncode())
+        {
+            encodeFrame();
+            doneCondition_.notify_all();
+        }
+    }
+    spdlog::debug("FakeM2mEncoder: {} frames encoded, {} capture stalls", statistics_.FramesEncoded,
+                  statistics_.CaptureStalls);
+}
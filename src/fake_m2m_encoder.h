@@ -0,0 +1,129 @@
+#ifndef FAKE_M2M_ENCODER_H
+#define FAKE_M2M_ENCODER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <linux/videodev2.h>
+
+#include "v4l2_device.h"
+
+struct FakeEncoderOptions
+{
+    // Time taken per frame. Frames are encoded one at a time, as on the hardware, so this also
+    // sets the throughput ceiling.
+    unsigned int LatencyUs = 2000;
+    // Each frame takes up to this much longer or shorter, uniformly distributed
+    unsigned int JitterUs = 0;
+    // Mean encoded sizes, each frame varying by up to SizeJitter of them
+    size_t FrameBytes = 20000;
+    size_t KeyframeBytes = 150000;
+    float SizeJitter = 0.25f;
+    uint32_t Seed = 1;
+};
+
+struct FakeEncoderStatistics
+{
+    uint64_t FramesEncoded = 0;
+    uint64_t Keyframes = 0;
+    // Frames that waited for the application to give back a capture buffer
+    uint64_t CaptureStalls = 0;
+    // Frames cut short as they did not fit the capture buffer
+    uint64_t Truncated = 0;
+};
+
+// An in-process stand-in for the Pi's V4L2 H.264 encoder implementing the subset of the M2M
+// interface H264Encoder uses: multiplanar DMABUF output and MMAP capture queues, the codec
+// controls and non-blocking dequeueing. A worker thread turns each queued raw frame into an
+// access unit after the configured latency: SPS and PPS ahead of keyframes when inline headers
+// are on, then a slice NAL unit of a randomised size filled with data free of start codes.
+// Raw frame contents are never read.
+class FakeM2mEncoder : public V4l2Device
+{
+private:
+    struct PendingFrame
+    {
+        unsigned int Index;
+        timeval Timestamp;
+    };
+
+    struct EncodedFrame
+    {
+        unsigned int Index;
+        uint32_t BytesUsed;
+        uint32_t Flags;
+        timeval Timestamp;
+    };
+
+    FakeEncoderOptions options_;
+    std::mt19937 random_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable workCondition_;
+    std::condition_variable doneCondition_;
+
+    unsigned int width_ = 0;
+    unsigned int height_ = 0;
+    uint8_t level_ = 40;
+    unsigned int intraPeriod_ = 30;
+    bool inlineHeaders_ = true;
+    bool forceKeyframe_ = false;
+    uint32_t captureSize_ = 512 << 10;
+    size_t captureStride_ = 0;
+
+    unsigned int outputBufferCount_ = 0;
+    std::vector<bool> outputQueued_;
+    std::vector<std::vector<uint8_t>> captureBuffers_;
+    std::vector<bool> captureQueued_;
+    std::deque<PendingFrame> pendingOutputs_;
+    std::deque<unsigned int> doneOutputs_;
+    std::deque<unsigned int> freeCaptures_;
+    std::deque<EncodedFrame> doneCaptures_;
+    bool outputStreaming_ = false;
+    bool captureStreaming_ = false;
+
+    // SPS and PPS in Annex-B form, and slice data without zero bytes so any prefix of it is a
+    // valid NAL unit payload
+    std::vector<uint8_t> headers_;
+    std::vector<uint8_t> filler_;
+    unsigned int frameCount_ = 0;
+    FakeEncoderStatistics statistics_;
+
+    std::thread worker_;
+    bool stop_requested = false;
+
+public:
+    explicit FakeM2mEncoder(FakeEncoderOptions const &options);
+    ~FakeM2mEncoder() override;
+
+    int Ioctl(unsigned long request, void *arg) override;
+    int Poll(short events, short *revents, int timeoutMs) override;
+    void *Mmap(size_t length, off_t offset) override;
+    void Munmap(void *address, size_t length) override;
+    // A new fake with the same options, as if the driver was reset
+    std::unique_ptr<V4l2Device> Reopen() const override;
+
+    FakeEncoderStatistics Statistics() const;
+
+private:
+    int setFormat(v4l2_format *format);
+    int setControl(v4l2_control const *control);
+    int requestBuffers(v4l2_requestbuffers *request);
+    int queryBuffer(v4l2_buffer *buffer) const;
+    int queueBuffer(v4l2_buffer const *buffer);
+    int dequeueBuffer(v4l2_buffer *buffer);
+    int setStreaming(uint32_t type, bool on);
+
+    bool readyToEncode() const;
+    std::chrono::microseconds frameLatency();
+    void encodeFrame();
+    void encodeFrames();
+};
+
+#endif
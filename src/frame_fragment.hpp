@@ -0,0 +1,15 @@
+#ifndef FRAME_FRAGMENT_H
+#define FRAME_FRAGMENT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Part of an encoded frame, sent as one access unit together with the other parts. Lets the
+// output path add or replace NAL units without editing the encoder's buffer.
+struct FrameFragment
+{
+    const uint8_t *Data;
+    size_t Size;
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef FRAME_OUTPUT_H
+#define FRAME_OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "frame_fragment.hpp"
+
+// Where the output thread hands encoded frames: RtpOutput for receivers on the network,
+// DatagramOutput for a forwarder on the same host. Called from a single thread.
+class FrameOutput
+{
+public:
+    virtual ~FrameOutput() = default;
+
+    // Sends the fragments, in order, as a single access unit captured at the given
+    // CLOCK_MONOTONIC time
+    virtual bool SendFrame(FrameFragment const *fragments, size_t count, int64_t captureTimestampUs) = 0;
+    // Recreates the socket for a destination that has been refusing frames, carrying on the
+    // stream where it left off. Throws like construction.
+    virtual void Reconnect() = 0;
+
+    // Packets the last frame took, estimated where the library sending them does not say
+    virtual size_t LastPacketCount() const = 0;
+    // How long pacing held back the last packet of the last frame sent, from the call to its departure
+    virtual int64_t LastPacingDelayUs() const { return 0; }
+    virtual size_t HeapBytes() const = 0;
+};
+
+#endif
@@ -0,0 +1,191 @@
+#include "frame_trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+namespace
+{
+    const char *const StageNames[TraceStageCount] = {
+        "request completed", "dequeued", "encoder queued", "encoder input released", "encoded", "send begin", "send end",
+    };
+
+    // What happened between the previous stage and this one
+    const char *const IntervalNames[TraceStageCount] = {
+        "", "completed queue", "encoder queue", "encoder input", "encode", "output queue", "send",
+    };
+
+    int64_t nowNs()
+    {
+        const auto time = std::chrono::steady_clock::now().time_since_epoch();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+    }
+
+    uint32_t currentThreadId()
+    {
+        thread_local const auto tid = static_cast<uint32_t>(syscall(SYS_gettid));
+        return tid;
+    }
+}
+
+FrameTrace::FrameTrace(size_t capacity)
+    : slots_(std::make_unique<Slot[]>(capacity)), capacity_(capacity)
+{
+    if (capacity == 0)
+    {
+        throw std::runtime_error("frame trace needs at least one slot");
+    }
+}
+
+FrameTrace::Slot *FrameTrace::slotFor(uint32_t sequence) const
+{
+    Slot *slot = &slots_[sequence % capacity_];
+    return slot->Sequence.load(std::memory_order_acquire) == sequence ? slot : nullptr;
+}
+
+void FrameTrace::Begin(uint32_t sequence)
+{
+    Slot &slot = slots_[sequence % capacity_];
+    slot.Sequence.store(InvalidSequence, std::memory_order_relaxed);
+    for (auto &time : slot.TimesNs)
+    {
+        time.store(0, std::memory_order_relaxed);
+    }
+    slot.Sequence.store(sequence, std::memory_order_release);
+    newest_.store(sequence, std::memory_order_release);
+    Record(sequence, TraceStage::RequestCompleted);
+}
+
+void FrameTrace::Record(uint32_t sequence, TraceStage stage)
+{
+    Slot *slot = slotFor(sequence);
+    if (!slot)
+    {
+        // Overwritten by a newer frame, or completed before tracing started
+        return;
+    }
+    const auto index = static_cast<size_t>(stage);
+    slot->ThreadIds[index].store(currentThreadId(), std::memory_order_relaxed);
+    slot->TimesNs[index].store(nowNs(), std::memory_order_relaxed);
+}
+
+void FrameTrace::NameCurrentThread(std::string name)
+{
+    const std::lock_guard lock(threadNamesMutex_);
+    threadNames_[currentThreadId()] = std::move(name);
+}
+
+std::vector<FrameTraceRecord> FrameTrace::Snapshot() const
+{
+    std::vector<FrameTraceRecord> records;
+    const uint32_t newest = newest_.load(std::memory_order_acquire);
+    if (newest == InvalidSequence)
+    {
+        return records;
+    }
+    records.reserve(capacity_);
+    const uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(capacity_, uint64_t(newest) + 1));
+    for (uint32_t age = count; age-- > 0;)
+    {
+        const uint32_t sequence = newest - age;
+        const Slot &slot = slots_[sequence % capacity_];
+        if (slot.Sequence.load(std::memory_order_acquire) != sequence)
+        {
+            continue;
+        }
+        FrameTraceRecord record{};
+        record.Sequence = sequence;
+        for (size_t stage = 0; stage < TraceStageCount; stage++)
+        {
+            record.TimesNs[stage] = slot.TimesNs[stage].load(std::memory_order_relaxed);
+            record.ThreadIds[stage] = slot.ThreadIds[stage].load(std::memory_order_relaxed);
+        }
+        records.push_back(record);
+    }
+    return records;
+}
+
+std::string FrameTrace::ToChromeJson(std::vector<FrameTraceRecord> const &records) const
+{
+    int64_t originNs = 0;
+    for (const auto &record : records)
+    {
+        if (record.TimesNs[0] != 0 && (originNs == 0 || record.TimesNs[0] < originNs))
+        {
+            originNs = record.TimesNs[0];
+        }
+    }
+    const auto toUs = [originNs](int64_t ns) { return (ns - originNs) / 1000.0; };
+
+    const int pid = getpid();
+    std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    const auto append = [&json, &first](std::string const &event) {
+        if (!first)
+        {
+            json += ",\n";
+        }
+        json += event;
+        first = false;
+    };
+
+    {
+        const std::lock_guard lock(threadNamesMutex_);
+        for (const auto &[tid, name] : threadNames_)
+        {
+            append(fmt::format(R"({{"ph":"M","name":"thread_name","pid":{},"tid":{},"args":{{"name":"{}"}}}})",
+                               pid, tid, name));
+        }
+    }
+
+    for (const auto &record : records)
+    {
+        size_t previous = TraceStageCount;
+        size_t last = TraceStageCount;
+        for (size_t stage = 0; stage < TraceStageCount; stage++)
+        {
+            if (record.TimesNs[stage] == 0)
+            {
+                continue;
+            }
+            // Each interval is drawn on the thread which ended it
+            if (previous != TraceStageCount)
+            {
+                append(fmt::format(R"({{"ph":"X","name":"{}","cat":"stage","pid":{},"tid":{},"ts":{:.3f},"dur":{:.3f},"args":{{"frame":{}}}}})",
+                                   IntervalNames[stage], pid, record.ThreadIds[stage], toUs(record.TimesNs[previous]),
+                                   (record.TimesNs[stage] - record.TimesNs[previous]) / 1000.0, record.Sequence));
+            }
+            append(fmt::format(R"({{"ph":"i","s":"t","name":"{}","cat":"event","pid":{},"tid":{},"ts":{:.3f},"args":{{"frame":{}}}}})",
+                               StageNames[stage], pid, record.ThreadIds[stage], toUs(record.TimesNs[stage]),
+                               record.Sequence));
+            previous = stage;
+            last = stage;
+        }
+        // One async lane per frame spanning all of its stages
+        if (last != TraceStageCount && record.TimesNs[0] != 0)
+        {
+            append(fmt::format(R"({{"ph":"b","name":"frame {}","cat":"frame","id":{},"pid":{},"ts":{:.3f}}})",
+                               record.Sequence, record.Sequence, pid, toUs(record.TimesNs[0])));
+            append(fmt::format(R"({{"ph":"e","name":"frame {}","cat":"frame","id":{},"pid":{},"ts":{:.3f}}})",
+                               record.Sequence, record.Sequence, pid, toUs(record.TimesNs[last])));
+        }
+    }
+    json += "]}\n";
+    return json;
+}
+
+void FrameTrace::Write(std::string const &path) const
+{
+    const auto records = Snapshot();
+    std::ofstream file(path, std::ios::trunc);
+    if (!file)
+    {
+        throw std::runtime_error("failed to open trace file " + path);
+    }
+    file << ToChromeJson(records);
+    spdlog::info("Frame trace of {} frames written to {}", records.size(), path);
+}
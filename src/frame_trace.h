@@ -0,0 +1,80 @@
+#ifndef FRAME_TRACE_H
+#define FRAME_TRACE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Stage transitions of a frame, in pipeline order
+enum class TraceStage : uint8_t
+{
+    RequestCompleted,
+    Dequeued,
+    EncoderQueued,
+    EncoderInputReleased,
+    Encoded,
+    SendBegin,
+    SendEnd,
+    Count
+};
+
+constexpr size_t TraceStageCount = static_cast<size_t>(TraceStage::Count);
+
+struct FrameTraceRecord
+{
+    uint32_t Sequence;
+    // steady_clock nanoseconds, 0 when the frame never reached the stage
+    std::array<int64_t, TraceStageCount> TimesNs;
+    std::array<uint32_t, TraceStageCount> ThreadIds;
+};
+
+// Records when every frame passes each pipeline stage into a preallocated ring indexed by the
+// camera sequence number. Recording is a handful of relaxed stores, so it can stay enabled in
+// the field, and the ring is exported as Chrome trace JSON which Perfetto opens as well.
+class FrameTrace
+{
+private:
+    struct Slot
+    {
+        std::atomic<uint32_t> Sequence{InvalidSequence};
+        std::array<std::atomic<int64_t>, TraceStageCount> TimesNs = {};
+        std::array<std::atomic<uint32_t>, TraceStageCount> ThreadIds = {};
+    };
+
+    static constexpr uint32_t InvalidSequence = UINT32_MAX;
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t capacity_;
+    std::atomic<uint32_t> newest_{InvalidSequence};
+
+    mutable std::mutex threadNamesMutex_;
+    std::map<uint32_t, std::string> threadNames_;
+
+public:
+    explicit FrameTrace(size_t capacity);
+
+    size_t Capacity() const { return capacity_; }
+
+    // Claims the slot of a newly completed frame and records its RequestCompleted stage
+    void Begin(uint32_t sequence);
+    void Record(uint32_t sequence, TraceStage stage);
+
+    // Labels the calling thread's lane in the exported trace
+    void NameCurrentThread(std::string name);
+
+    // Copies out the frames still held by the ring, oldest first. Frames being recorded while
+    // the copy is taken may miss their latest stages.
+    std::vector<FrameTraceRecord> Snapshot() const;
+    std::string ToChromeJson(std::vector<FrameTraceRecord> const &records) const;
+    void Write(std::string const &path) const;
+
+private:
+    Slot *slotFor(uint32_t sequence) const;
+};
+
+#endif
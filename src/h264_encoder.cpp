@@ -1,23 +1,13 @@
 #include "h264_encoder.h"
 
-#include <fcntl.h>
+#include <algorithm>
 #include <stdexcept>
 #include <linux/videodev2.h>
 #include <spdlog/spdlog.h>
-#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <poll.h>
 
-static int xioctl(int fd, unsigned long ctl, void *arg)
-{
-    int ret, num_tries = 10;
-    do
-    {
-        ret = ioctl(fd, ctl, arg);
-    }
-    while (ret == -1 && errno == EINTR && num_tries-- > 0);
-    return ret;
-}
+#include "clock_conversion.h"
 
 static int get_v4l2_colorspace(std::optional<libcamera::ColorSpace> const &cs)
 {
@@ -34,23 +24,21 @@ static int get_v4l2_colorspace(std::optional<libcamera::ColorSpace> const &cs)
 }
 
 
-H264Encoder::H264Encoder(EncoderOptions const *options, StreamInfo streamInfo,std::function<void(void)> inputBufferProcessedCallback)
+H264Encoder::H264Encoder(EncoderOptions const *options, std::function<void(uint64_t)> inputBufferProcessedCallback) :
+    H264Encoder(options, std::move(inputBufferProcessedCallback), std::make_unique<KernelV4l2Device>("/dev/video11"))
 {
-    inputBufferProcessedCallback_ = inputBufferProcessedCallback;
-
-    constexpr char deviceName[] = "/dev/video11";
-    fd_ = open(deviceName, O_RDWR, 0);
-    if (fd_ < 0)
-    {
-        throw std::runtime_error("failed to open V4L2 H264 encoder");
-    }
+}
 
-    setControlValue(V4L2_CID_MPEG_VIDEO_BITRATE, options->bitrate, "failed to set bitrate");
-    setControlValue(V4L2_CID_MPEG_VIDEO_H264_PROFILE, options->profile, "failed to set profile");
-    setControlValue(V4L2_CID_MPEG_VIDEO_H264_LEVEL, options->level, "failed to set level");
-    setControlValue(V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, options->intra, "failed to set intra period");
-    setControlValue(V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER, options->inline_headers ? 1 : 0, "failed to set inline headers");
+H264Encoder::H264Encoder(EncoderOptions const *options, std::function<void(uint64_t)> inputBufferProcessedCallback,
+                         std::unique_ptr<V4l2Device> device) :
+    options_(options), device_(std::move(device))
+{
+    inputBufferProcessedCallback_ = inputBufferProcessedCallback;
+    applyControls();
+}
 
+void H264Encoder::Configure(StreamInfo streamInfo)
+{
     v4l2_format outputFormat = {};
     outputFormat.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
     outputFormat.fmt.pix_mp.width = streamInfo.Width;
@@ -62,31 +50,31 @@ H264Encoder::H264Encoder(EncoderOptions const *options, StreamInfo streamInfo,st
     outputFormat.fmt.pix_mp.field = V4L2_FIELD_ANY;
     outputFormat.fmt.pix_mp.colorspace = get_v4l2_colorspace(streamInfo.ColorSpace);
     outputFormat.fmt.pix_mp.num_planes = 1;
-    if (xioctl(fd_, VIDIOC_S_FMT, &outputFormat) < 0)
+    if (device_->Ioctl(VIDIOC_S_FMT, &outputFormat) < 0)
     {
         throw std::runtime_error("failed to set output format");
     }
 
     v4l2_format captureFormat = {};
     captureFormat.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    captureFormat.fmt.pix_mp.width = options->width;
-    captureFormat.fmt.pix_mp.height = options->height;
+    captureFormat.fmt.pix_mp.width = options_->width;
+    captureFormat.fmt.pix_mp.height = options_->height;
     captureFormat.fmt.pix_mp.pixelformat = V4L2_PIX_FMT_H264;
     captureFormat.fmt.pix_mp.field = V4L2_FIELD_ANY;
     captureFormat.fmt.pix_mp.colorspace = V4L2_COLORSPACE_DEFAULT;
     captureFormat.fmt.pix_mp.num_planes = 1;
     captureFormat.fmt.pix_mp.plane_fmt[0].bytesperline = 0;
-    captureFormat.fmt.pix_mp.plane_fmt[0].sizeimage = 512 << 10;
-    if (xioctl(fd_, VIDIOC_S_FMT, &captureFormat) < 0)
+    captureFormat.fmt.pix_mp.plane_fmt[0].sizeimage = captureBufferSize(options_);
+    if (device_->Ioctl(VIDIOC_S_FMT, &captureFormat) < 0)
     {
         throw std::runtime_error("failed to set capture format");
     }
 
     v4l2_streamparm streamParameters = {};
     streamParameters.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-    streamParameters.parm.output.timeperframe.numerator = 1000 / options->framerate;
+    streamParameters.parm.output.timeperframe.numerator = 1000 / options_->framerate;
     streamParameters.parm.output.timeperframe.denominator = 1000;
-    if (xioctl(fd_, VIDIOC_S_PARM, &streamParameters) < 0)
+    if (device_->Ioctl(VIDIOC_S_PARM, &streamParameters) < 0)
     {
         throw std::runtime_error("failed to set streamParameters");
     }
@@ -98,32 +86,31 @@ H264Encoder::H264Encoder(EncoderOptions const *options, StreamInfo streamInfo,st
 
     // v4l2 OUTPUT is actually INPUT for raw frames
     v4l2_requestbuffers outputBuffersRequest = {};
-    outputBuffersRequest.count = OutputBuffersCount;
+    outputBuffersRequest.count = options_->output_buffers;
     outputBuffersRequest.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
     outputBuffersRequest.memory = V4L2_MEMORY_DMABUF;
-    if (xioctl(fd_, VIDIOC_REQBUFS, &outputBuffersRequest) < 0)
+    if (device_->Ioctl(VIDIOC_REQBUFS, &outputBuffersRequest) < 0)
     {
         throw std::runtime_error("request for output buffers failed");
     }
     spdlog::trace("Got {} output buffers", outputBuffersRequest.count);
 
-    // We have to maintain a list of the buffers we can use when our caller gives
-    // us another frame to encode.
-    for (unsigned int i = 0; i < outputBuffersRequest.count; i++)
-    {
-        availableInputBuffers_.enqueue(i);
-    }
+    // Start() puts them on the list of buffers we can use when our caller gives us another frame
+    inputFrames_.resize(outputBuffersRequest.count);
+    activeOutputBuffers_ = outputBuffersRequest.count;
 
     // v4l2 CAPTURE buffers is actually OUTPUT buffers with encoded frames
     v4l2_requestbuffers captureBuffersRequest = {};
-    captureBuffersRequest.count = CaptureBuffersCount;
+    captureBuffersRequest.count = options_->capture_buffers;
     captureBuffersRequest.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
     captureBuffersRequest.memory = V4L2_MEMORY_MMAP;
-    if (xioctl(fd_, VIDIOC_REQBUFS, &captureBuffersRequest) < 0)
+    if (device_->Ioctl(VIDIOC_REQBUFS, &captureBuffersRequest) < 0)
     {
         throw std::runtime_error("request for capture buffers failed");
     }
     spdlog::trace("Got {} capture buffers", captureBuffersRequest.count);
+    buffers_.resize(captureBuffersRequest.count);
+    activeCaptureBuffers_ = captureBuffersRequest.count;
         
     for (unsigned int i = 0; i < captureBuffersRequest.count; i++)
     {
@@ -134,73 +121,189 @@ H264Encoder::H264Encoder(EncoderOptions const *options, StreamInfo streamInfo,st
         buffer.index = i;
         buffer.length = 1;
         buffer.m.planes = planes;
-        if (xioctl(fd_, VIDIOC_QUERYBUF, &buffer) < 0)
+        if (device_->Ioctl(VIDIOC_QUERYBUF, &buffer) < 0)
         {
             throw std::runtime_error("failed to capture query buffer " + std::to_string(i));
         }
 
-        buffers_[i].mem = mmap(
-            0, 
-            buffer.m.planes[0].length, 
-            PROT_READ | PROT_WRITE, 
-            MAP_SHARED, 
-            fd_,
-            buffer.m.planes[0].m.mem_offset);
+        buffers_[i].mem = device_->Mmap(buffer.m.planes[0].length, buffer.m.planes[0].m.mem_offset);
         if (buffers_[i].mem == MAP_FAILED)
         {
             throw std::runtime_error("failed to mmap capture buffer " + std::to_string(i));
         }
 
         buffers_[i].size = buffer.m.planes[0].length;
-        // Whilst we're going through all the capture buffers, we may as well queue
-        // them ready for the encoder to write into.
-        if (xioctl(fd_, VIDIOC_QBUF, &buffer) < 0)
-        {
-            throw std::runtime_error("failed to queue capture buffer " + std::to_string(i));
-        }
     }
-    
-     // Enable streaming and we're done.
-    
+}
+
+H264Encoder::~H264Encoder()
+{
+    Stop();
+    releaseBuffers();
+}
+
+void H264Encoder::Restream(StreamInfo streamInfo)
+{
+    releaseBuffers();
+    inputFrames_.clear();
+
+    // Profile and level can only change while the codec is not streaming
+    applyControls();
+    Configure(streamInfo);
+}
+
+void H264Encoder::Reopen(StreamInfo streamInfo)
+{
+    const unsigned int activeOutputBuffers = activeOutputBuffers_;
+    const unsigned int activeCaptureBuffers = activeCaptureBuffers_;
+    // A wedged driver may refuse to free them, closing the old handle does
+    releaseBuffers();
+    device_ = device_->Reopen();
+    inputFrames_.clear();
+    applyControls();
+    Configure(streamInfo);
+    SetActiveBuffers(activeOutputBuffers, activeCaptureBuffers);
+}
+
+void H264Encoder::releaseBuffers()
+{
+    for (const auto &buffer : buffers_)
+    {
+        device_->Munmap(buffer.mem, buffer.size);
+    }
+    buffers_.clear();
+
+    // Freeing the buffers needs the mappings gone, otherwise the driver keeps them alive
+    v4l2_requestbuffers request = {};
+    request.count = 0;
+    request.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    request.memory = V4L2_MEMORY_DMABUF;
+    device_->Ioctl(VIDIOC_REQBUFS, &request);
+    request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    request.memory = V4L2_MEMORY_MMAP;
+    device_->Ioctl(VIDIOC_REQBUFS, &request);
+}
+
+ComponentFootprint H264Encoder::GetMemoryFootprint() const
+{
+    ComponentFootprint footprint;
+    for (const auto &buffer : buffers_)
+    {
+        footprint.DmabufBytes += buffer.size;
+        footprint.MmapBytes += buffer.size;
+    }
+    // Raw frames are imported from the camera and accounted there
+    footprint.HeapBytes = buffers_.capacity() * sizeof(BufferDescription) + inputFrames_.capacity() * sizeof(InputFrame)
+                          + sizeof(availableInputBuffers_) + sizeof(outputItemsQueue_);
+    return footprint;
+}
+
+uint32_t H264Encoder::captureBufferSize(EncoderOptions const *options)
+{
+    if (options->capture_buffer_size > 0)
+    {
+        return options->capture_buffer_size;
+    }
+    if (options->bitrate == 0 || options->framerate <= 0)
+    {
+        return 512 << 10;
+    }
+
+    // Room for an I frame several times the size of an average frame, but never more than
+    // the raw frame nor less than a minimum that covers the headers and tiny frames.
+    constexpr uint32_t KeyframeToAverageRatio = 16;
+    constexpr uint32_t MinimumSize = 64 << 10;
+    constexpr uint32_t PageSize = 4 << 10;
+    const uint64_t averageFrameBytes = options->bitrate / 8 / options->framerate;
+    const uint64_t rawFrameBytes = static_cast<uint64_t>(options->width) * options->height * 3 / 2;
+    uint64_t size = std::clamp<uint64_t>(averageFrameBytes * KeyframeToAverageRatio, MinimumSize,
+                                         std::max<uint64_t>(rawFrameBytes, MinimumSize));
+    size = (size + PageSize - 1) / PageSize * PageSize;
+    spdlog::debug("H264Encoder: capture buffers sized to {} KiB", size >> 10);
+    return static_cast<uint32_t>(size);
+}
+
+void H264Encoder::Start()
+{
+     // Every buffer is ours again after Configure() or Stop(), whatever the last run left behind
+     availableInputBuffers_.Clear();
+     parkedOutputBuffers_.clear();
+     for (unsigned int i = 0; i < inputFrames_.size(); i++)
+     {
+         if (i < activeOutputBuffers_)
+         {
+             availableInputBuffers_.TryPush(i);
+         }
+         else
+         {
+             parkedOutputBuffers_.push_back(i);
+         }
+     }
+     outputItemsQueue_.Clear();
+     outputItemsQueue_.Resume();
+     parkedCaptureBuffers_.clear();
+     for (unsigned int i = 0; i < buffers_.size(); i++)
+     {
+         if (i < activeCaptureBuffers_)
+         {
+             queueCaptureBuffer(i, buffers_[i].size);
+         }
+         else
+         {
+             parkedCaptureBuffers_.push_back(i);
+         }
+     }
+     inputsInFlight_.Reset();
+     capturesHeld_.Reset();
+
      v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
-     if (xioctl(fd_, VIDIOC_STREAMON, &type) < 0)
+     if (device_->Ioctl(VIDIOC_STREAMON, &type) < 0)
      {
          throw std::runtime_error("failed to start output streaming");
      }
-
      type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-     if (xioctl(fd_, VIDIOC_STREAMON, &type) < 0)
+     if (device_->Ioctl(VIDIOC_STREAMON, &type) < 0)
      {
          throw std::runtime_error("failed to start capture streaming");
      }
      spdlog::trace("H264Encoder: Codec streaming started");
-}
-
-H264Encoder::~H264Encoder() {}
 
-void H264Encoder::Start()
-{
+     stop_requested = false;
+     failed_ = false;
      pollThread_ = std::thread(&H264Encoder::pollEncoder, this);
 }
 
 void H264Encoder::Stop()
 {
-    stop_requested= true;
-    if(pollThread_.joinable()){
+    stop_requested = true;
+    if (pollThread_.joinable())
+    {
+        // Within the poll timeout
         pollThread_.join();
     }
+    // Hands every queued buffer back, raw frames the codec had not got to are dropped
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    device_->Ioctl(VIDIOC_STREAMOFF, &type);
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    device_->Ioctl(VIDIOC_STREAMOFF, &type);
 }
 
-void H264Encoder::EncodeBuffer(int fd, size_t size, int64_t timestamp_us)
+bool H264Encoder::EncodeBuffer(int fd, size_t size, int64_t timestamp_us, uint32_t sequence, uint64_t cookie)
 {
      spdlog::trace("H264Encoder: EncodeBuffer {} {} {}", fd, size, timestamp_us);
-     int index;
-     if(!availableInputBuffers_.try_dequeue(index))
+     unsigned int index;
+     if(!availableInputBuffers_.TryPop(index))
      {
          spdlog::warn("H264Encoder: Frame encoding skipped");
-         return;
+         return false;
      }
      spdlog::trace("H264Encoder: Using {} buffer", index);
+     inputFrames_[index] = {cookie, sequence};
+     const size_t next = nextQueuedFrame_.load(std::memory_order_relaxed);
+     QueuedFrame &queued = queuedFrames_[next % QueuedFramesSize];
+     queued.sequence.store(sequence, std::memory_order_relaxed);
+     queued.timestamp_us.store(timestamp_us, std::memory_order_release);
+     nextQueuedFrame_.store(next + 1, std::memory_order_release);
 
      v4l2_buffer buffer = {};
      v4l2_plane planes[VIDEO_MAX_PLANES] = {};
@@ -209,42 +312,136 @@ void H264Encoder::EncodeBuffer(int fd, size_t size, int64_t timestamp_us)
      buffer.field = V4L2_FIELD_NONE;
      buffer.memory = V4L2_MEMORY_DMABUF;
      buffer.length = 1;
-     buffer.timestamp.tv_sec = timestamp_us / 1000000;
-     buffer.timestamp.tv_usec = timestamp_us % 1000000;
+     buffer.timestamp = MicrosecondsToTimeval(timestamp_us);
      buffer.m.planes = planes;
      buffer.m.planes[0].m.fd = fd;
      buffer.m.planes[0].bytesused = size;
      buffer.m.planes[0].length = size;
-     if (xioctl(fd_, VIDIOC_QBUF, &buffer) < 0)
+     if (device_->Ioctl(VIDIOC_QBUF, &buffer) < 0)
      {
          throw std::runtime_error("failed to queue input to codec");
      }
+     if (trace_)
+     {
+         trace_->Record(sequence, TraceStage::EncoderQueued);
+     }
+     inputsInFlight_.Acquire();
+     return true;
+}
+
+std::optional<OutputItem> H264Encoder::WaitForNextOutputItem()
+{
+     return outputItemsQueue_.WaitPop();
+}
+
+void H264Encoder::InterruptOutputWait()
+{
+     outputItemsQueue_.Interrupt();
+}
+
+void H264Encoder::OutputDone(OutputItem const &outputItem)
+{
+     capturesHeld_.Release();
+     if (buffers_.size() - parkedCaptureBuffers_.size() > activeCaptureBuffers_)
+     {
+         parkedCaptureBuffers_.push_back(outputItem.index);
+         return;
+     }
+     queueCaptureBuffer(outputItem.index, outputItem.length);
+     while (!parkedCaptureBuffers_.empty() && buffers_.size() - parkedCaptureBuffers_.size() < activeCaptureBuffers_)
+     {
+         queueCaptureBuffer(parkedCaptureBuffers_.back(), buffers_[parkedCaptureBuffers_.back()].size);
+         parkedCaptureBuffers_.pop_back();
+     }
+}
+
+BufferPoolUsage H264Encoder::GetOutputBufferUsage() const
+{
+    BufferPoolUsage usage;
+    usage.Allocated = inputFrames_.size();
+    usage.Active = activeOutputBuffers_;
+    usage.PeakInUse = inputsInFlight_.Peak();
+    return usage;
+}
+
+BufferPoolUsage H264Encoder::GetCaptureBufferUsage() const
+{
+    BufferPoolUsage usage;
+    usage.Allocated = buffers_.size();
+    usage.Active = activeCaptureBuffers_;
+    usage.PeakInUse = capturesHeld_.Peak();
+    return usage;
+}
+
+void H264Encoder::ResetBufferUsagePeaks()
+{
+    inputsInFlight_.ResetPeak();
+    capturesHeld_.ResetPeak();
+}
+
+void H264Encoder::SetActiveBuffers(unsigned int outputBuffers, unsigned int captureBuffers)
+{
+    activeOutputBuffers_ = std::clamp<unsigned int>(outputBuffers, 1, inputFrames_.size());
+    activeCaptureBuffers_ = std::clamp<unsigned int>(captureBuffers, 1, buffers_.size());
+}
+
+void H264Encoder::RequestKeyframe() const
+{
+    setControlValue(V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 1, "failed to force keyframe");
+}
+
+void H264Encoder::SetBitrate(uint32_t bitrate) const
+{
+    setControlValue(V4L2_CID_MPEG_VIDEO_BITRATE, bitrate, "failed to set bitrate");
+}
+
+void H264Encoder::SetIntraPeriod(unsigned int intra) const
+{
+    setControlValue(V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, intra, "failed to set intra period");
+}
+
+void H264Encoder::SetFramerate(float framerate) const
+{
+    v4l2_streamparm streamParameters = {};
+    streamParameters.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    streamParameters.parm.output.timeperframe.numerator = 1000 / framerate;
+    streamParameters.parm.output.timeperframe.denominator = 1000;
+    if (device_->Ioctl(VIDIOC_S_PARM, &streamParameters) < 0)
+    {
+        // Only the rate control's bits per frame are off until the next restream
+        spdlog::warn("H264Encoder: the codec kept its frame rate, errno {}", errno);
+    }
 }
 
-OutputItem * H264Encoder::WaitForNextOutputItem()
+bool H264Encoder::CaptureBuffersFit(EncoderOptions const &options) const
 {
-     OutputItem *outputItem;
-     outputItemsQueue_.wait_dequeue(outputItem);
-     return outputItem;
+    return !buffers_.empty() && captureBufferSize(&options) <= buffers_.front().size;
 }
 
-void H264Encoder::OutputDone(const OutputItem *outputItem) const
+void H264Encoder::applyControls() const
+{
+    setControlValue(V4L2_CID_MPEG_VIDEO_BITRATE, options_->bitrate, "failed to set bitrate");
+    setControlValue(V4L2_CID_MPEG_VIDEO_H264_PROFILE, options_->profile, "failed to set profile");
+    setControlValue(V4L2_CID_MPEG_VIDEO_H264_LEVEL, options_->level, "failed to set level");
+    setControlValue(V4L2_CID_MPEG_VIDEO_H264_I_PERIOD, options_->intra, "failed to set intra period");
+    setControlValue(V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER, options_->inline_headers ? 1 : 0, "failed to set inline headers");
+}
+
+void H264Encoder::queueCaptureBuffer(unsigned int index, size_t length) const
 {
      v4l2_buffer buf = {};
      v4l2_plane planes[VIDEO_MAX_PLANES] = {};
      buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
      buf.memory = V4L2_MEMORY_MMAP;
-     buf.index = outputItem->index;
+     buf.index = index;
      buf.length = 1;
      buf.m.planes = planes;
      buf.m.planes[0].bytesused = 0;
-     buf.m.planes[0].length = outputItem->length;
-     if (xioctl(fd_, VIDIOC_QBUF, &buf) < 0)
+     buf.m.planes[0].length = length;
+     if (device_->Ioctl(VIDIOC_QBUF, &buf) < 0)
      {
          throw std::runtime_error("failed to re-queue encoded buffer");
      }
-
-     delete (outputItem);
 }
 
 void H264Encoder::setControlValue(uint32_t id, int32_t value, const std::string &errorText) const
@@ -252,7 +449,7 @@ void H264Encoder::setControlValue(uint32_t id, int32_t value, const std::string
     v4l2_control ctrl{};
     ctrl.id = id;
     ctrl.value = value;
-    if (xioctl(fd_, VIDIOC_S_CTRL, &ctrl) < 0)
+    if (device_->Ioctl(VIDIOC_S_CTRL, &ctrl) < 0)
     {
         throw std::runtime_error(errorText);
     }
@@ -261,25 +458,39 @@ void H264Encoder::setControlValue(uint32_t id, int32_t value, const std::string
 void H264Encoder::pollEncoder()
 {
     spdlog::trace("Starting poll thread");
-    while (!stop_requested)
+    if (trace_)
     {
-        pollfd p = {fd_, POLLIN, 0};
-        const int pollResult = poll(&p, 1, 200);
-        
-        if (pollResult == -1)
+        trace_->NameCurrentThread("encoder poll");
+    }
+    try
+    {
+        while (!stop_requested)
         {
-            if (errno == EINTR)
+            short revents = 0;
+            const int pollResult = device_->Poll(POLLIN, &revents, 200);
+
+            if (pollResult == -1)
             {
-                continue;
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error("unexpected errno " + std::to_string(errno) + " from poll");
+            }
+            if (revents & POLLIN)
+            {
+                pollReadyToReuseOutputBuffers();
+                pollReadyToProcessCaptureBuffers();
             }
-            throw std::runtime_error("unexpected errno " + std::to_string(errno) + " from poll");
-        }
-        if (p.revents & POLLIN)
-        {
-            pollReadyToReuseOutputBuffers();
-            pollReadyToProcessCaptureBuffers();
         }
     }
+    catch (std::exception const &e)
+    {
+        // Reported through Failed() for the owner to reopen the codec, rather than ending the process
+        spdlog::error("H264Encoder: poll thread failed: {}", e.what());
+        failed_ = true;
+        outputItemsQueue_.Interrupt();
+    }
 }
 
 void H264Encoder::pollReadyToReuseOutputBuffers()
@@ -290,14 +501,33 @@ void H264Encoder::pollReadyToReuseOutputBuffers()
     buffer.memory = V4L2_MEMORY_DMABUF;
     buffer.length = 1;
     buffer.m.planes = planes;
-    const int outputRequestResult = xioctl(fd_, VIDIOC_DQBUF, &buffer);
+    const int outputRequestResult = device_->Ioctl(VIDIOC_DQBUF, &buffer);
     if (outputRequestResult == 0)
     {
         spdlog::trace("Input buffer {} now available", buffer.index);
+        if (trace_)
+        {
+            trace_->Record(inputFrames_[buffer.index].sequence, TraceStage::EncoderInputReleased);
+        }
+        inputsInFlight_.Release();
         // Return this to the caller, first noting that this buffer, identified
         // by its index, is available for queueing up another frame.
-        availableInputBuffers_.enqueue(buffer.index);
-        inputBufferProcessedCallback_();
+        const size_t outputBuffersCount = inputFrames_.size();
+        if (outputBuffersCount - parkedOutputBuffers_.size() > activeOutputBuffers_)
+        {
+            parkedOutputBuffers_.push_back(buffer.index);
+        }
+        else
+        {
+            availableInputBuffers_.TryPush(buffer.index);
+        }
+        while (!parkedOutputBuffers_.empty()
+               && outputBuffersCount - parkedOutputBuffers_.size() < activeOutputBuffers_)
+        {
+            availableInputBuffers_.TryPush(parkedOutputBuffers_.back());
+            parkedOutputBuffers_.pop_back();
+        }
+        inputBufferProcessedCallback_(inputFrames_[buffer.index].cookie);
     }
 }
 
@@ -309,20 +539,45 @@ void H264Encoder::pollReadyToProcessCaptureBuffers()
     buffer.memory = V4L2_MEMORY_MMAP;
     buffer.length = 1;
     buffer.m.planes = planes;
-    const int captureRequestResult = xioctl(fd_, VIDIOC_DQBUF, &buffer);
+    const int captureRequestResult = device_->Ioctl(VIDIOC_DQBUF, &buffer);
     if (captureRequestResult == 0)
     {
         // We push this encoded buffer to another thread so that our
         // application can take its time with the data without blocking the
         // encode process.
-        int64_t timestamp_us = (buffer.timestamp.tv_sec * (int64_t)1000000) + buffer.timestamp.tv_usec;
-        OutputItem *item = new OutputItem();
-        item->mem = buffers_[buffer.index].mem;
-        item->bytes_used = buffer.m.planes[0].bytesused;
-        item->length = buffer.m.planes[0].length;
-        item->index = buffer.index;
-        item->keyframe = !!(buffer.flags & V4L2_BUF_FLAG_KEYFRAME);
-        item->timestamp_us = timestamp_us;
-        outputItemsQueue_.enqueue(item);
+        // The codec copies the timestamp of the raw frame to the encoded one
+        const int64_t timestamp_us = TimevalToMicroseconds(buffer.timestamp);
+        const uint32_t sequence = sequenceForTimestamp(timestamp_us);
+        if (trace_)
+        {
+            trace_->Record(sequence, TraceStage::Encoded);
+        }
+        OutputItem item;
+        item.mem = buffers_[buffer.index].mem;
+        item.bytes_used = buffer.m.planes[0].bytesused;
+        item.length = buffer.m.planes[0].length;
+        item.index = buffer.index;
+        item.keyframe = !!(buffer.flags & V4L2_BUF_FLAG_KEYFRAME);
+        item.timestamp_us = timestamp_us;
+        item.sequence = sequence;
+        capturesHeld_.Acquire();
+        // Descriptors are copied into the ring, which has a slot for every capture buffer
+        outputItemsQueue_.TryPush(item);
+    }
+}
+
+uint32_t H264Encoder::sequenceForTimestamp(int64_t timestamp_us) const
+{
+    // Newest first, the frame just encoded was usually queued only a few frames ago
+    const size_t newest = nextQueuedFrame_.load(std::memory_order_acquire);
+    for (size_t age = 1; age <= QueuedFramesSize; age++)
+    {
+        QueuedFrame const &queued = queuedFrames_[(newest - age) % QueuedFramesSize];
+        if (queued.timestamp_us.load(std::memory_order_acquire) == timestamp_us)
+        {
+            return queued.sequence.load(std::memory_order_relaxed);
+        }
     }
+    spdlog::warn("H264Encoder: no queued frame with timestamp {}", timestamp_us);
+    return 0;
 }
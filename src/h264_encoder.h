@@ -1,13 +1,24 @@
 #ifndef H264_ENCODER_H
 #define H264_ENCODER_H
 
+#include <array>
+#include <atomic>
 #include <thread>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include <linux/videodev2.h>
 
 #include "libcamera-streamer/encoder_options.hpp"
 #include "stream_info.hpp"
-#include "readerwriterqueue/readerwriterqueue.h"
 #include "output_item.hpp"
+#include "spsc_ring.hpp"
+#include "buffer_pool_usage.hpp"
+#include "frame_trace.h"
+#include "memory_footprint.hpp"
+#include "v4l2_device.h"
 
 class H264Encoder
 {
@@ -18,30 +29,110 @@ private:
         size_t size;
     };
 
-private:
-    static constexpr int OutputBuffersCount = 6;
-    static constexpr int CaptureBuffersCount = 12;
+    struct InputFrame
+    {
+        uint64_t cookie;
+        uint32_t sequence;
+    };
 
-    int fd_;
-    moodycamel::BlockingReaderWriterQueue<int> availableInputBuffers_;
-    moodycamel::BlockingReaderWriterQueue<OutputItem *> outputItemsQueue_;
-    BufferDescription buffers_[CaptureBuffersCount];
+    // Frames recently queued, for finding the sequence of an encoded frame by its timestamp.
+    // Encoded frames come out a few frames behind, well within the ring.
+    struct QueuedFrame
+    {
+        std::atomic<int64_t> timestamp_us{-1};
+        std::atomic<uint32_t> sequence{0};
+    };
+    static constexpr size_t QueuedFramesSize = 64;
+    // V4L2 allows no more buffers per queue, so the rings never fill
+    static constexpr size_t MaxBuffers = VIDEO_MAX_FRAME;
+
+private:
+    EncoderOptions const *options_;
+    std::unique_ptr<V4l2Device> device_;
+    SpscRing<unsigned int, MaxBuffers> availableInputBuffers_;
+    SpscRing<OutputItem, MaxBuffers> outputItemsQueue_;
+    std::vector<BufferDescription> buffers_;
+    // Caller cookie and sequence of the frame queued on each output buffer
+    std::vector<InputFrame> inputFrames_;
+    std::array<QueuedFrame, QueuedFramesSize> queuedFrames_;
+    std::atomic<size_t> nextQueuedFrame_{0};
     std::thread pollThread_;
-    std::function<void(void)> inputBufferProcessedCallback_;
+    std::function<void(uint64_t cookie)> inputBufferProcessedCallback_;
+
+    // Output buffers queued in the codec and capture buffers held by the application
+    BufferUseCounter inputsInFlight_;
+    BufferUseCounter capturesHeld_;
+    std::atomic<unsigned int> activeOutputBuffers_{0};
+    std::atomic<unsigned int> activeCaptureBuffers_{0};
+    // Buffers taken out of circulation; owned by the poll and output threads respectively
+    std::vector<unsigned int> parkedOutputBuffers_;
+    std::vector<unsigned int> parkedCaptureBuffers_;
+    FrameTrace *trace_ = nullptr;
 
 public:
-    H264Encoder(EncoderOptions const *options, StreamInfo streamInfo,
-                std::function<void(void)> inputBufferProcessedCallback);
+    // Opens the device and applies the codec controls, which do not depend on the camera
+    H264Encoder(EncoderOptions const *options, std::function<void(uint64_t cookie)> inputBufferProcessedCallback);
+    // Drives the given device instead of the Pi's encoder, such as a FakeM2mEncoder
+    H264Encoder(EncoderOptions const *options, std::function<void(uint64_t cookie)> inputBufferProcessedCallback,
+                std::unique_ptr<V4l2Device> device);
     ~H264Encoder();
 
+    // Sets the formats for the negotiated camera stream and allocates the buffers
+    void Configure(StreamInfo streamInfo);
+
+    // Queues the capture buffers, starts streaming and the poll thread. Also restarts after Stop(),
+    // with every buffer available again.
     void Start();
+    // Joins the poll thread, within its 200 ms poll timeout, and stops streaming, which drops the
+    // frames still queued in the codec without handing their cookies back. Encoded items not yet
+    // given back are abandoned: only once nothing waits for or holds them.
     void Stop();
-    void EncodeBuffer(int fd, size_t size, int64_t timestamp_us);
-    OutputItem* WaitForNextOutputItem();
-    void OutputDone(const OutputItem * outputItem) const;
+    // Queues a frame, returning false when every output buffer is busy and the frame is skipped.
+    // The capture timestamp and sequence come back on the encoded OutputItem; the cookie is
+    // handed back to the callback once the codec has consumed the frame.
+    bool EncodeBuffer(int fd, size_t size, int64_t timestamp_us, uint32_t sequence, uint64_t cookie);
+    // Empty once InterruptOutputWait() was called or the poll thread failed, until the next Start()
+    std::optional<OutputItem> WaitForNextOutputItem();
+    // From any thread, wakes the waiter in WaitForNextOutputItem() for it to stop
+    void InterruptOutputWait();
+    size_t OutputItemsQueued() const { return outputItemsQueue_.SizeApprox(); }
+    size_t InputBuffersAvailable() const { return availableInputBuffers_.SizeApprox(); }
+    void OutputDone(OutputItem const &outputItem);
+
+    BufferPoolUsage GetOutputBufferUsage() const;
+    BufferPoolUsage GetCaptureBufferUsage() const;
+    void ResetBufferUsagePeaks();
+    // Limits how many of the allocated buffers circulate, without reallocating them
+    void SetActiveBuffers(unsigned int outputBuffers, unsigned int captureBuffers);
+    // The next frame queued is encoded as an IDR
+    void RequestKeyframe() const;
+    // Rate control and GOP changes, applied while streaming
+    void SetBitrate(uint32_t bitrate) const;
+    void SetIntraPeriod(unsigned int intra) const;
+    void SetFramerate(float framerate) const;
+    // Whether the capture buffers are large enough for the frames of these options
+    bool CaptureBuffersFit(EncoderOptions const &options) const;
+    // Frees every buffer and configures the codec again from the options, for a new stream
+    // geometry or buffer counts. Only while stopped.
+    void Restream(StreamInfo streamInfo);
+    // Like Restream(), on a freshly opened device, for a codec that stopped responding. The
+    // active buffer depths are kept.
+    void Reopen(StreamInfo streamInfo);
+    // Whether the poll thread ended on an error since the last Start()
+    bool Failed() const { return failed_; }
+    ComponentFootprint GetMemoryFootprint() const;
+    // Records the codec stages of frames bound to their timestamp; set before Start()
+    void SetFrameTrace(FrameTrace *trace) { trace_ = trace; }
+    // How the output thread waits for encoded frames; set before Start()
+    void SetQueueWaitStrategy(WaitStrategy strategy) { outputItemsQueue_.SetWaitStrategy(strategy); }
 
 private:
+    void applyControls() const;
+    void releaseBuffers();
     void setControlValue(uint32_t id, int32_t value, const std::string &errorText) const;
+    void queueCaptureBuffer(unsigned int index, size_t length) const;
+    static uint32_t captureBufferSize(EncoderOptions const *options);
+    uint32_t sequenceForTimestamp(int64_t timestamp_us) const;
 
     // This thread just sits waiting for the encoder to finish stuff. It will either:
     // * receive "output" buffers (codec inputs), which we must return to the caller
@@ -51,7 +142,8 @@ private:
     // Getting ready to reuse output(raw frame) buffers
     void pollReadyToReuseOutputBuffers();
     void pollReadyToProcessCaptureBuffers();
-    bool stop_requested= false;
+    std::atomic<bool> stop_requested{false};
+    std::atomic<bool> failed_{false};
 };
 
 #endif
\ No newline at end of file
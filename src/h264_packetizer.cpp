@@ -0,0 +1,106 @@
+#include "h264_packetizer.h"
+
+#include <algorithm>
+#include <random>
+
+#include "nal_index.h"
+
+H264Packetizer::H264Packetizer(size_t mtu, uint8_t payloadType) :
+    mtu_(mtu)
+    , payloadType_(payloadType)
+{
+    // Random starting points, as RFC 3550 asks for
+    std::random_device random;
+    ssrc_ = random();
+    sequence_ = static_cast<uint16_t>(random());
+}
+
+std::vector<RtpPacket> const &H264Packetizer::Packetize(const uint8_t *data, size_t size, uint32_t rtpTimestamp)
+{
+    packets_.clear();
+    size_t startCode = FindStartCode(data, size, 0);
+    while (startCode < size)
+    {
+        size_t header = startCode;
+        while (data[header] == 0)
+        {
+            header++;
+        }
+        header++;
+        const size_t next = FindStartCode(data, size, header);
+        // Trailing zero bytes belong to the byte stream, not to the NAL unit
+        size_t end = next;
+        while (end > header && data[end - 1] == 0)
+        {
+            end--;
+        }
+        if (end > header)
+        {
+            addNalUnit(data + header, end - header, rtpTimestamp);
+        }
+        startCode = next;
+    }
+    if (!packets_.empty())
+    {
+        packets_.back().Header[1] |= 0x80;
+    }
+    return packets_;
+}
+
+RtpPacket const &H264Packetizer::PacketizeNalUnit(const uint8_t *nal, size_t size, uint32_t rtpTimestamp, bool marker)
+{
+    packets_.clear();
+    RtpPacket &packet = addPacket(rtpTimestamp);
+    packet.Payload = nal;
+    packet.PayloadSize = size;
+    if (marker)
+    {
+        packet.Header[1] |= 0x80;
+    }
+    return packet;
+}
+
+void H264Packetizer::addNalUnit(const uint8_t *nal, size_t size, uint32_t rtpTimestamp)
+{
+    if (size <= mtu_ - RtpHeaderSize)
+    {
+        RtpPacket &packet = addPacket(rtpTimestamp);
+        packet.Payload = nal;
+        packet.PayloadSize = size;
+        return;
+    }
+
+    // The NAL unit header is carried by the FU indicator and header instead
+    const uint8_t indicator = (nal[0] & 0xe0) | FuA;
+    const uint8_t type = nal[0] & 0x1f;
+    const size_t fragmentSize = mtu_ - RtpHeaderSize - 2;
+    for (size_t offset = 1; offset < size; offset += fragmentSize)
+    {
+        RtpPacket &packet = addPacket(rtpTimestamp);
+        packet.Header[RtpHeaderSize] = indicator;
+        packet.Header[RtpHeaderSize + 1] = type | (offset == 1 ? 0x80 : 0) | (offset + fragmentSize >= size ? 0x40 : 0);
+        packet.HeaderSize = RtpHeaderSize + 2;
+        packet.Payload = nal + offset;
+        packet.PayloadSize = std::min(fragmentSize, size - offset);
+    }
+}
+
+RtpPacket &H264Packetizer::addPacket(uint32_t rtpTimestamp)
+{
+    RtpPacket &packet = packets_.emplace_back();
+    const uint16_t sequence = sequence_++;
+    packet.Header[0] = 0x80;
+    packet.Header[1] = payloadType_;
+    packet.Header[2] = sequence >> 8;
+    packet.Header[3] = sequence & 0xff;
+    packet.Header[4] = rtpTimestamp >> 24;
+    packet.Header[5] = (rtpTimestamp >> 16) & 0xff;
+    packet.Header[6] = (rtpTimestamp >> 8) & 0xff;
+    packet.Header[7] = rtpTimestamp & 0xff;
+    packet.Header[8] = ssrc_ >> 24;
+    packet.Header[9] = (ssrc_ >> 16) & 0xff;
+    packet.Header[10] = (ssrc_ >> 8) & 0xff;
+    packet.Header[11] = ssrc_ & 0xff;
+    packet.HeaderSize = RtpHeaderSize;
+    return packet;
+}
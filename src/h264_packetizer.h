@@ -0,0 +1,56 @@
+#ifndef H264_PACKETIZER_H
+#define H264_PACKETIZER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// An RTP packet as a header and a payload left in place in the access unit, ready for a
+// gathering send
+struct RtpPacket
+{
+    // The RTP header, then the FU indicator and FU header of a fragment
+    std::array<uint8_t, 14> Header;
+    uint8_t HeaderSize;
+    const uint8_t *Payload;
+    size_t PayloadSize;
+
+    size_t Size() const { return HeaderSize + PayloadSize; }
+};
+
+// Splits H.264 access units into RTP packets following RFC 6184 in non-interleaved mode: a single
+// NAL unit packet for each NAL unit that fits the MTU, FU-A fragments for the others, and the
+// marker bit on the last packet of the access unit.
+class H264Packetizer
+{
+public:
+    static constexpr size_t RtpHeaderSize = 12;
+    static constexpr uint8_t FuA = 28;
+    static constexpr uint8_t StapA = 24;
+
+private:
+    size_t mtu_;
+    uint8_t payloadType_;
+    uint32_t ssrc_;
+    uint16_t sequence_;
+    std::vector<RtpPacket> packets_;
+
+public:
+    // Dynamic payload type 96 as uvgRTP uses, random SSRC and starting sequence number
+    explicit H264Packetizer(size_t mtu, uint8_t payloadType = 96);
+
+    // Packets of an Annex-B access unit. Payloads point into data, which must stay valid while
+    // they are sent; the packets themselves are reused by the next call.
+    std::vector<RtpPacket> const &Packetize(const uint8_t *data, size_t size, uint32_t rtpTimestamp);
+    // One packet carrying the given NAL unit payload as is, such as a STAP-A
+    RtpPacket const &PacketizeNalUnit(const uint8_t *nal, size_t size, uint32_t rtpTimestamp, bool marker);
+
+    uint32_t Ssrc() const { return ssrc_; }
+
+private:
+    void addNalUnit(const uint8_t *nal, size_t size, uint32_t rtpTimestamp);
+    RtpPacket &addPacket(uint32_t rtpTimestamp);
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "h264_parameter_sets.h"
+
+#include "bit_writer.hpp"
+
+uint8_t H264LevelIdc(v4l2_mpeg_video_h264_level level)
+{
+    switch (level)
+    {
+        case V4L2_MPEG_VIDEO_H264_LEVEL_1_0:
+            return 10;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_1B:
+        case V4L2_MPEG_VIDEO_H264_LEVEL_1_1:
+            return 11;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_1_2:
+            return 12;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_1_3:
+            return 13;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_2_0:
+            return 20;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_2_1:
+            return 21;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_2_2:
+            return 22;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_3_0:
+            return 30;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_3_1:
+            return 31;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_3_2:
+            return 32;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_4_0:
+            return 40;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_4_1:
+            return 41;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_4_2:
+            return 42;
+        case V4L2_MPEG_VIDEO_H264_LEVEL_5_0:
+            return 50;
+        default:
+            return 51;
+    }
+}
+
+std::vector<uint8_t> MakeBaselineSps(unsigned int width, unsigned int height, uint8_t level)
+{
+    const unsigned int widthInMbs = (width + 15) / 16;
+    const unsigned int heightInMbs = (height + 15) / 16;
+
+    BitWriter sps;
+    sps.WriteBits(66, 8); // profile_idc
+    sps.WriteBits(0xC0, 8); // constraint_set0_flag, constraint_set1_flag
+    sps.WriteBits(level, 8);
+    sps.WriteUe(0); // seq_parameter_set_id
+    sps.WriteUe(BaselineLog2MaxFrameNum - 4);
+    sps.WriteUe(2); // pic_order_cnt_type
+    sps.WriteUe(1); // max_num_ref_frames
+    sps.WriteBit(false); // gaps_in_frame_num_value_allowed_flag
+    sps.WriteUe(widthInMbs - 1);
+    sps.WriteUe(heightInMbs - 1);
+    sps.WriteBit(true); // frame_mbs_only_flag
+    sps.WriteBit(true); // direct_8x8_inference_flag
+    const bool cropping = widthInMbs * 16 != width || heightInMbs * 16 != height;
+    sps.WriteBit(cropping);
+    if (cropping)
+    {
+        // Crop units are two pixels in both directions for 4:2:0 progressive video
+        sps.WriteUe(0);
+        sps.WriteUe((widthInMbs * 16 - width) / 2);
+        sps.WriteUe(0);
+        sps.WriteUe((heightInMbs * 16 - height) / 2);
+    }
+    sps.WriteBit(false); // vui_parameters_present_flag
+    sps.WriteTrailingBits();
+    return sps.Bytes();
+}
+
+std::vector<uint8_t> MakeBaselinePps()
+{
+    BitWriter pps;
+    pps.WriteUe(0); // pic_parameter_set_id
+    pps.WriteUe(0); // seq_parameter_set_id
+    pps.WriteBit(false); // entropy_coding_mode_flag
+    pps.WriteBit(false); // bottom_field_pic_order_in_frame_present_flag
+    pps.WriteUe(0); // num_slice_groups_minus1
+    pps.WriteUe(0); // num_ref_idx_l0_default_active_minus1
+    pps.WriteUe(0); // num_ref_idx_l1_default_active_minus1
+    pps.WriteBit(false); // weighted_pred_flag
+    pps.WriteBits(0, 2); // weighted_bipred_idc
+    pps.WriteSe(0); // pic_init_qp_minus26
+    pps.WriteSe(0); // pic_init_qs_minus26
+    pps.WriteSe(0); // chroma_qp_index_offset
+    pps.WriteBit(true); // deblocking_filter_control_present_flag
+    pps.WriteBit(false); // constrained_intra_pred_flag
+    pps.WriteBit(false); // redundant_pic_cnt_present_flag
+    pps.WriteTrailingBits();
+    return pps.Bytes();
+}
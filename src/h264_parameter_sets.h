@@ -0,0 +1,21 @@
+#ifndef H264_PARAMETER_SETS_H
+#define H264_PARAMETER_SETS_H
+
+#include <cstdint>
+#include <vector>
+
+#include <linux/v4l2-controls.h>
+
+// Minimal parameter sets for streams generated without the hardware encoder: the placeholder
+// video and the fake encoder. RBSPs without the NAL unit header, for AppendNalUnit().
+
+// frame_num of slices referring to MakeBaselineSps() takes this many bits
+constexpr unsigned int BaselineLog2MaxFrameNum = 4;
+
+uint8_t H264LevelIdc(v4l2_mpeg_video_h264_level level);
+// Constrained baseline, POC type 2, a single reference frame and no VUI
+std::vector<uint8_t> MakeBaselineSps(unsigned int width, unsigned int height, uint8_t level);
+// CAVLC, a single slice group and the deblocking filter controlled from the slice header
+std::vector<uint8_t> MakeBaselinePps();
+
+#endif
@@ -5,20 +5,63 @@
 #include <uvgrtp/lib.hh>
 
 #include <chrono>
+#include <malloc.h>
+#include <future>
 
 //#include "completed_request.hpp"
 //#include "output/output.hpp"
 
+static uint64_t getTimeNs(){
+    const auto time=std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+}
+static uint64_t __attribute__((unused)) getTimeUs(){
+    const auto time=std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+}
+
 LibcameraStreamer::LibcameraStreamer(StreamerConfiguration configuration)
     :configuration_(std::move(configuration))
+    ,spsRewriter_(configuration_.Output.RewriteVui ? std::make_unique<SpsRewriter>(configuration_.Encoder.framerate) : nullptr)
+    ,parameterSets_(spsRewriter_.get())
 {
     spdlog::trace("LibcameraStreamer streamer creating");
+
+    // Neither the encoder device nor the output depend on libcamera, so they are brought up
+    // while the camera manager enumerates and configures the sensor.
+    auto encoderOpening = std::async(std::launch::async, [this]() {
+        const auto begin = StartupTimeline::Clock::now();
+        auto encoder = std::make_unique<H264Encoder>(&configuration_.Encoder,
+                                                     [=](uint64_t cookie) -> void { this->inputBufferProcessedCallback(cookie); });
+        startupTimeline_.Record("encoder open", begin);
+        return encoder;
+    });
+    auto outputOpening = std::async(std::launch::async, [this]() {
+        const auto begin = StartupTimeline::Clock::now();
+        // The encoder may not be open yet, or being reopened, when an RTSP client asks for a keyframe
+        output_ = MakeFrameOutput(&configuration_.Output, &parameterSets_,
+                                  [this]() { clientKeyframeRequested_ = true; });
+        outputHeapBytes_ = output_->HeapBytes();
+        startupTimeline_.Record("output open", begin);
+        if (configuration_.Output.SendPlaceholder) {
+            // Stamped on the same monotonic clock as the sensor so the RTP timeline carries on smoothly
+            placeholder_ = std::make_unique<PlaceholderStream>(&configuration_.Encoder, [this](uint8_t *data, size_t size) {
+                const FrameFragment fragment = {data, size};
+                output_->SendFrame(&fragment, 1, getTimeUs());
+                outputHeapBytes_.store(output_->HeapBytes(), std::memory_order_relaxed);
+            });
+            placeholder_->Start();
+        }
+    });
+
+    auto begin = StartupTimeline::Clock::now();
     auto cameraManager = std::make_unique<libcamera::CameraManager>();
     const auto isStarted = cameraManager->start();
     if (isStarted) {
         throw std::runtime_error("camera manager failed to start, code "
             + std::to_string(-isStarted));
     }
+    startupTimeline_.Record("camera manager start", begin);
 
     auto cameras = cameraManager->cameras();
     // Do not show USB webcams as these are not supported in libcamera-apps!
@@ -34,88 +77,600 @@ LibcameraStreamer::LibcameraStreamer(StreamerConfiguration configuration)
 
     std::string const& cam_id = cameras[0]->id();
 
+    begin = StartupTimeline::Clock::now();
     cameraWrapper_ = std::make_unique<CameraWrapper>(std::move(cameraManager), cam_id, &configuration_.Camera);
+    startupTimeline_.Record("camera acquire", begin);
+
+    // The validated configuration already carries the final stride, so the encoder formats and
+    // buffers can be set up while libcamera configures the sensor and allocates its buffers.
     auto streamInfo = cameraWrapper_->GetStreamInfo();
-    encoderWrapper_ = std::make_unique<H264Encoder>(&configuration_.Encoder, streamInfo,
-                                                    [=]() -> void { this->inputBufferProcessedCallback(); });
+    encoderWrapper_ = encoderOpening.get();
+    auto encoderConfiguring = std::async(std::launch::async, [this, streamInfo]() {
+        const auto begin = StartupTimeline::Clock::now();
+        encoderWrapper_->Configure(streamInfo);
+        startupTimeline_.Record("encoder configure", begin);
+    });
 
-    sess_ = ctx_.create_session(configuration_.Output.Ip);
-    int flags = RCE_SEND_ONLY;
-    stream_ = sess_->create_stream(configuration_.Output.Port, RTP_FORMAT_H264, flags);
-    stream_->configure_ctx(RCC_MTU_SIZE, 1400);
+    begin = StartupTimeline::Clock::now();
+    cameraWrapper_->Configure();
+    startupTimeline_.Record("camera configure", begin);
 
-    stop_requested=false;
-    fromCameraToEncoderThread_ = std::thread(&LibcameraStreamer::completedRequestsProcessor, this);
-    fromEncoderToOutputThread_ = std::thread(&LibcameraStreamer::encodedFramesProcessor, this);
-    cameraWrapper_->StartCamera();
-    encoderWrapper_->Start();
+    encoderConfiguring.get();
+    outputOpening.get();
+
+    if (configuration_.MemoryBudgetBytes > 0) {
+        const auto footprint = GetMemoryFootprint();
+        const size_t held = footprint.DmabufBytes() + footprint.Camera.HeapBytes + footprint.Encoder.HeapBytes
+                            + footprint.Output.HeapBytes;
+        if (held > configuration_.MemoryBudgetBytes) {
+            throw std::runtime_error("memory budget exceeded: " + std::to_string(held >> 10) + " KiB held (camera "
+                                     + std::to_string(footprint.Camera.DmabufBytes >> 10) + " KiB, encoder "
+                                     + std::to_string(footprint.Encoder.DmabufBytes >> 10) + " KiB of buffers), budget "
+                                     + std::to_string(configuration_.MemoryBudgetBytes >> 10) + " KiB");
+        }
+    }
+
+    if (!configuration_.MetricsEndpoint.empty()) {
+        metricsServer_ = std::make_unique<MetricsServer>(configuration_.MetricsEndpoint,
+                                                         [this]() { return GetStatistics(); });
+    }
+
+
+    const WaitStrategy waitStrategy{configuration_.QueueSpinIterations};
+    cameraWrapper_->SetQueueWaitStrategy(waitStrategy);
+    encoderWrapper_->SetQueueWaitStrategy(waitStrategy);
+
+    if (configuration_.TraceFrames > 0) {
+        frameTrace_ = std::make_unique<FrameTrace>(configuration_.TraceFrames);
+        cameraWrapper_->SetFrameTrace(frameTrace_.get());
+        encoderWrapper_->SetFrameTrace(frameTrace_.get());
+    }
+
+    if (configuration_.AutoTuneBuffers) {
+        bufferDepthTuner_ = std::make_unique<BufferDepthTuner>(cameraWrapper_.get(), encoderWrapper_.get(),
+                                                               configuration_.BufferCalibrationFrames);
+    }
+
+    if (configuration_.WatchdogStallFrames > 0) {
+        watchdog_ = std::make_unique<PipelineWatchdog>(configuration_.WatchdogStallFrames, configuration_.Camera.framerate);
+    }
+    outputStage_ = std::make_unique<OutputStage>(&configuration_.Output, spsRewriter_.get(), &parameterSets_,
+                                                 &statistics_, &frameMetadata_, placeholder_.get(), watchdog_.get());
+    startPipeline(true);
+    if (watchdog_) {
+        watchdogThread_ = std::thread(&LibcameraStreamer::watchdogLoop, this);
+    }
     spdlog::trace("LibcameraStreamer streamer created");
 }
 
 LibcameraStreamer::~LibcameraStreamer() {
-    stop_requested=true;
+    if (watchdogThread_.joinable()) {
+        {
+            const std::lock_guard lock(watchdogMutex_);
+            watchdogStopRequested_ = true;
+        }
+        watchdogCondition_.notify_all();
+        watchdogThread_.join();
+    }
+    {
+        const std::lock_guard lock(controlMutex_);
+        if (running_) {
+            try {
+                stopPipeline();
+            } catch (std::exception const &e) {
+                spdlog::error("Destroying the streamer with its pipeline still running: {}", e.what());
+            }
+        }
+    }
+    if (traceDump_.valid()) {
+        traceDump_.wait();
+    }
+    // An RTSP server reads the parameter set cache, which would otherwise be destroyed first. The
+    // placeholder sends through the output, so it goes before.
+    placeholder_.reset();
+    output_.reset();
+}
+
+void LibcameraStreamer::Start()
+{
+    const std::lock_guard lock(controlMutex_);
+    if (running_) {
+        return;
+    }
+    const auto begin = std::chrono::steady_clock::now();
+    startPipeline(false);
+    spdlog::info("Pipeline restarted in {} ms",
+                 std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count());
+}
+
+void LibcameraStreamer::Stop()
+{
+    const std::lock_guard lock(controlMutex_);
+    if (running_) {
+        stopPipeline();
+    }
+}
+
+void LibcameraStreamer::startPipeline(bool firstStart)
+{
+    stop_requested = false;
+    // Both queues are reset and ready for their waiters before the threads start
+    encoderWrapper_->Start();
+    const auto begin = StartupTimeline::Clock::now();
+    cameraWrapper_->StartCamera();
+    if (firstStart) {
+        startupTimeline_.Record("camera start", begin);
+    }
+    {
+        const std::lock_guard lock(pipelineThreadsMutex_);
+        pipelineThreadsRunning_ = 2;
+    }
+    fromCameraToEncoderThread_ = std::thread(&LibcameraStreamer::runPipelineThread, this,
+                                             &LibcameraStreamer::completedRequestsProcessor, firstStart);
+    fromEncoderToOutputThread_ = std::thread(&LibcameraStreamer::runPipelineThread, this,
+                                             &LibcameraStreamer::encodedFramesProcessor, firstStart);
+    if (watchdog_) {
+        watchdog_->Started(getTimeUs());
+    }
+    running_ = true;
+}
+
+void LibcameraStreamer::stopPipeline()
+{
+    const auto begin = std::chrono::steady_clock::now();
+    stop_requested = true;
+    if (placeholder_) {
+        placeholder_->Stop();
+    }
+    // The camera first, so nothing completes behind the threads' backs, then both threads leave
+    // their waits. Frames still queued in the codec are dropped when it stops streaming.
     cameraWrapper_->StopCamera();
-    if(fromCameraToEncoderThread_.joinable()){
+    cameraWrapper_->InterruptCompletedRequestWait();
+    encoderWrapper_->InterruptOutputWait();
+    {
+        std::unique_lock lock(pipelineThreadsMutex_);
+        const auto exited = [this]() { return pipelineThreadsRunning_ == 0; };
+        if (configuration_.ShutdownTimeoutMs == 0) {
+            pipelineThreadsExited_.wait(lock, exited);
+        } else if (!pipelineThreadsExited_.wait_until(
+                       lock, begin + std::chrono::milliseconds(configuration_.ShutdownTimeoutMs), exited)) {
+            spdlog::error("{} pipeline thread(s) still running {} ms after the stop request, leaving them",
+                          pipelineThreadsRunning_, configuration_.ShutdownTimeoutMs);
+            // They leave their loops whenever the call they are stuck in returns. The pipeline
+            // stays running_, so the next stop, or the watchdog's next recovery, waits for them again.
+            if (fromCameraToEncoderThread_.joinable()) {
+                fromCameraToEncoderThread_.detach();
+            }
+            if (fromEncoderToOutputThread_.joinable()) {
+                fromEncoderToOutputThread_.detach();
+            }
+            throw std::runtime_error("pipeline threads did not stop within "
+                                     + std::to_string(configuration_.ShutdownTimeoutMs) + " ms");
+        }
+    }
+    // Not started when a restart failed part way
+    if (fromCameraToEncoderThread_.joinable()) {
         fromCameraToEncoderThread_.join();
     }
-    if(fromEncoderToOutputThread_.joinable()){
+    if (fromEncoderToOutputThread_.joinable()) {
         fromEncoderToOutputThread_.join();
     }
     encoderWrapper_->Stop();
-    if (stream_){
-        sess_->destroy_stream(stream_);
-    }
-    if (sess_){
-        /* Session must be destroyed manually */
-        ctx_.destroy_session(sess_);
+    running_ = false;
+    spdlog::info("Pipeline stopped in {} ms",
+                 std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count());
+}
+
+void LibcameraStreamer::runPipelineThread(void (LibcameraStreamer::*processor)(bool) const, bool firstStart) const
+{
+    try {
+        (this->*processor)(firstStart);
+    } catch (std::exception const &e) {
+        if (!watchdog_) {
+            pipelineThreadExited();
+            throw;
+        }
+        // Codec calls are what throws on these threads
+        spdlog::error("Pipeline thread failed: {}", e.what());
+        watchdog_->Failed(PipelineComponent::Encoder);
     }
+    pipelineThreadExited();
 }
 
-using namespace std::placeholders;
+void LibcameraStreamer::watchdogLoop()
+{
+    std::unique_lock lock(watchdogMutex_);
+    while (!watchdogStopRequested_) {
+        // A few checks per stall timeout
+        watchdogCondition_.wait_for(lock, std::chrono::microseconds(watchdog_->StallUs() / 4));
+        if (watchdogStopRequested_) {
+            break;
+        }
+        lock.unlock();
+        if (encoderWrapper_->Failed()) {
+            watchdog_->Failed(PipelineComponent::Encoder);
+        }
+        if (const auto component = watchdog_->Check(getTimeUs())) {
+            recover(*component);
+        }
+        lock.lock();
+    }
+}
 
-static uint64_t getTimeNs(){
-    const auto time=std::chrono::steady_clock::now().time_since_epoch();
-    return std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+void LibcameraStreamer::recover(PipelineComponent component)
+{
+    // Stop(), Start() and Reconfigure() go first, the next check sees what they left
+    std::unique_lock lock(controlMutex_, std::try_to_lock);
+    if (!lock.owns_lock() || !running_) {
+        return;
+    }
+    const auto begin = std::chrono::steady_clock::now();
+    spdlog::warn("Watchdog: {} stalled, recovering it", PipelineComponentName(component));
+    try {
+        switch (component) {
+            case PipelineComponent::Camera:
+                // The camera keeps its buffers and requests, the codec only streams off and on again
+                stopPipeline();
+                startPipeline(false);
+                break;
+            case PipelineComponent::Encoder:
+                stopPipeline();
+                encoderWrapper_->Reopen(cameraWrapper_->GetStreamInfo());
+                startPipeline(false);
+                break;
+            default:
+                // Done on the output thread, the only one sending live frames, which counts the
+                // recovery once the output has reconnected
+                outputStage_->RequestReconnect();
+                return;
+        }
+    } catch (std::exception const &e) {
+        spdlog::error("Watchdog: recovering the {} failed: {}", PipelineComponentName(component), e.what());
+        // Stop() still stops whatever did start. Started() forgets failures, so the same
+        // component is marked again and the next check retries its recovery rather than
+        // blaming the stages it left stalled.
+        running_ = true;
+        watchdog_->Started(getTimeUs());
+        watchdog_->Failed(component);
+        return;
+    }
+    watchdog_->Recovered(component, getTimeUs());
+    spdlog::warn("Watchdog: {} recovered in {} ms, {} time(s) so far", PipelineComponentName(component),
+                 std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count(),
+                 watchdog_->Recoveries(component));
 }
-static uint64_t __attribute__((unused)) getTimeUs(){
-    const auto time=std::chrono::steady_clock::now().time_since_epoch();
-    return std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+
+void LibcameraStreamer::pipelineThreadExited() const
+{
+    {
+        const std::lock_guard lock(pipelineThreadsMutex_);
+        pipelineThreadsRunning_--;
+    }
+    pipelineThreadsExited_.notify_all();
 }
 
+using namespace std::placeholders;
+
+
 // called when there is a new libcamera raw buffer
-void LibcameraStreamer::completedRequestsProcessor() const
+void LibcameraStreamer::completedRequestsProcessor(bool firstStart) const
 {
+    bool firstFrame = firstStart;
+    std::optional<uint32_t> lastSequence;
+    if (frameTrace_) {
+        frameTrace_->NameCurrentThread("camera to encoder");
+    }
     while (!stop_requested) {
         const auto request = cameraWrapper_->WaitForCompletedRequest();
+        if (!request) {
+            break;
+        }
         spdlog::trace("LibcameraStreamer: New completed request");
+        if (watchdog_) {
+            watchdog_->Progress(PipelineStage::Captured, getTimeUs());
+        }
+        if (firstFrame) {
+            startupTimeline_.Mark("first frame captured");
+            firstFrame = false;
+        }
+
+        if (frameTrace_) {
+            frameTrace_->Record(request->sequence(), TraceStage::Dequeued);
+        }
 
         const auto buffer = cameraWrapper_->GetFrameBufferForRequest(request);
-        libcamera::Span bufferMemory = cameraWrapper_->Mmap(buffer)[0];
         auto ts = request->metadata().get(libcamera::controls::SensorTimestamp);
         int64_t timestamp_ns = ts ? *ts : buffer->metadata().timestamp;
         const auto delay_ns=getTimeNs()-timestamp_ns;
         const float delay_ms=delay_ns / 1000 / 1000.0;
         spdlog::info("Delay camera?: {} ms",delay_ms);
-        // feed current time to measure encode only
-        encoderWrapper_->EncodeBuffer(buffer->planes()[0].fd.get(), bufferMemory.size(), getTimeUs());
+        if (configuration_.Output.MetadataSeiFields != 0) {
+            frameMetadata_.Put(ExtractFrameMetadata(request->metadata(), configuration_.Output.MetadataSeiFields,
+                                                    timestamp_ns / 1000, request->sequence()));
+        }
+        // The capture time and sequence travel with the frame through the encoder
+        const bool queued = encoderWrapper_->EncodeBuffer(buffer->planes()[0].fd.get(), cameraWrapper_->GetFrameBufferSize(buffer),
+                                                          timestamp_ns / 1000, request->sequence(), request->cookie());
+        if (!queued) {
+            cameraWrapper_->ReuseRequest(request->cookie());
+        }
+
+        const uint32_t droppedByCamera = lastSequence ? request->sequence() - *lastSequence - 1 : 0;
+        statistics_.FrameCaptured(droppedByCamera, !queued);
+        if (bufferDepthTuner_) {
+            bufferDepthTuner_->OnCameraFrame(droppedByCamera > 0 || !queued, delay_ms);
+        }
+        lastSequence = request->sequence();
     }
 }
 
-void LibcameraStreamer::encodedFramesProcessor() const
+void LibcameraStreamer::encodedFramesProcessor(bool firstStart) const
 {
+    bool firstPacket = firstStart;
+    std::optional<uint32_t> lastTraceDump;
+    if (frameTrace_) {
+        frameTrace_->NameCurrentThread("encoder to output");
+    }
+    outputStage_->Begin();
     while (!stop_requested)
     {
-        auto nextOutputItem = encoderWrapper_->WaitForNextOutputItem();
-        const auto delay_us=getTimeUs()-nextOutputItem->timestamp_us;
+        const auto waited = encoderWrapper_->WaitForNextOutputItem();
+        if (!waited)
+        {
+            if (encoderWrapper_->Failed())
+            {
+                throw std::runtime_error("the encoder failed");
+            }
+            break;
+        }
+        auto const &nextOutputItem = *waited;
+        if (clientKeyframeRequested_.exchange(false))
+        {
+            outputStage_->RequestParameterSets();
+            encoderWrapper_->RequestKeyframe();
+        }
+        if (!outputStage_->Accept(nextOutputItem))
+        {
+            encoderWrapper_->OutputDone(nextOutputItem);
+            continue;
+        }
+        const auto delay_us=getTimeUs()-nextOutputItem.timestamp_us;
         const float delay_ms=delay_us / 1000.0;
-        spdlog::info("Delay encode: {} ms",delay_ms);
-        stream_->push_frame(static_cast<uint8_t *>(nextOutputItem->mem), nextOutputItem->bytes_used, RTP_COPY);
+        spdlog::info("Delay capture to encoded: {} ms (frame {})",delay_ms,nextOutputItem.sequence);
+        if (bufferDepthTuner_) {
+            bufferDepthTuner_->OnFrameEncoded(delay_ms);
+        }
+        const uint32_t sequence = nextOutputItem.sequence;
+        if (frameTrace_) {
+            frameTrace_->Record(sequence, TraceStage::SendBegin);
+        }
+        const bool sent = outputStage_->Send(nextOutputItem, *output_);
+        outputHeapBytes_.store(output_->HeapBytes(), std::memory_order_relaxed);
+        frameSent(getTimeUs());
+        if (frameTrace_) {
+            frameTrace_->Record(sequence, TraceStage::SendEnd);
+            const bool slow = configuration_.TraceAnomalyMs > 0
+                              && getTimeUs() - nextOutputItem.timestamp_us > configuration_.TraceAnomalyMs * 1000ll;
+            // Dump at most once per ring length, so consecutive dumps do not repeat the same frames
+            const bool dumpedRecently = lastTraceDump && sequence - *lastTraceDump < frameTrace_->Capacity();
+            if ((slow || !sent) && !dumpedRecently) {
+                dumpFrameTrace(sequence);
+                lastTraceDump = sequence;
+            }
+        }
         encoderWrapper_->OutputDone(nextOutputItem);
+        if (firstPacket)
+        {
+            startupTimeline_.Mark("first packet sent");
+            startupTimeline_.Log();
+            firstPacket = false;
+        }
+    }
+}
+
+std::vector<StartupPhase> LibcameraStreamer::GetStartupTimeline() const
+{
+    return startupTimeline_.Phases();
+}
+
+ConvergenceStats LibcameraStreamer::GetConvergenceStats() const
+{
+    return cameraWrapper_->GetConvergenceStats();
+}
+
+PipelineStatisticsSnapshot LibcameraStreamer::GetStatistics() const
+{
+    auto snapshot = statistics_.Snapshot();
+    snapshot.CompletedRequestsQueued = cameraWrapper_->CompletedRequestsQueued();
+    snapshot.EncoderInputBuffersAvailable = encoderWrapper_->InputBuffersAvailable();
+    snapshot.OutputItemsQueued = encoderWrapper_->OutputItemsQueued();
+    if (watchdog_) {
+        snapshot.CameraRestarts = watchdog_->Recoveries(PipelineComponent::Camera);
+        snapshot.EncoderRestarts = watchdog_->Recoveries(PipelineComponent::Encoder);
+        snapshot.OutputReconnects = watchdog_->Recoveries(PipelineComponent::Output);
+    }
+    return snapshot;
+}
+
+MemoryFootprint LibcameraStreamer::GetMemoryFootprint() const
+{
+    // Not while Reconfigure() or a recovery reallocates the camera and encoder buffers
+    const std::lock_guard lock(controlMutex_);
+    MemoryFootprint footprint;
+    footprint.Camera = cameraWrapper_->GetMemoryFootprint();
+    footprint.Encoder = encoderWrapper_->GetMemoryFootprint();
+    footprint.Output.HeapBytes += outputHeapBytes_.load(std::memory_order_relaxed);
+    if (placeholder_) {
+        footprint.Output.HeapBytes += placeholder_->HeapBytes();
+    }
+#if __GLIBC_PREREQ(2, 33)
+    footprint.ProcessHeapBytes = mallinfo2().uordblks;
+#else
+    footprint.ProcessHeapBytes = static_cast<unsigned int>(mallinfo().uordblks);
+#endif
+    return footprint;
+}
+
+std::optional<BufferTuningReport> LibcameraStreamer::GetBufferTuningReport() const
+{
+    if (!bufferDepthTuner_) {
+        return std::nullopt;
+    }
+    return bufferDepthTuner_->Report();
+}
+
+void LibcameraStreamer::RequestKeyframe()
+{
+    // Set first, the keyframe may come out of the encoder before the control call returns
+    outputStage_->RequestParameterSets();
+    encoderWrapper_->RequestKeyframe();
+}
+
+void LibcameraStreamer::WriteFrameTrace(std::string const &path) const
+{
+    if (!frameTrace_) {
+        throw std::runtime_error("frame tracing is disabled");
+    }
+    frameTrace_->Write(path);
+}
+
+void LibcameraStreamer::dumpFrameTrace(uint32_t sequence) const
+{
+    if (traceDump_.valid() && traceDump_.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return;
+    }
+    spdlog::warn("Frame {} was late or failed to send, writing frame trace", sequence);
+    traceDump_ = std::async(std::launch::async, [this]() {
+        try {
+            frameTrace_->Write(configuration_.TraceFile);
+        } catch (std::exception const &e) {
+            spdlog::warn("Writing frame trace failed: {}", e.what());
+        }
+    });
+}
+
+ReconfigurationReport LibcameraStreamer::Reconfigure(StreamerConfiguration const &configuration)
+{
+    const std::lock_guard lock(controlMutex_);
+    const auto begin = std::chrono::steady_clock::now();
+    ReconfigurationReport report;
+
+    auto const &camera = configuration.Camera;
+    auto const &encoder = configuration.Encoder;
+    auto const &currentCamera = configuration_.Camera;
+    auto const &currentEncoder = configuration_.Encoder;
+    // Everything the buffers, formats or profile depend on only changes while the codec and camera
+    // are not streaming
+    report.Restreamed = camera.width != currentCamera.width || camera.height != currentCamera.height
+                        || camera.buffer_count != currentCamera.buffer_count
+                        || camera.mode_string != currentCamera.mode_string || encoder.width != currentEncoder.width
+                        || encoder.height != currentEncoder.height || encoder.profile != currentEncoder.profile
+                        || encoder.level != currentEncoder.level || encoder.inline_headers != currentEncoder.inline_headers
+                        || encoder.output_buffers != currentEncoder.output_buffers
+                        || encoder.capture_buffers != currentEncoder.capture_buffers
+                        || encoder.capture_buffer_size != currentEncoder.capture_buffer_size
+                        // A higher bitrate can outgrow the capture buffers
+                        || !encoderWrapper_->CaptureBuffersFit(encoder);
+    report.Framerate = camera.framerate != currentCamera.framerate || encoder.framerate != currentEncoder.framerate;
+    report.EncoderControls = encoder.bitrate != currentEncoder.bitrate || encoder.intra != currentEncoder.intra;
+
+    if (report.Restreamed) {
+        restream(configuration, report);
+    } else {
+        if (encoder.bitrate != currentEncoder.bitrate) {
+            encoderWrapper_->SetBitrate(encoder.bitrate);
+            configuration_.Encoder.bitrate = encoder.bitrate;
+        }
+        if (encoder.intra != currentEncoder.intra) {
+            encoderWrapper_->SetIntraPeriod(encoder.intra);
+            configuration_.Encoder.intra = encoder.intra;
+        }
+        if (report.Framerate) {
+            cameraWrapper_->SetFramerate(camera.framerate);
+            encoderWrapper_->SetFramerate(encoder.framerate);
+            configuration_.Camera.framerate = camera.framerate;
+            configuration_.Encoder.framerate = encoder.framerate;
+        }
+        startGapMeasurement(report);
+    }
+    if (report.Framerate && watchdog_) {
+        watchdog_->SetFramerate(configuration_.Camera.framerate);
+    }
+    if (report.Framerate) {
+        // The SPS timing info follows, sent with the next keyframe
+        outputStage_->SetFramerate(encoder.framerate);
+        RequestKeyframe();
+    }
+
+    report.ApplyMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    spdlog::info("Reconfigured in {:.1f} ms{}{}{}", report.ApplyMs, report.Restreamed ? ", restreamed" : "",
+                 report.Framerate ? ", frame rate" : "", report.EncoderControls ? ", encoder controls" : "");
+    const std::lock_guard reportLock(reconfigurationReportMutex_);
+    // The first frame after the change may already have been sent
+    lastReconfiguration_->ApplyMs = report.ApplyMs;
+    report.GapMs = lastReconfiguration_->GapMs;
+    return report;
+}
+
+std::optional<ReconfigurationReport> LibcameraStreamer::GetLastReconfiguration() const
+{
+    const std::lock_guard lock(reconfigurationReportMutex_);
+    return lastReconfiguration_;
+}
+
+void LibcameraStreamer::restream(StreamerConfiguration const &configuration, ReconfigurationReport const &report)
+{
+    const bool running = running_;
+    if (running) {
+        stopPipeline();
+    }
+    // Nothing is sent until the pipeline restarts
+    startGapMeasurement(report);
+    // The components read their options through pointers into the configuration
+    configuration_.Camera = configuration.Camera;
+    configuration_.Encoder = configuration.Encoder;
+
+    auto begin = StartupTimeline::Clock::now();
+    cameraWrapper_->ResetConfiguration();
+    const auto streamInfo = cameraWrapper_->GetStreamInfo();
+    // As at construction, the codec is set up while libcamera allocates the camera buffers
+    auto encoderRestreaming = std::async(std::launch::async, [this, streamInfo]() {
+        encoderWrapper_->Restream(streamInfo);
+    });
+    cameraWrapper_->Configure();
+    encoderRestreaming.get();
+    spdlog::debug("Camera and encoder reconfigured in {} ms",
+                  std::chrono::duration_cast<std::chrono::milliseconds>(StartupTimeline::Clock::now() - begin).count());
+
+    if (running) {
+        startPipeline(false);
+    }
+}
+
+void LibcameraStreamer::startGapMeasurement(ReconfigurationReport const &report)
+{
+    const std::lock_guard lock(reconfigurationReportMutex_);
+    lastReconfiguration_ = report;
+    reconfigurationGapStartUs_ = lastFrameSentUs_.load(std::memory_order_relaxed);
+}
+
+void LibcameraStreamer::frameSent(int64_t nowUs) const
+{
+    lastFrameSentUs_.store(nowUs, std::memory_order_relaxed);
+    const int64_t gapStartUs = reconfigurationGapStartUs_.exchange(0);
+    if (gapStartUs == 0) {
+        return;
+    }
+    const float gapMs = (nowUs - gapStartUs) / 1000.0f;
+    spdlog::info("Reconfiguration gap {:.1f} ms", gapMs);
+    const std::lock_guard lock(reconfigurationReportMutex_);
+    if (lastReconfiguration_) {
+        lastReconfiguration_->GapMs = gapMs;
     }
 }
 
-void LibcameraStreamer::inputBufferProcessedCallback() const
+void LibcameraStreamer::inputBufferProcessedCallback(uint64_t cookie) const
 {
     spdlog::trace("Streamer received input done");
-    cameraWrapper_->ReuseRequest();
+    cameraWrapper_->ReuseRequest(cookie);
 }
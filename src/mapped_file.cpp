@@ -0,0 +1,38 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(std::string const &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        throw std::runtime_error("failed to open " + path);
+    }
+    struct stat status = {};
+    if (fstat(fd, &status) < 0 || status.st_size == 0)
+    {
+        close(fd);
+        throw std::runtime_error("failed to read the size of " + path + " or it is empty");
+    }
+    size_ = status.st_size;
+    void *mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file referenced
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::runtime_error("failed to map " + path);
+    }
+    // Both readers go through the file front to back
+    madvise(mapping, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const uint8_t *>(mapping);
+}
+
+MappedFile::~MappedFile()
+{
+    munmap(const_cast<uint8_t *>(data_), size_);
+}
@@ -0,0 +1,27 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A whole file mapped read-only, for the sources that read recorded streams and footage in place
+class MappedFile
+{
+private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+
+public:
+    // Throws when the file cannot be opened or mapped, or is empty
+    explicit MappedFile(std::string const &path);
+    ~MappedFile();
+
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    const uint8_t *Data() const { return data_; }
+    size_t Size() const { return size_; }
+};
+
+#endif
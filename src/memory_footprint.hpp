@@ -0,0 +1,28 @@
+#ifndef MEMORY_FOOTPRINT_H
+#define MEMORY_FOOTPRINT_H
+
+#include <cstddef>
+
+struct ComponentFootprint
+{
+    // Buffer memory allocated by drivers (CMA/DMA heaps) on behalf of the component
+    size_t DmabufBytes = 0;
+    // Buffer memory mapped into the process address space
+    size_t MmapBytes = 0;
+    // Heap held by the component's own data
+    size_t HeapBytes = 0;
+};
+
+struct MemoryFootprint
+{
+    ComponentFootprint Camera;
+    ComponentFootprint Encoder;
+    ComponentFootprint Output;
+    // Heap in use by the whole process, including libcamera and uvgRTP
+    size_t ProcessHeapBytes = 0;
+
+    size_t DmabufBytes() const { return Camera.DmabufBytes + Encoder.DmabufBytes + Output.DmabufBytes; }
+    size_t MmapBytes() const { return Camera.MmapBytes + Encoder.MmapBytes + Output.MmapBytes; }
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "metadata_sei.h"
+
+#include <cstring>
+
+#include "bit_writer.hpp"
+
+namespace
+{
+    constexpr uint8_t NalUnitTypeSei = 6;
+    constexpr uint8_t SeiUserDataUnregistered = 5;
+
+    // Fixed-capacity byte buffer, large enough for the SEI with every field, so building the
+    // message for each frame does not allocate
+    class SeiBuffer
+    {
+    private:
+        std::array<uint8_t, 64> bytes_;
+        size_t size_ = 0;
+
+    public:
+        void Append(uint8_t byte) { bytes_[size_++] = byte; }
+
+        void AppendBigEndian(uint64_t value, unsigned int count)
+        {
+            while (count > 0)
+            {
+                count--;
+                Append(static_cast<uint8_t>(value >> (8 * count)));
+            }
+        }
+
+        void AppendFloat(float value)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            AppendBigEndian(bits, 4);
+        }
+
+        uint8_t *Data() { return bytes_.data(); }
+        size_t Size() const { return size_; }
+    };
+}
+
+FrameMetadata ExtractFrameMetadata(libcamera::ControlList const &metadata, uint32_t fields, int64_t timestampUs,
+                                   uint32_t sequence)
+{
+    FrameMetadata frame;
+    frame.Fields = fields & (SeiTimestamp | SeiSequence);
+    frame.TimestampUs = timestampUs;
+    frame.Sequence = sequence;
+
+    if (fields & SeiExposureTime)
+    {
+        if (const auto exposureTime = metadata.get(libcamera::controls::ExposureTime))
+        {
+            frame.ExposureTimeUs = static_cast<uint32_t>(*exposureTime);
+            frame.Fields |= SeiExposureTime;
+        }
+    }
+    if (fields & SeiAnalogueGain)
+    {
+        if (const auto analogueGain = metadata.get(libcamera::controls::AnalogueGain))
+        {
+            frame.AnalogueGain = *analogueGain;
+            frame.Fields |= SeiAnalogueGain;
+        }
+    }
+    if (fields & SeiDigitalGain)
+    {
+        if (const auto digitalGain = metadata.get(libcamera::controls::DigitalGain))
+        {
+            frame.DigitalGain = *digitalGain;
+            frame.Fields |= SeiDigitalGain;
+        }
+    }
+    if (fields & SeiLux)
+    {
+        if (const auto lux = metadata.get(libcamera::controls::Lux))
+        {
+            frame.Lux = *lux;
+            frame.Fields |= SeiLux;
+        }
+    }
+    if (fields & SeiColourTemperature)
+    {
+        if (const auto colourTemperature = metadata.get(libcamera::controls::ColourTemperature))
+        {
+            frame.ColourTemperature = static_cast<uint32_t>(*colourTemperature);
+            frame.Fields |= SeiColourTemperature;
+        }
+    }
+    return frame;
+}
+
+void AppendMetadataSei(std::vector<uint8_t> &out, FrameMetadata const &metadata)
+{
+    SeiBuffer rbsp;
+    // payloadType and payloadSize, each a single byte as both stay below 0xff
+    rbsp.Append(SeiUserDataUnregistered);
+    rbsp.Append(0);
+    for (const uint8_t byte : MetadataSeiUuid)
+    {
+        rbsp.Append(byte);
+    }
+    rbsp.Append(MetadataSeiVersion);
+    rbsp.AppendBigEndian(metadata.Fields, 4);
+    if (metadata.Fields & SeiTimestamp)
+    {
+        rbsp.AppendBigEndian(static_cast<uint64_t>(metadata.TimestampUs), 8);
+    }
+    if (metadata.Fields & SeiSequence)
+    {
+        rbsp.AppendBigEndian(metadata.Sequence, 4);
+    }
+    if (metadata.Fields & SeiExposureTime)
+    {
+        rbsp.AppendBigEndian(metadata.ExposureTimeUs, 4);
+    }
+    if (metadata.Fields & SeiAnalogueGain)
+    {
+        rbsp.AppendFloat(metadata.AnalogueGain);
+    }
+    if (metadata.Fields & SeiDigitalGain)
+    {
+        rbsp.AppendFloat(metadata.DigitalGain);
+    }
+    if (metadata.Fields & SeiLux)
+    {
+        rbsp.AppendFloat(metadata.Lux);
+    }
+    if (metadata.Fields & SeiColourTemperature)
+    {
+        rbsp.AppendBigEndian(metadata.ColourTemperature, 4);
+    }
+    rbsp.Data()[1] = static_cast<uint8_t>(rbsp.Size() - 2);
+    // rbsp_trailing_bits() on an already byte aligned message
+    rbsp.Append(0x80);
+    AppendNalUnit(out, 0, NalUnitTypeSei, rbsp.Data(), rbsp.Size());
+}
+
+void FrameMetadataTable::Put(FrameMetadata const &metadata)
+{
+    const std::lock_guard lock(mutex_);
+    entries_[metadata.Sequence % Size] = metadata;
+    valid_[metadata.Sequence % Size] = true;
+}
+
+std::optional<FrameMetadata> FrameMetadataTable::Take(uint32_t sequence)
+{
+    const std::lock_guard lock(mutex_);
+    const size_t index = sequence % Size;
+    if (!valid_[index] || entries_[index].Sequence != sequence)
+    {
+        return std::nullopt;
+    }
+    valid_[index] = false;
+    return entries_[index];
+}
@@ -0,0 +1,61 @@
+#ifndef METADATA_SEI_H
+#define METADATA_SEI_H
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "libcamera-streamer/output_options.hpp"
+
+// Identifies our user_data_unregistered SEI messages among any others in the stream
+constexpr std::array<uint8_t, 16> MetadataSeiUuid = {
+    0xe4, 0x45, 0x90, 0x1f, 0x4a, 0xea, 0x49, 0x2e, 0x83, 0x15, 0xf1, 0x54, 0x7c, 0x1e, 0x48, 0x1c,
+};
+constexpr uint8_t MetadataSeiVersion = 1;
+
+// Camera metadata of one frame. Fields holds the MetadataSeiField bits actually present.
+//
+// SEI payload after the UUID, all values big-endian:
+//   u8 version, u32 fields, then for each bit set in fields, in bit order:
+//   i64 timestamp (us, CLOCK_MONOTONIC), u32 sequence, u32 exposure time (us),
+//   f32 analogue gain, f32 digital gain, f32 lux, u32 colour temperature (K)
+struct FrameMetadata
+{
+    uint32_t Fields = 0;
+    int64_t TimestampUs = 0;
+    uint32_t Sequence = 0;
+    uint32_t ExposureTimeUs = 0;
+    float AnalogueGain = 0;
+    float DigitalGain = 0;
+    float Lux = 0;
+    uint32_t ColourTemperature = 0;
+};
+
+// Picks the requested fields out of the request metadata, dropping those the pipeline did not report
+FrameMetadata ExtractFrameMetadata(libcamera::ControlList const &metadata, uint32_t fields, int64_t timestampUs,
+                                   uint32_t sequence);
+
+// Appends the Annex-B SEI NAL unit carrying the metadata
+void AppendMetadataSei(std::vector<uint8_t> &out, FrameMetadata const &metadata);
+
+// Hands metadata from the camera thread to the output thread, which finds it again by the
+// sequence number of the encoded frame. Frames the encoder skipped are simply overwritten.
+class FrameMetadataTable
+{
+private:
+    static constexpr size_t Size = 64;
+
+    std::mutex mutex_;
+    std::array<FrameMetadata, Size> entries_;
+    std::array<bool, Size> valid_ = {};
+
+public:
+    void Put(FrameMetadata const &metadata);
+    std::optional<FrameMetadata> Take(uint32_t sequence);
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "metrics_server.h"
+
+#include <arpa/inet.h>
+#include <cstring>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+namespace
+{
+    struct Metric
+    {
+        const char *Name;
+        const char *Type;
+        const char *Help;
+        uint64_t Value;
+    };
+
+    std::vector<Metric> metrics(PipelineStatisticsSnapshot const &s)
+    {
+        return {
+            {"frames_captured_total", "counter", "Frames completed by the camera", s.FramesCaptured},
+            {"frames_dropped_camera_total", "counter", "Frames missing from the camera sequence",
+             s.FramesDroppedByCamera},
+            {"frames_dropped_encoder_busy_total", "counter", "Frames skipped for lack of an encoder buffer",
+             s.FramesDroppedEncoderBusy},
+            {"frames_encoded_total", "counter", "Frames produced by the encoder", s.FramesEncoded},
+            {"keyframes_total", "counter", "Keyframes produced by the encoder", s.Keyframes},
+            {"encoded_bytes_total", "counter", "Bytes produced by the encoder", s.EncodedBytes},
+            {"frames_dropped_output_total", "counter", "Encoded frames dropped before sending",
+             s.FramesDroppedByOutput},
+            {"frames_sent_total", "counter", "Frames handed to the network", s.FramesSent},
+            {"bytes_sent_total", "counter", "Bytes handed to the network", s.BytesSent},
+            {"packets_sent_total", "counter", "Packets handed to the network", s.PacketsSent},
+            {"send_errors_total", "counter", "Frames the network refused", s.SendErrors},
+            {"pacing_delay_us_total", "counter", "Microseconds pacing held back the last packet of each frame",
+             s.PacingDelayUs},
+            {"camera_restarts_total", "counter", "Camera streams restarted by the watchdog", s.CameraRestarts},
+            {"encoder_restarts_total", "counter", "Encoders reopened by the watchdog", s.EncoderRestarts},
+            {"output_reconnects_total", "counter", "Outputs reconnected by the watchdog", s.OutputReconnects},
+            {"completed_requests_queued", "gauge", "Camera frames waiting for the encoder",
+             s.CompletedRequestsQueued},
+            {"encoder_input_buffers_available", "gauge", "Free encoder input buffers",
+             s.EncoderInputBuffersAvailable},
+            {"output_items_queued", "gauge", "Encoded frames waiting to be sent", s.OutputItemsQueued},
+        };
+    }
+
+    int listenOn(std::string const &endpoint)
+    {
+        int fd;
+        if (endpoint.rfind('/', 0) == 0)
+        {
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (endpoint.size() >= sizeof(address.sun_path))
+            {
+                throw std::runtime_error("metrics socket path too long: " + endpoint);
+            }
+            strncpy(address.sun_path, endpoint.c_str(), sizeof(address.sun_path) - 1);
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            unlink(endpoint.c_str());
+            if (fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+                throw std::runtime_error("failed to bind metrics socket " + endpoint);
+            }
+        }
+        else
+        {
+            const auto colon = endpoint.rfind(':');
+            if (colon == std::string::npos)
+            {
+                throw std::runtime_error("metrics endpoint must be host:port or a socket path: " + endpoint);
+            }
+            sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(static_cast<uint16_t>(std::stoi(endpoint.substr(colon + 1))));
+            if (inet_pton(AF_INET, endpoint.substr(0, colon).c_str(), &address.sin_addr) != 1)
+            {
+                throw std::runtime_error("invalid metrics address " + endpoint);
+            }
+            fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            const int reuse = 1;
+            if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0
+                || bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0)
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+                throw std::runtime_error("failed to bind metrics endpoint " + endpoint);
+            }
+        }
+        if (listen(fd, 4) < 0)
+        {
+            close(fd);
+            throw std::runtime_error("failed to listen on metrics endpoint " + endpoint);
+        }
+        return fd;
+    }
+}
+
+MetricsServer::MetricsServer(std::string endpoint, std::function<PipelineStatisticsSnapshot()> snapshot) :
+    snapshot_(std::move(snapshot))
+    , endpoint_(std::move(endpoint))
+{
+    listenFd_ = listenOn(endpoint_);
+    serverThread_ = std::thread(&MetricsServer::serve, this);
+    spdlog::info("Serving metrics on {}", endpoint_);
+}
+
+MetricsServer::~MetricsServer()
+{
+    stop_requested = true;
+    if (serverThread_.joinable())
+    {
+        serverThread_.join();
+    }
+    close(listenFd_);
+    if (endpoint_.rfind('/', 0) == 0)
+    {
+        unlink(endpoint_.c_str());
+    }
+}
+
+std::string MetricsServer::ToPrometheus(PipelineStatisticsSnapshot const &snapshot)
+{
+    std::ostringstream text;
+    for (const auto &metric : metrics(snapshot))
+    {
+        text << "# HELP libcamera_streamer_" << metric.Name << " " << metric.Help << "\n"
+             << "# TYPE libcamera_streamer_" << metric.Name << " " << metric.Type << "\n"
+             << "libcamera_streamer_" << metric.Name << " " << metric.Value << "\n";
+    }
+    text << "# HELP libcamera_streamer_encoded_frame_bytes Encoded frame size distribution\n"
+         << "# TYPE libcamera_streamer_encoded_frame_bytes histogram\n";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < FrameSizeBuckets; i++)
+    {
+        cumulative += snapshot.EncodedFrameSizes[i];
+        text << "libcamera_streamer_encoded_frame_bytes_bucket{le=\"";
+        if (i == FrameSizeBuckets - 1)
+        {
+            text << "+Inf";
+        }
+        else
+        {
+            text << FrameSizeBucketBytes(i);
+        }
+        text << "\"} " << cumulative << "\n";
+    }
+    text << "libcamera_streamer_encoded_frame_bytes_sum " << snapshot.EncodedBytes << "\n"
+         << "libcamera_streamer_encoded_frame_bytes_count " << snapshot.FramesEncoded << "\n";
+    return text.str();
+}
+
+std::string MetricsServer::ToJson(PipelineStatisticsSnapshot const &snapshot)
+{
+    std::ostringstream json;
+    json << "{";
+    for (const auto &metric : metrics(snapshot))
+    {
+        json << "\"" << metric.Name << "\":" << metric.Value << ",";
+    }
+    json << "\"encoded_frame_bytes_buckets\":[";
+    for (size_t i = 0; i < FrameSizeBuckets; i++)
+    {
+        json << (i > 0 ? "," : "") << snapshot.EncodedFrameSizes[i];
+    }
+    json << "]}";
+    return json.str();
+}
+
+void MetricsServer::serve()
+{
+    while (!stop_requested)
+    {
+        pollfd p = {listenFd_, POLLIN, 0};
+        if (poll(&p, 1, 200) <= 0 || !(p.revents & POLLIN))
+        {
+            continue;
+        }
+        const int clientFd = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (clientFd < 0)
+        {
+            continue;
+        }
+        handleClient(clientFd);
+        close(clientFd);
+    }
+}
+
+void MetricsServer::handleClient(int clientFd) const
+{
+    // Only the request line matters; a slow client must not stall the server for long
+    pollfd p = {clientFd, POLLIN, 0};
+    char request[512] = {};
+    if (poll(&p, 1, 500) <= 0 || recv(clientFd, request, sizeof(request) - 1, 0) <= 0)
+    {
+        return;
+    }
+    const bool json = strncmp(request, "GET /json", 9) == 0;
+    const std::string body = json ? ToJson(snapshot_()) : ToPrometheus(snapshot_());
+    std::ostringstream response;
+    response << "HTTP/1.0 200 OK\r\n"
+             << "Content-Type: " << (json ? "application/json" : "text/plain; version=0.0.4") << "\r\n"
+             << "Content-Length: " << body.size() << "\r\n\r\n"
+             << body;
+    const std::string data = response.str();
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        const ssize_t result = send(clientFd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0)
+        {
+            return;
+        }
+        sent += result;
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "pipeline_statistics.hpp"
+
+// Serves the pipeline statistics over HTTP: Prometheus text on any path, JSON on /json.
+// The endpoint is either host:port (e.g. 127.0.0.1:9464) or a Unix socket path starting with '/'.
+class MetricsServer
+{
+private:
+    std::function<PipelineStatisticsSnapshot()> snapshot_;
+    std::string endpoint_;
+    int listenFd_ = -1;
+    std::thread serverThread_;
+    std::atomic<bool> stop_requested{false};
+
+public:
+    MetricsServer(std::string endpoint, std::function<PipelineStatisticsSnapshot()> snapshot);
+    ~MetricsServer();
+
+    static std::string ToPrometheus(PipelineStatisticsSnapshot const &snapshot);
+    static std::string ToJson(PipelineStatisticsSnapshot const &snapshot);
+
+private:
+    void serve();
+    void handleClient(int clientFd) const;
+};
+
+#endif
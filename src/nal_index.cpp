@@ -0,0 +1,110 @@
+#include "nal_index.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace
+{
+    size_t includeLeadingZero(const uint8_t *data, size_t position, size_t from)
+    {
+        return position > from && data[position - 1] == 0 ? position - 1 : position;
+    }
+}
+
+size_t FindStartCodeScalar(const uint8_t *data, size_t size, size_t from)
+{
+    for (size_t i = from; i + 2 < size; i++)
+    {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+        {
+            return includeLeadingZero(data, i, from);
+        }
+    }
+    return size;
+}
+
+size_t FindStartCode(const uint8_t *data, size_t size, size_t from)
+{
+    size_t i = from;
+#if defined(__SSE2__)
+    // Compares 16 candidate positions at once: zero at i and i + 1, one at i + 2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    for (; i + 18 <= size; i += 16)
+    {
+        const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        const __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 1));
+        const __m128i third = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i + 2));
+        const __m128i matches = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(first, zero), _mm_cmpeq_epi8(second, zero)),
+                                              _mm_cmpeq_epi8(third, one));
+        const int mask = _mm_movemask_epi8(matches);
+        if (mask != 0)
+        {
+            return includeLeadingZero(data, i + __builtin_ctz(mask), from);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+    for (; i + 18 <= size; i += 16)
+    {
+        const uint8x16_t matches = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(data + i), zero), vceqq_u8(vld1q_u8(data + i + 1), zero)),
+                                            vceqq_u8(vld1q_u8(data + i + 2), one));
+        // NEON has no movemask: narrowing by 4 bits leaves one nibble per byte in a 64-bit word
+        const uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(matches), 4);
+        const uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+        if (mask != 0)
+        {
+            return includeLeadingZero(data, i + __builtin_ctzll(mask) / 4, from);
+        }
+    }
+#endif
+    // The tail, checking for the leading zero against `from` as the zero may sit in the last vector
+    for (; i + 2 < size; i++)
+    {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)
+        {
+            return includeLeadingZero(data, i, from);
+        }
+    }
+    return size;
+}
+
+void NalIndex::Build(const uint8_t *data, size_t size)
+{
+    count_ = 0;
+    truncated_ = false;
+    size_t startCode = FindStartCode(data, size, 0);
+    while (startCode < size)
+    {
+        const size_t header = startCode + (data[startCode + 2] == 1 ? 3 : 4);
+        if (header >= size)
+        {
+            break;
+        }
+        if (count_ == Capacity)
+        {
+            truncated_ = true;
+            units_[count_ - 1].End = size;
+            break;
+        }
+        const size_t next = FindStartCode(data, size, header + 1);
+        units_[count_++] = {startCode, header, next, static_cast<uint8_t>(data[header] & 0x1f)};
+        startCode = next;
+    }
+}
+
+NalUnit const *NalIndex::Find(uint8_t type) const
+{
+    for (const auto &unit : *this)
+    {
+        if (unit.Type == type)
+        {
+            return &unit;
+        }
+    }
+    return nullptr;
+}
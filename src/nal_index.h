@@ -0,0 +1,60 @@
+#ifndef NAL_INDEX_H
+#define NAL_INDEX_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+constexpr uint8_t NalUnitTypeIdr = 5;
+constexpr uint8_t NalUnitTypeSei = 6;
+constexpr uint8_t NalUnitTypeSps = 7;
+constexpr uint8_t NalUnitTypePps = 8;
+
+inline bool IsVclNalUnit(uint8_t nalUnitType)
+{
+    return nalUnitType >= 1 && nalUnitType <= 5;
+}
+
+// Start of the next 00 00 01 start code at or after `from`, including the leading zero byte of
+// a four byte start code, or `size` if there is none. Uses SSE2 or NEON where available.
+size_t FindStartCode(const uint8_t *data, size_t size, size_t from);
+// Byte at a time reference for FindStartCode()
+size_t FindStartCodeScalar(const uint8_t *data, size_t size, size_t from);
+
+// A NAL unit of an Annex-B byte stream
+struct NalUnit
+{
+    size_t StartCodePosition;
+    // Header byte, the payload follows up to End
+    size_t HeaderPosition;
+    size_t End;
+    uint8_t Type;
+};
+
+// Boundaries of every NAL unit in an access unit, built once in the output path and shared by
+// everything that needs to look inside the bitstream.
+class NalIndex
+{
+public:
+    // The Pi encoder emits at most a handful per frame: headers, SEI and the slices
+    static constexpr size_t Capacity = 32;
+
+private:
+    std::array<NalUnit, Capacity> units_;
+    size_t count_ = 0;
+    bool truncated_ = false;
+
+public:
+    void Build(const uint8_t *data, size_t size);
+
+    size_t Size() const { return count_; }
+    NalUnit const &operator[](size_t index) const { return units_[index]; }
+    NalUnit const *begin() const { return units_.data(); }
+    NalUnit const *end() const { return units_.data() + count_; }
+    // The first NAL unit of the type, nullptr when there is none
+    NalUnit const *Find(uint8_t type) const;
+    // More NAL units than Capacity: the last one indexed runs to the end of the access unit
+    bool Truncated() const { return truncated_; }
+};
+
+#endif
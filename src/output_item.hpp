@@ -8,7 +8,9 @@ struct OutputItem
     size_t length;
     unsigned int index;
     bool keyframe;
+    // Sensor timestamp (CLOCK_MONOTONIC) and libcamera sequence of the captured frame
     int64_t timestamp_us;
+    uint32_t sequence;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,152 @@
+#include "output_stage.h"
+
+#include <exception>
+
+#include "spdlog/spdlog.h"
+
+#include "clock_conversion.h"
+#include "datagram_output.h"
+#include "rtp_output.h"
+#include "rtsp_server.h"
+
+OutputStage::OutputStage(OutputOptions const *options, SpsRewriter *spsRewriter, ParameterSetCache *parameterSets,
+                         PipelineStatistics *statistics, FrameMetadataTable *frameMetadata,
+                         PlaceholderStream *placeholder, PipelineWatchdog *watchdog) :
+    options_(options)
+    , spsRewriter_(spsRewriter)
+    , parameterSets_(parameterSets)
+    , statistics_(statistics)
+    , frameMetadata_(frameMetadata)
+    , placeholder_(placeholder)
+    , watchdog_(watchdog)
+{
+    sei_.reserve(128);
+}
+
+void OutputStage::Begin()
+{
+    placeholderActive_ = placeholder_ != nullptr;
+    parameterSetsSent_ = false;
+    parameterSetsSentUs_ = 0;
+}
+
+bool OutputStage::Accept(OutputItem const &item)
+{
+    if (watchdog_)
+    {
+        watchdog_->Progress(PipelineStage::Encoded, MonotonicNowUs());
+    }
+    if (const float framerate = pendingFramerate_.exchange(0); framerate > 0 && spsRewriter_)
+    {
+        spsRewriter_->SetFramerate(framerate);
+    }
+    statistics_->FrameEncoded(item.bytes_used, item.keyframe);
+    // Located once, for everything below that looks inside the bitstream
+    const auto *bitstream = static_cast<const uint8_t *>(item.mem);
+    nalIndex_.Build(bitstream, item.bytes_used);
+    // Learnt even from frames dropped below, the first buffer may carry nothing but the headers
+    carriesSps_ = parameterSets_->Update(bitstream, nalIndex_);
+    if (placeholderActive_)
+    {
+        // Switch over at a keyframe so the receiver never sees a P frame referencing the placeholder
+        if (!item.keyframe)
+        {
+            statistics_->FrameDroppedByOutput();
+            return false;
+        }
+        placeholder_->Stop();
+        placeholderActive_ = false;
+    }
+    return true;
+}
+
+bool OutputStage::Send(OutputItem const &item, FrameOutput &output)
+{
+    const auto *bitstream = static_cast<const uint8_t *>(item.mem);
+    const auto metadata = options_->MetadataSeiFields != 0 && frameMetadata_ ? frameMetadata_->Take(item.sequence)
+                                                                             : std::nullopt;
+    FrameFragment fragments[2 + SpsRewriter::MaxFragments];
+    size_t fragmentCount = 0;
+    if (metadata)
+    {
+        // The SEI starts the access unit, ahead of any parameter sets and the slices
+        sei_.clear();
+        AppendMetadataSei(sei_, *metadata);
+        fragments[fragmentCount++] = {sei_.data(), sei_.size()};
+    }
+    if (item.keyframe)
+    {
+        // Keyframes without headers get the cached ones when a receiver may be missing them: at the
+        // start of the session, after a keyframe request and, optionally, periodically
+        const bool requested = parameterSetsRequested_.exchange(false);
+        const auto nowUs = static_cast<uint64_t>(MonotonicNowUs());
+        const bool repeatDue = options_->ParameterSetRepeatMs > 0
+                               && nowUs - parameterSetsSentUs_ >= options_->ParameterSetRepeatMs * 1000ull;
+        const bool inject = !carriesSps_ && parameterSets_->Complete() && (!parameterSetsSent_ || requested || repeatDue);
+        if (inject)
+        {
+            fragments[fragmentCount++] = parameterSets_->AnnexB();
+        }
+        if (carriesSps_ || inject)
+        {
+            parameterSetsSent_ = true;
+            parameterSetsSentUs_ = nowUs;
+        }
+    }
+    if (spsRewriter_)
+    {
+        fragmentCount += spsRewriter_->Rewrite(bitstream, item.bytes_used, nalIndex_, fragments + fragmentCount);
+    }
+    else
+    {
+        fragments[fragmentCount++] = {bitstream, item.bytes_used};
+    }
+    size_t sentBytes = 0;
+    for (size_t i = 0; i < fragmentCount; i++)
+    {
+        sentBytes += fragments[i].Size;
+    }
+    if (reconnectRequested_.exchange(false))
+    {
+        try
+        {
+            output.Reconnect();
+            if (watchdog_)
+            {
+                watchdog_->Recovered(PipelineComponent::Output, MonotonicNowUs());
+                spdlog::warn("Watchdog: output reconnected, {} time(s) so far",
+                             watchdog_->Recoveries(PipelineComponent::Output));
+            }
+        }
+        catch (std::exception const &e)
+        {
+            spdlog::error("Reconnecting the output failed: {}", e.what());
+            // Asked for again from the watchdog's next check
+            if (watchdog_)
+            {
+                watchdog_->Failed(PipelineComponent::Output);
+            }
+        }
+    }
+    const bool sent = output.SendFrame(fragments, fragmentCount, item.timestamp_us);
+    statistics_->FrameSent(sentBytes, output.LastPacketCount(), !sent, output.LastPacingDelayUs());
+    if (watchdog_ && sent)
+    {
+        watchdog_->Progress(PipelineStage::Sent, MonotonicNowUs());
+    }
+    return sent;
+}
+
+std::unique_ptr<FrameOutput> MakeFrameOutput(OutputOptions const *options, ParameterSetCache const *parameterSets,
+                                             std::function<void()> requestKeyframe)
+{
+    switch (options->Transport)
+    {
+        case OutputTransport::Rtp:
+            return std::make_unique<RtpOutput>(options);
+        case OutputTransport::Rtsp:
+            return std::make_unique<RtspServer>(options, parameterSets, std::move(requestKeyframe));
+        default:
+            return std::make_unique<DatagramOutput>(options);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef OUTPUT_STAGE_H
+#define OUTPUT_STAGE_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "frame_output.hpp"
+#include "metadata_sei.h"
+#include "nal_index.h"
+#include "output_item.hpp"
+#include "parameter_set_cache.h"
+#include "pipeline_statistics.hpp"
+#include "pipeline_watchdog.h"
+#include "placeholder_stream.h"
+#include "sps_rewriter.h"
+#include "libcamera-streamer/output_options.hpp"
+
+// What the output thread does with every encoded frame on its way from the encoder's buffer to a
+// FrameOutput: indexing its NAL units, learning its parameter sets, switching over from the
+// placeholder stream at the first keyframe, putting the metadata SEI and any missing parameter
+// sets ahead of it, rewriting the SPS VUI and sending it, all counted in the pipeline statistics.
+// The streamer and the file replay both drive it, so a replay measures the path live frames take.
+//
+// Accept() and Send() are called from a single thread, the request calls from any.
+class OutputStage
+{
+private:
+    OutputOptions const *options_;
+    SpsRewriter *spsRewriter_;
+    ParameterSetCache *parameterSets_;
+    PipelineStatistics *statistics_;
+    FrameMetadataTable *frameMetadata_;
+    PlaceholderStream *placeholder_;
+    PipelineWatchdog *watchdog_;
+
+    std::atomic<bool> parameterSetsRequested_{false};
+    std::atomic<bool> reconnectRequested_{false};
+    // Handed to the SPS rewriter with the next frame, 0 when unchanged
+    std::atomic<float> pendingFramerate_{0};
+
+    // Output thread
+    NalIndex nalIndex_;
+    bool carriesSps_ = false;
+    bool placeholderActive_ = false;
+    bool parameterSetsSent_ = false;
+    uint64_t parameterSetsSentUs_ = 0;
+    std::vector<uint8_t> sei_;
+
+public:
+    // spsRewriter, frameMetadata, placeholder and watchdog may be null when not used
+    OutputStage(OutputOptions const *options, SpsRewriter *spsRewriter, ParameterSetCache *parameterSets,
+                PipelineStatistics *statistics, FrameMetadataTable *frameMetadata, PlaceholderStream *placeholder,
+                PipelineWatchdog *watchdog);
+
+    // Starts a run of the output thread: the first keyframe carries the parameter sets and, with a
+    // placeholder stream, frames before it are dropped
+    void Begin();
+    // Indexes the frame and learns its parameter sets. Returns false when the frame is dropped and
+    // goes back to the encoder unsent.
+    bool Accept(OutputItem const &item);
+    // Sends the frame Accept() took last, returns false when the output failed to
+    bool Send(OutputItem const &item, FrameOutput &output);
+
+    // The next keyframe is preceded by the parameter sets, for a keyframe asked of the encoder
+    void RequestParameterSets() { parameterSetsRequested_ = true; }
+    // The output is reconnected before the next frame is sent, reported to the watchdog as a recovery
+    // once it has, or as an output failure when it could not be
+    void RequestReconnect() { reconnectRequested_ = true; }
+    // Timing info of the SPS rewritten from the next frame on
+    void SetFramerate(float framerate) { pendingFramerate_ = framerate; }
+};
+
+// The output for options->Transport. requestKeyframe is called when an RTSP client needs one.
+std::unique_ptr<FrameOutput> MakeFrameOutput(OutputOptions const *options, ParameterSetCache const *parameterSets,
+                                             std::function<void()> requestKeyframe);
+
+#endif
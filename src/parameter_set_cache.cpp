@@ -0,0 +1,108 @@
+#include "parameter_set_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+namespace
+{
+    constexpr uint8_t NalUnitTypeStapA = 24;
+
+    void appendAggregationUnit(std::vector<uint8_t> &out, std::vector<uint8_t> const &nal)
+    {
+        out.push_back(static_cast<uint8_t>(nal.size() >> 8));
+        out.push_back(static_cast<uint8_t>(nal.size()));
+        out.insert(out.end(), nal.begin(), nal.end());
+    }
+}
+
+ParameterSetCache::ParameterSetCache(SpsRewriter *spsRewriter) : spsRewriter_(spsRewriter)
+{
+}
+
+bool ParameterSetCache::Update(const uint8_t *data, NalIndex const &index)
+{
+    bool carriesSps = false;
+    bool changed = false;
+    for (const auto &nal : index)
+    {
+        const uint8_t *payload = data + nal.HeaderPosition;
+        const size_t payloadSize = nal.End - nal.HeaderPosition;
+        if (nal.Type == NalUnitTypeSps)
+        {
+            carriesSps = true;
+            const FrameFragment sps = spsRewriter_ ? spsRewriter_->Substitute(payload, payloadSize)
+                                                   : FrameFragment{payload, payloadSize};
+            changed |= store(sps_, sps.Data, sps.Size);
+        }
+        else if (nal.Type == NalUnitTypePps)
+        {
+            changed |= store(pps_, payload, payloadSize);
+        }
+    }
+    if (changed)
+    {
+        rebuildAnnexB();
+        spdlog::debug("ParameterSetCache: SPS {} bytes, PPS {} bytes", sps_.size(), pps_.size());
+    }
+    return carriesSps;
+}
+
+bool ParameterSetCache::store(std::vector<uint8_t> &cached, const uint8_t *nal, size_t size)
+{
+    if (size == cached.size() && std::memcmp(cached.data(), nal, size) == 0)
+    {
+        return false;
+    }
+    const std::lock_guard lock(mutex_);
+    cached.assign(nal, nal + size);
+    return true;
+}
+
+void ParameterSetCache::rebuildAnnexB()
+{
+    annexB_.clear();
+    if (!Complete())
+    {
+        return;
+    }
+    for (const auto *nal : {&sps_, &pps_})
+    {
+        annexB_.insert(annexB_.end(), {0, 0, 0, 1});
+        annexB_.insert(annexB_.end(), nal->begin(), nal->end());
+    }
+}
+
+bool ParameterSetCache::Complete() const
+{
+    return !sps_.empty() && !pps_.empty();
+}
+
+std::vector<uint8_t> ParameterSetCache::Sps() const
+{
+    const std::lock_guard lock(mutex_);
+    return sps_;
+}
+
+std::vector<uint8_t> ParameterSetCache::Pps() const
+{
+    const std::lock_guard lock(mutex_);
+    return pps_;
+}
+
+std::vector<uint8_t> ParameterSetCache::StapA() const
+{
+    const std::lock_guard lock(mutex_);
+    std::vector<uint8_t> stapA;
+    if (sps_.empty() || pps_.empty())
+    {
+        return stapA;
+    }
+    // NRI of the aggregate is the highest of the aggregated units
+    const uint8_t nri = std::max(sps_[0], pps_[0]) & 0x60;
+    stapA.push_back(nri | NalUnitTypeStapA);
+    appendAggregationUnit(stapA, sps_);
+    appendAggregationUnit(stapA, pps_);
+    return stapA;
+}
@@ -0,0 +1,47 @@
+#ifndef PARAMETER_SET_CACHE_H
+#define PARAMETER_SET_CACHE_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "frame_fragment.hpp"
+#include "nal_index.h"
+#include "sps_rewriter.h"
+
+// Keeps the latest SPS and PPS seen in the encoder output, as they are sent (after any VUI
+// rewriting), so they can be put back in front of keyframes the encoder sent without them.
+// Updated from the output thread; the copies returned by Sps(), Pps() and StapA() may be taken
+// from any thread.
+class ParameterSetCache
+{
+private:
+    SpsRewriter *spsRewriter_;
+    mutable std::mutex mutex_;
+    // NAL units without start codes
+    std::vector<uint8_t> sps_;
+    std::vector<uint8_t> pps_;
+    // Both in Annex-B form, ready to prefix an access unit
+    std::vector<uint8_t> annexB_;
+
+public:
+    explicit ParameterSetCache(SpsRewriter *spsRewriter);
+
+    // Learns the parameter sets of an access unit, returns whether it carries an SPS
+    bool Update(const uint8_t *data, NalIndex const &index);
+    bool Complete() const;
+    // SPS and PPS in Annex-B form, only for use on the output thread
+    FrameFragment AnnexB() const { return {annexB_.data(), annexB_.size()}; }
+
+    std::vector<uint8_t> Sps() const;
+    std::vector<uint8_t> Pps() const;
+    // Both aggregated in an RFC 6184 STAP-A NAL unit, for a new subscriber joining mid-stream
+    std::vector<uint8_t> StapA() const;
+
+private:
+    // Replaces the cached NAL unit if it changed, without allocating when it did not
+    bool store(std::vector<uint8_t> &cached, const uint8_t *nal, size_t size);
+    void rebuildAnnexB();
+};
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef PIPELINE_STATISTICS_H
+#define PIPELINE_STATISTICS_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Encoded frame sizes are bucketed by powers of four from 1 KiB up
+constexpr size_t FrameSizeBuckets = 8;
+constexpr size_t FrameSizeBucketBytes(size_t bucket) { return size_t(1024) << (2 * bucket); }
+
+struct PipelineStatisticsSnapshot
+{
+    // Camera side
+    uint64_t FramesCaptured = 0;
+    uint64_t FramesDroppedByCamera = 0;
+    uint64_t FramesDroppedEncoderBusy = 0;
+
+    // Encoded frames as they leave the encoder
+    uint64_t FramesEncoded = 0;
+    uint64_t Keyframes = 0;
+    uint64_t EncodedBytes = 0;
+    // Frames of up to FrameSizeBucketBytes(i), as a Prometheus le bound, and larger than the bucket
+    // before; the last bucket also holds all larger frames
+    std::array<uint64_t, FrameSizeBuckets> EncodedFrameSizes = {};
+
+    // Output side
+    uint64_t FramesDroppedByOutput = 0;
+    uint64_t FramesSent = 0;
+    uint64_t BytesSent = 0;
+    uint64_t PacketsSent = 0;
+    uint64_t SendErrors = 0;
+    // Summed over frames, how long pacing held back the last packet of each
+    uint64_t PacingDelayUs = 0;
+
+    // Watchdog recoveries
+    uint64_t CameraRestarts = 0;
+    uint64_t EncoderRestarts = 0;
+    uint64_t OutputReconnects = 0;
+
+    // Queue depths at the time of the snapshot
+    uint64_t CompletedRequestsQueued = 0;
+    uint64_t EncoderInputBuffersAvailable = 0;
+    uint64_t OutputItemsQueued = 0;
+};
+
+// Counters owned by a single writer thread. Updates are relaxed atomics bracketed by a sequence
+// number, so readers on other threads get a consistent copy without ever blocking the writer.
+template <size_t Size>
+class SeqLockedCounters
+{
+private:
+    std::atomic<uint32_t> sequence_{0};
+    std::array<std::atomic<uint64_t>, Size> counters_ = {};
+
+public:
+    // Every Add() between BeginUpdate() and EndUpdate() is seen by readers all at once
+    void BeginUpdate()
+    {
+        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void Add(size_t counter, uint64_t value)
+    {
+        counters_[counter].store(counters_[counter].load(std::memory_order_relaxed) + value,
+                                 std::memory_order_relaxed);
+    }
+
+    void EndUpdate()
+    {
+        sequence_.store(sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    std::array<uint64_t, Size> Read() const
+    {
+        std::array<uint64_t, Size> values;
+        uint32_t before;
+        uint32_t after;
+        do
+        {
+            before = sequence_.load(std::memory_order_acquire);
+            for (size_t i = 0; i < Size; i++)
+            {
+                values[i] = counters_[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence_.load(std::memory_order_relaxed);
+        }
+        while (before != after || (before & 1));
+        return values;
+    }
+};
+
+// Counters of the whole pipeline: the camera thread writes the capture side, the output thread
+// the encoded and sent side.
+class PipelineStatistics
+{
+private:
+    enum CaptureCounter
+    {
+        FramesCaptured,
+        FramesDroppedByCamera,
+        FramesDroppedEncoderBusy,
+        CaptureCounterCount
+    };
+
+    enum OutputCounter
+    {
+        FramesEncoded,
+        Keyframes,
+        EncodedBytes,
+        FramesDroppedByOutput,
+        FramesSent,
+        BytesSent,
+        PacketsSent,
+        SendErrors,
+        PacingDelayUs,
+        FrameSizeBucket0,
+        OutputCounterCount = FrameSizeBucket0 + FrameSizeBuckets
+    };
+
+    SeqLockedCounters<CaptureCounterCount> capture_;
+    SeqLockedCounters<OutputCounterCount> output_;
+
+public:
+    // Camera thread
+    void FrameCaptured(uint64_t droppedByCamera, bool encoderBusy)
+    {
+        capture_.BeginUpdate();
+        capture_.Add(FramesCaptured, 1);
+        capture_.Add(FramesDroppedByCamera, droppedByCamera);
+        capture_.Add(FramesDroppedEncoderBusy, encoderBusy ? 1 : 0);
+        capture_.EndUpdate();
+    }
+
+    // Output thread
+    void FrameEncoded(size_t bytes, bool keyframe)
+    {
+        size_t bucket = 0;
+        while (bucket < FrameSizeBuckets - 1 && bytes > FrameSizeBucketBytes(bucket))
+        {
+            bucket++;
+        }
+        output_.BeginUpdate();
+        output_.Add(FramesEncoded, 1);
+        output_.Add(Keyframes, keyframe ? 1 : 0);
+        output_.Add(EncodedBytes, bytes);
+        output_.Add(FrameSizeBucket0 + bucket, 1);
+        output_.EndUpdate();
+    }
+
+    void FrameDroppedByOutput()
+    {
+        output_.BeginUpdate();
+        output_.Add(FramesDroppedByOutput, 1);
+        output_.EndUpdate();
+    }
+
+    void FrameSent(size_t bytes, size_t packets, bool failed, int64_t pacingDelayUs = 0)
+    {
+        output_.BeginUpdate();
+        output_.Add(failed ? SendErrors : FramesSent, 1);
+        output_.Add(BytesSent, failed ? 0 : bytes);
+        output_.Add(PacketsSent, failed ? 0 : packets);
+        output_.Add(PacingDelayUs, pacingDelayUs);
+        output_.EndUpdate();
+    }
+
+    // Any thread; queue depths are filled in by the caller
+    PipelineStatisticsSnapshot Snapshot() const
+    {
+        const auto capture = capture_.Read();
+        const auto output = output_.Read();
+        PipelineStatisticsSnapshot snapshot;
+        snapshot.FramesCaptured = capture[FramesCaptured];
+        snapshot.FramesDroppedByCamera = capture[FramesDroppedByCamera];
+        snapshot.FramesDroppedEncoderBusy = capture[FramesDroppedEncoderBusy];
+        snapshot.FramesEncoded = output[FramesEncoded];
+        snapshot.Keyframes = output[Keyframes];
+        snapshot.EncodedBytes = output[EncodedBytes];
+        for (size_t i = 0; i < FrameSizeBuckets; i++)
+        {
+            snapshot.EncodedFrameSizes[i] = output[FrameSizeBucket0 + i];
+        }
+        snapshot.FramesDroppedByOutput = output[FramesDroppedByOutput];
+        snapshot.FramesSent = output[FramesSent];
+        snapshot.BytesSent = output[BytesSent];
+        snapshot.PacketsSent = output[PacketsSent];
+        snapshot.SendErrors = output[SendErrors];
+        snapshot.PacingDelayUs = output[PacingDelayUs];
+        return snapshot;
+    }
+};
+
+#endif
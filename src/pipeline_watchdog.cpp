@@ -0,0 +1,86 @@
+#include "pipeline_watchdog.h"
+
+const char *PipelineComponentName(PipelineComponent component)
+{
+    switch (component)
+    {
+        case PipelineComponent::Camera:
+            return "camera";
+        case PipelineComponent::Encoder:
+            return "encoder";
+        case PipelineComponent::Output:
+            return "output";
+        default:
+            return "unknown";
+    }
+}
+
+PipelineWatchdog::PipelineWatchdog(unsigned int stallFrames, float framerate) :
+    stallFrames_(stallFrames)
+{
+    SetFramerate(framerate);
+}
+
+void PipelineWatchdog::SetFramerate(float framerate)
+{
+    // The camera's default frame rate when none is configured
+    const float rate = framerate > 0 ? framerate : 30;
+    stallUs_.store(static_cast<int64_t>(stallFrames_ * 1e6 / rate), std::memory_order_relaxed);
+}
+
+void PipelineWatchdog::Failed(PipelineComponent component)
+{
+    failed_[static_cast<size_t>(component)].store(true, std::memory_order_release);
+}
+
+void PipelineWatchdog::Started(int64_t nowUs)
+{
+    for (auto &failed : failed_)
+    {
+        failed.store(false, std::memory_order_relaxed);
+    }
+    // Downstream stages only count as stalled while their upstream one progresses, so they can
+    // start from the same point
+    for (auto &progress : progressUs_)
+    {
+        progress.store(nowUs + StartGraceUs, std::memory_order_relaxed);
+    }
+}
+
+std::optional<PipelineComponent> PipelineWatchdog::Check(int64_t nowUs) const
+{
+    for (size_t i = 0; i < failed_.size(); i++)
+    {
+        if (failed_[i].load(std::memory_order_acquire))
+        {
+            return static_cast<PipelineComponent>(i);
+        }
+    }
+    const int64_t stallUs = StallUs();
+    const auto stalled = [&](PipelineStage stage) {
+        return nowUs - progressUs_[static_cast<size_t>(stage)].load(std::memory_order_relaxed) > stallUs;
+    };
+    if (stalled(PipelineStage::Captured))
+    {
+        return PipelineComponent::Camera;
+    }
+    if (stalled(PipelineStage::Encoded))
+    {
+        return PipelineComponent::Encoder;
+    }
+    if (stalled(PipelineStage::Sent))
+    {
+        return PipelineComponent::Output;
+    }
+    return std::nullopt;
+}
+
+void PipelineWatchdog::Recovered(PipelineComponent component, int64_t nowUs)
+{
+    recoveries_[static_cast<size_t>(component)].fetch_add(1, std::memory_order_relaxed);
+    if (component == PipelineComponent::Output)
+    {
+        failed_[static_cast<size_t>(component)].store(false, std::memory_order_relaxed);
+        Progress(PipelineStage::Sent, nowUs);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef PIPELINE_WATCHDOG_H
+#define PIPELINE_WATCHDOG_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <optional>
+
+// Points the pipeline threads report progress at, in pipeline order
+enum class PipelineStage
+{
+    Captured,
+    Encoded,
+    Sent,
+    Count
+};
+
+// What the streamer can restart on its own, in pipeline order
+enum class PipelineComponent
+{
+    Camera,
+    Encoder,
+    Output,
+    Count
+};
+
+const char *PipelineComponentName(PipelineComponent component);
+
+// Tracks when each pipeline stage last made progress and which components failed outright, and
+// picks the component to recover: the first one in pipeline order that failed, or that has not
+// moved for the stall timeout while the stage before it kept going. Stages are reported from the
+// pipeline threads and checked from another, all lock-free.
+class PipelineWatchdog
+{
+public:
+    // Time a (re)started camera gets for its first frame on top of the stall timeout
+    static constexpr int64_t StartGraceUs = 1000000;
+
+private:
+    unsigned int stallFrames_;
+    std::atomic<int64_t> stallUs_{0};
+    std::array<std::atomic<int64_t>, static_cast<size_t>(PipelineStage::Count)> progressUs_ = {};
+    std::array<std::atomic<bool>, static_cast<size_t>(PipelineComponent::Count)> failed_ = {};
+    std::array<std::atomic<uint64_t>, static_cast<size_t>(PipelineComponent::Count)> recoveries_ = {};
+
+public:
+    // A stage stalls after stallFrames frame periods without progress
+    PipelineWatchdog(unsigned int stallFrames, float framerate);
+
+    void SetFramerate(float framerate);
+    int64_t StallUs() const { return stallUs_.load(std::memory_order_relaxed); }
+
+    void Progress(PipelineStage stage, int64_t nowUs)
+    {
+        progressUs_[static_cast<size_t>(stage)].store(nowUs, std::memory_order_relaxed);
+    }
+    void Failed(PipelineComponent component);
+    // Every stage's clock starts afresh and failures are forgotten, once the pipeline has started
+    void Started(int64_t nowUs);
+    std::optional<PipelineComponent> Check(int64_t nowUs) const;
+    // Counts the recovery; an output reconnect restarts the sent stage's clock
+    void Recovered(PipelineComponent component, int64_t nowUs);
+    uint64_t Recoveries(PipelineComponent component) const
+    {
+        return recoveries_[static_cast<size_t>(component)].load(std::memory_order_relaxed);
+    }
+};
+
+#endif
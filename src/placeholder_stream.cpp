@@ -0,0 +1,134 @@
+#include "placeholder_stream.h"
+
+#include <algorithm>
+#include <spdlog/spdlog.h>
+
+#include "bit_writer.hpp"
+#include "h264_parameter_sets.h"
+
+namespace
+{
+    constexpr unsigned int Log2MaxFrameNum = BaselineLog2MaxFrameNum;
+    constexpr unsigned int MaxFrameNum = 1 << Log2MaxFrameNum;
+
+    // Every macroblock is I_16x16 with DC prediction and no residual, which decodes to mid grey
+    std::vector<uint8_t> makeIdrSlice(unsigned int macroblocks, unsigned int idrPicId)
+    {
+        BitWriter slice;
+        slice.WriteUe(0); // first_mb_in_slice
+        slice.WriteUe(7); // slice_type: I, all slices of the picture
+        slice.WriteUe(0); // pic_parameter_set_id
+        slice.WriteBits(0, Log2MaxFrameNum); // frame_num
+        slice.WriteUe(idrPicId);
+        slice.WriteBit(false); // no_output_of_prior_pics_flag
+        slice.WriteBit(false); // long_term_reference_flag
+        slice.WriteSe(0); // slice_qp_delta
+        slice.WriteUe(1); // disable_deblocking_filter_idc
+        for (unsigned int i = 0; i < macroblocks; i++)
+        {
+            slice.WriteUe(3); // mb_type I_16x16_2_0_0
+            slice.WriteUe(0); // intra_chroma_pred_mode: DC
+            slice.WriteSe(0); // mb_qp_delta
+            slice.WriteBit(true); // coeff_token for Intra16x16DCLevel: no coefficients
+        }
+        slice.WriteTrailingBits();
+        return slice.Bytes();
+    }
+
+    std::vector<uint8_t> makeSkipSlice(unsigned int macroblocks, unsigned int frameNum)
+    {
+        BitWriter slice;
+        slice.WriteUe(0); // first_mb_in_slice
+        slice.WriteUe(5); // slice_type: P, all slices of the picture
+        slice.WriteUe(0); // pic_parameter_set_id
+        slice.WriteBits(frameNum, Log2MaxFrameNum);
+        slice.WriteBit(false); // num_ref_idx_active_override_flag
+        slice.WriteBit(false); // ref_pic_list_modification_flag_l0
+        slice.WriteBit(false); // adaptive_ref_pic_marking_mode_flag
+        slice.WriteSe(0); // slice_qp_delta
+        slice.WriteUe(1); // disable_deblocking_filter_idc
+        slice.WriteUe(macroblocks); // mb_skip_run
+        slice.WriteTrailingBits();
+        return slice.Bytes();
+    }
+}
+
+PlaceholderStream::PlaceholderStream(EncoderOptions const *options, std::function<void(uint8_t *, size_t)> send) :
+    send_(std::move(send))
+{
+    const float framerate = options->framerate > 0 ? options->framerate : 30;
+    frameInterval_ = std::chrono::microseconds(static_cast<int64_t>(1000000 / framerate));
+    keyframeInterval_ = std::max(1u, static_cast<unsigned int>(framerate));
+
+    const unsigned int macroblocks = ((options->width + 15) / 16) * ((options->height + 15) / 16);
+    const auto sps = MakeBaselineSps(options->width, options->height, H264LevelIdc(options->level));
+    const auto pps = MakeBaselinePps();
+    // Consecutive IDR pictures must use different idr_pic_id values
+    for (unsigned int idrPicId = 0; idrPicId < 2; idrPicId++)
+    {
+        AppendNalUnit(keyframes_[idrPicId], 3, 7, sps);
+        AppendNalUnit(keyframes_[idrPicId], 3, 8, pps);
+        AppendNalUnit(keyframes_[idrPicId], 3, 5, makeIdrSlice(macroblocks, idrPicId));
+    }
+    // Skip frames are kept as references so that frame_num simply counts up after each IDR
+    for (unsigned int frameNum = 0; frameNum < MaxFrameNum; frameNum++)
+    {
+        skipFrames_.emplace_back();
+        AppendNalUnit(skipFrames_.back(), 2, 1, makeSkipSlice(macroblocks, frameNum));
+    }
+    spdlog::trace("PlaceholderStream: keyframe {} bytes, skip frame {} bytes",
+                  keyframes_[0].size(), skipFrames_[0].size());
+}
+
+PlaceholderStream::~PlaceholderStream()
+{
+    Stop();
+}
+
+size_t PlaceholderStream::HeapBytes() const
+{
+    size_t bytes = keyframes_[0].capacity() + keyframes_[1].capacity();
+    for (const auto &frame : skipFrames_)
+    {
+        bytes += frame.capacity();
+    }
+    return bytes;
+}
+
+void PlaceholderStream::Start()
+{
+    senderThread_ = std::thread(&PlaceholderStream::sendFrames, this);
+}
+
+void PlaceholderStream::Stop()
+{
+    {
+        const std::lock_guard lock(mutex_);
+        stop_requested = true;
+    }
+    stopCondition_.notify_all();
+    if (senderThread_.joinable())
+    {
+        senderThread_.join();
+    }
+}
+
+void PlaceholderStream::sendFrames()
+{
+    spdlog::info("PlaceholderStream: sending placeholder video until the camera is ready");
+    unsigned int frameIndex = 0;
+    unsigned int idrCount = 0;
+    auto nextFrameTime = std::chrono::steady_clock::now();
+    std::unique_lock lock(mutex_);
+    while (!stop_requested)
+    {
+        const unsigned int position = frameIndex % keyframeInterval_;
+        auto &frame = position == 0 ? keyframes_[idrCount++ % 2] : skipFrames_[position % MaxFrameNum];
+        send_(frame.data(), frame.size());
+        frameIndex++;
+
+        nextFrameTime += frameInterval_;
+        stopCondition_.wait_until(lock, nextFrameTime, [this]() { return stop_requested; });
+    }
+    spdlog::info("PlaceholderStream: {} placeholder frames sent", frameIndex);
+}
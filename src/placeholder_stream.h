@@ -0,0 +1,46 @@
+#ifndef PLACEHOLDER_STREAM_H
+#define PLACEHOLDER_STREAM_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "libcamera-streamer/encoder_options.hpp"
+
+// Sends a pre-encoded, flat grey H.264 stream of the configured size while the camera is still
+// starting, so receivers have their decoder initialised by the time live video arrives.
+// The stream is an IDR once per second followed by P frames made only of skipped macroblocks,
+// all generated once at construction.
+class PlaceholderStream
+{
+private:
+    std::vector<uint8_t> keyframes_[2];
+    std::vector<std::vector<uint8_t>> skipFrames_;
+    std::chrono::microseconds frameInterval_;
+    unsigned int keyframeInterval_;
+    std::function<void(uint8_t *data, size_t size)> send_;
+
+    std::thread senderThread_;
+    std::mutex mutex_;
+    std::condition_variable stopCondition_;
+    bool stop_requested = false;
+
+public:
+    PlaceholderStream(EncoderOptions const *options, std::function<void(uint8_t *data, size_t size)> send);
+    ~PlaceholderStream();
+
+    size_t HeapBytes() const;
+
+    void Start();
+    // Returns once no more placeholder frames will be sent
+    void Stop();
+
+private:
+    void sendFrames();
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "raw_video_file.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "spdlog/spdlog.h"
+
+namespace
+{
+    constexpr const char Y4mSignature[] = "YUV4MPEG2";
+    constexpr const char Y4mFrameSignature[] = "FRAME";
+
+    size_t lineEnd(const uint8_t *data, size_t size, size_t from)
+    {
+        const void *end = std::memchr(data + from, '\n', size - from);
+        return end ? static_cast<const uint8_t *>(end) - data : size;
+    }
+}
+
+RawVideoFile::RawVideoFile(std::string const &path, unsigned int width, unsigned int height, float framerate)
+    : file_(path), width_(width), height_(height), framerate_(framerate)
+{
+    const bool y4m = file_.Size() >= sizeof(Y4mSignature) - 1
+                     && std::memcmp(file_.Data(), Y4mSignature, sizeof(Y4mSignature) - 1) == 0;
+    if (y4m)
+    {
+        indexY4mFrames(parseY4mHeader(path));
+    }
+    else
+    {
+        if (width_ == 0 || height_ == 0 || framerate_ <= 0)
+        {
+            throw std::runtime_error(path + " has no YUV4MPEG2 header, its size and frame rate must be given");
+        }
+        for (size_t offset = 0; offset + FrameSize() <= file_.Size(); offset += FrameSize())
+        {
+            frameOffsets_.push_back(offset);
+        }
+    }
+    if (frameOffsets_.empty())
+    {
+        throw std::runtime_error(path + " holds no complete " + std::to_string(width_) + "x" + std::to_string(height_)
+                                 + " frame");
+    }
+    spdlog::info("Reading {}: {} frames of {}x{} at {} fps", path, frameOffsets_.size(), width_, height_, framerate_);
+}
+
+size_t RawVideoFile::parseY4mHeader(std::string const &path)
+{
+    const uint8_t *data = file_.Data();
+    const size_t end = lineEnd(data, file_.Size(), 0);
+    const std::string header(reinterpret_cast<const char *>(data), end);
+    size_t position = sizeof(Y4mSignature) - 1;
+    while (position < header.size())
+    {
+        const size_t next = std::min(header.find(' ', position + 1), header.size());
+        const std::string parameter = header.substr(position + 1, next - position - 1);
+        if (!parameter.empty())
+        {
+            const std::string value = parameter.substr(1);
+            switch (parameter[0])
+            {
+                case 'W':
+                    width_ = std::stoul(value);
+                    break;
+                case 'H':
+                    height_ = std::stoul(value);
+                    break;
+                case 'F':
+                {
+                    const size_t colon = value.find(':');
+                    const float denominator = colon == std::string::npos ? 1 : std::stof(value.substr(colon + 1));
+                    framerate_ = std::stof(value.substr(0, colon)) / denominator;
+                    break;
+                }
+                case 'C':
+                    // 420, 420jpeg, 420paldv and 420mpeg2 only differ in chroma siting
+                    if (value.compare(0, 3, "420") != 0)
+                    {
+                        throw std::runtime_error(path + " is " + value + ", only 4:2:0 footage can be encoded");
+                    }
+                    break;
+                case 'I':
+                    if (value != "p" && value != "?")
+                    {
+                        throw std::runtime_error(path + " is interlaced, only progressive footage can be encoded");
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        position = next;
+    }
+    if (width_ == 0 || height_ == 0)
+    {
+        throw std::runtime_error(path + " has a YUV4MPEG2 header without a size");
+    }
+    // A zero denominator leaves NaN or infinity
+    if (!std::isfinite(framerate_) || framerate_ <= 0)
+    {
+        throw std::runtime_error(path + " has a YUV4MPEG2 header without a valid frame rate, it must be given");
+    }
+    return end + 1;
+}
+
+void RawVideoFile::indexY4mFrames(size_t offset)
+{
+    const uint8_t *data = file_.Data();
+    const size_t size = file_.Size();
+    while (offset + sizeof(Y4mFrameSignature) - 1 <= size
+           && std::memcmp(data + offset, Y4mFrameSignature, sizeof(Y4mFrameSignature) - 1) == 0)
+    {
+        // Frame parameters, if any, are ignored
+        const size_t frame = lineEnd(data, size, offset) + 1;
+        if (frame + FrameSize() > size)
+        {
+            break;
+        }
+        frameOffsets_.push_back(frame);
+        offset = frame + FrameSize();
+    }
+}
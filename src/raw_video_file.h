@@ -0,0 +1,42 @@
+#ifndef RAW_VIDEO_FILE_H
+#define RAW_VIDEO_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Raw YUV 4:2:0 footage to feed the encoder offline: either a headerless planar I420 file, whose
+// size and frame rate must be given, or a YUV4MPEG2 (.y4m) file, which carries its own. Frames are
+// read in place from the mapping.
+class RawVideoFile
+{
+private:
+    MappedFile file_;
+    unsigned int width_;
+    unsigned int height_;
+    float framerate_;
+    std::vector<size_t> frameOffsets_;
+
+public:
+    // The size and frame rate are only used for headerless files, and the frame rate for a
+    // YUV4MPEG2 header without one
+    RawVideoFile(std::string const &path, unsigned int width, unsigned int height, float framerate);
+
+    unsigned int Width() const { return width_; }
+    unsigned int Height() const { return height_; }
+    float Framerate() const { return framerate_; }
+    // I420 with the luma stride equal to the width
+    size_t FrameSize() const { return width_ * height_ * 3 / 2; }
+    size_t FrameCount() const { return frameOffsets_.size(); }
+    const uint8_t *Frame(size_t index) const { return file_.Data() + frameOffsets_[index]; }
+
+private:
+    // Parses the stream header, returns where the first frame header starts
+    size_t parseY4mHeader(std::string const &path);
+    void indexY4mFrames(size_t offset);
+};
+
+#endif
@@ -0,0 +1,292 @@
+#include "rtp_output.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <linux/net_tstamp.h>
+#include <random>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+#include <uvgrtp/lib.hh>
+
+#include "clock_conversion.h"
+#include "datagram_socket.h"
+
+namespace
+{
+    // Sender reports go out at most this often; RFC 3550 allows the interval to shrink with the
+    // session bandwidth, a video stream's is far above what a second needs
+    constexpr int64_t SenderReportIntervalUs = 1000000;
+    // Packets due this close are sent rather than slept for
+    constexpr int64_t PacingSlackUs = 100;
+    constexpr char Cname[] = "libcamera-streamer";
+    // SDES header, SSRC, CNAME item type and length, the name, and at least one zero byte ending
+    // the items, padded to 32 bits
+    constexpr size_t SdesSize = (4 + 4 + 2 + (sizeof(Cname) - 1) + 1 + 3) / 4 * 4;
+
+    void put32(uint8_t *data, uint32_t value)
+    {
+        data[0] = value >> 24;
+        data[1] = (value >> 16) & 0xff;
+        data[2] = (value >> 8) & 0xff;
+        data[3] = value & 0xff;
+    }
+}
+
+RtpOutput::RtpOutput(OutputOptions const *options)
+    : options_(options), timestampOffset_(std::random_device()())
+{
+    if (options_->PacingFraction > 0)
+    {
+        // Kept across reconnects, so the stream carries on with the same SSRC and sequence
+        packetizer_ = std::make_unique<H264Packetizer>(Mtu);
+        pacer_ = std::make_unique<SendPacer>(options_->PacingFraction, options_->PacingBurstBytes);
+    }
+    open();
+}
+
+RtpOutput::~RtpOutput()
+{
+    close();
+}
+
+void RtpOutput::Reconnect()
+{
+    close();
+    // Until it succeeds, frames fail to send and the owner may try again
+    open();
+    spdlog::info("RtpOutput: reconnected to {}:{}", options_->Ip, options_->Port);
+}
+
+void RtpOutput::open()
+{
+    if (packetizer_)
+    {
+        openSockets();
+        return;
+    }
+    sess_ = ctx_.create_session(options_->Ip);
+    if (!sess_)
+    {
+        throw std::runtime_error("failed to create RTP session for " + options_->Ip);
+    }
+    int flags = RCE_SEND_ONLY;
+    if (options_->SenderReports)
+    {
+        flags |= RCE_RTCP;
+    }
+    stream_ = sess_->create_stream(options_->Port, RTP_FORMAT_H264, flags);
+    if (!stream_)
+    {
+        ctx_.destroy_session(sess_);
+        sess_ = nullptr;
+        throw std::runtime_error("failed to create RTP stream to port " + std::to_string(options_->Port));
+    }
+    stream_->configure_ctx(RCC_MTU_SIZE, Mtu);
+    spdlog::debug("RtpOutput: sending to {}:{}{}", options_->Ip, options_->Port,
+                  options_->SenderReports ? " with RTCP sender reports" : "");
+}
+
+void RtpOutput::openSockets()
+{
+    rtpSocket_ = ConnectUdpSocket(options_->Ip, options_->Port);
+    if (options_->SenderReports)
+    {
+        rtcpSocket_ = ConnectUdpSocket(options_->Ip, options_->Port + 1);
+    }
+    txTime_ = false;
+    if (options_->PacingTxTime)
+    {
+        sock_txtime config = {};
+        config.clockid = CLOCK_MONOTONIC;
+        txTime_ = setsockopt(rtpSocket_, SOL_SOCKET, SO_TXTIME, &config, sizeof(config)) == 0;
+        if (!txTime_)
+        {
+            spdlog::warn("RtpOutput: SO_TXTIME unavailable, errno {}, pacing by sleeping instead", errno);
+        }
+    }
+    spdlog::debug("RtpOutput: sending to {}:{} paced over {:.0f}% of the frame interval{}{}", options_->Ip,
+                  options_->Port, options_->PacingFraction * 100, txTime_ ? " with SO_TXTIME" : "",
+                  options_->SenderReports ? ", with RTCP sender reports" : "");
+}
+
+void RtpOutput::close()
+{
+    if (rtpSocket_ >= 0)
+    {
+        ::close(rtpSocket_);
+        rtpSocket_ = -1;
+    }
+    if (rtcpSocket_ >= 0)
+    {
+        ::close(rtcpSocket_);
+        rtcpSocket_ = -1;
+    }
+    if (stream_)
+    {
+        sess_->destroy_stream(stream_);
+        stream_ = nullptr;
+    }
+    if (sess_)
+    {
+        /* Session must be destroyed manually */
+        ctx_.destroy_session(sess_);
+        sess_ = nullptr;
+    }
+}
+
+bool RtpOutput::SendFrame(uint8_t *data, size_t size, int64_t captureTimestampUs, int flags)
+{
+    if (packetizer_)
+    {
+        return sendPaced(data, size, captureTimestampUs);
+    }
+    if (!stream_)
+    {
+        return false;
+    }
+    lastPacketCount_ = EstimatedPackets(size);
+    // uvgRTP extrapolates the sender report timestamps from the latest pair given here
+    const auto result = stream_->push_frame(data, size, RtpTimestamp(captureTimestampUs),
+                                            NtpTimestamp(captureTimestampUs), flags);
+    return result == RTP_OK;
+}
+
+bool RtpOutput::SendFrame(FrameFragment const *fragments, size_t count, int64_t captureTimestampUs)
+{
+    if (count == 1)
+    {
+        return SendFrame(const_cast<uint8_t *>(fragments[0].Data), fragments[0].Size, captureTimestampUs, RTP_COPY);
+    }
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        size += fragments[i].Size;
+    }
+    if (staging_.size() < size)
+    {
+        staging_.resize(size);
+    }
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        std::memcpy(staging_.data() + offset, fragments[i].Data, fragments[i].Size);
+        offset += fragments[i].Size;
+    }
+    // push_frame() has sent the frame by the time it returns, so the staging buffer can be
+    // handed over without another copy
+    return SendFrame(staging_.data(), size, captureTimestampUs, RTP_NO_FLAGS);
+}
+
+bool RtpOutput::sendPaced(const uint8_t *data, size_t size, int64_t captureTimestampUs)
+{
+    lastPacingDelayUs_ = 0;
+    if (rtpSocket_ < 0)
+    {
+        return false;
+    }
+    std::vector<RtpPacket> const &packets = packetizer_->Packetize(data, size, RtpTimestamp(captureTimestampUs));
+    lastPacketCount_ = packets.size();
+    const int64_t beginUs = MonotonicNowUs();
+    pacer_->BeginFrame(size, captureTimestampUs);
+    int64_t departureUs = beginUs;
+    bool sent = true;
+    for (RtpPacket const &packet : packets)
+    {
+        // Scheduled on the pacer's own timeline, only the sleeps read the clock
+        departureUs = pacer_->Schedule(packet.Size(), beginUs);
+        if (!txTime_ && departureUs > beginUs + PacingSlackUs)
+        {
+            const timespec until = {static_cast<time_t>(departureUs / 1000000),
+                                    static_cast<long>(departureUs % 1000000 * 1000)};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr);
+        }
+        if (sendPacket(packet, departureUs))
+        {
+            packetsSent_++;
+            octetsSent_ += packet.PayloadSize + packet.HeaderSize - H264Packetizer::RtpHeaderSize;
+        }
+        else
+        {
+            sent = false;
+        }
+    }
+    lastPacingDelayUs_ = departureUs - beginUs;
+
+    const int64_t nowUs = MonotonicNowUs();
+    if (rtcpSocket_ >= 0 && nowUs - lastSenderReportUs_ >= SenderReportIntervalUs)
+    {
+        sendSenderReport(nowUs);
+    }
+    return sent;
+}
+
+bool RtpOutput::sendPacket(RtpPacket const &packet, int64_t departureUs) const
+{
+    iovec parts[2] = {{const_cast<uint8_t *>(packet.Header.data()), packet.HeaderSize},
+                      {const_cast<uint8_t *>(packet.Payload), packet.PayloadSize}};
+    msghdr message = {};
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+    alignas(cmsghdr) uint8_t control[CMSG_SPACE(sizeof(uint64_t))] = {};
+    if (txTime_)
+    {
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_TXTIME;
+        header->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        const uint64_t departureNs = departureUs * 1000;
+        std::memcpy(CMSG_DATA(header), &departureNs, sizeof(departureNs));
+    }
+    return sendmsg(rtpSocket_, &message, 0) == static_cast<ssize_t>(packet.Size());
+}
+
+void RtpOutput::sendSenderReport(int64_t nowUs)
+{
+    // A sender report and the SDES CNAME every compound RTCP packet must carry (RFC 3550 6.1)
+    uint8_t report[28 + SdesSize] = {};
+    report[0] = 0x80;
+    report[1] = 200;
+    report[3] = 6;
+    put32(report + 4, packetizer_->Ssrc());
+    const uint64_t ntp = NtpTimestamp(nowUs);
+    put32(report + 8, ntp >> 32);
+    put32(report + 12, ntp & 0xffffffff);
+    put32(report + 16, RtpTimestamp(nowUs));
+    put32(report + 20, packetsSent_);
+    put32(report + 24, octetsSent_);
+
+    uint8_t *sdes = report + 28;
+    sdes[0] = 0x81;
+    sdes[1] = 202;
+    sdes[3] = SdesSize / 4 - 1;
+    put32(sdes + 4, packetizer_->Ssrc());
+    sdes[8] = 1;
+    sdes[9] = sizeof(Cname) - 1;
+    std::memcpy(sdes + 10, Cname, sizeof(Cname) - 1);
+    if (send(rtcpSocket_, report, sizeof(report), 0) < 0)
+    {
+        spdlog::debug("RtpOutput: sender report not sent, errno {}", errno);
+    }
+    lastSenderReportUs_ = nowUs;
+}
+
+uint32_t RtpOutput::RtpTimestamp(int64_t captureTimestampUs) const
+{
+    return MonotonicToRtp(captureTimestampUs, ClockRate, timestampOffset_);
+}
+
+size_t RtpOutput::EstimatedPackets(size_t bytes)
+{
+    return std::max<size_t>(1, (bytes + PayloadSize - 1) / PayloadSize);
+}
+
+uint64_t RtpOutput::NtpTimestamp(int64_t monotonicTimestampUs)
+{
+    return MonotonicToNtp(monotonicTimestampUs);
+}
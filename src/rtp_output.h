@@ -0,0 +1,81 @@
+#ifndef RTP_OUTPUT_H
+#define RTP_OUTPUT_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <uvgrtp/context.hh>
+#include <uvgrtp/media_stream.hh>
+
+#include "frame_output.hpp"
+#include "h264_packetizer.h"
+#include "send_pacer.h"
+#include "libcamera-streamer/output_options.hpp"
+
+// Sends encoded frames over RTP with timestamps taken from the sensor clock rather than the time
+// of sending, and maps them to wall-clock time in RTCP sender reports so receivers can
+// synchronise and measure capture-to-display latency.
+//
+// With pacing, frames are packetized here and sent from a socket of our own, each packet at the
+// departure time SendPacer gives it, and the sender reports are built here too.
+class RtpOutput : public FrameOutput
+{
+public:
+    static constexpr size_t Mtu = 1400;
+    // Payload left for H.264 in each RTP packet after the RTP and FU-A headers
+    static constexpr size_t PayloadSize = Mtu - 12 - 2;
+    static constexpr uint32_t ClockRate = 90000;
+
+private:
+    OutputOptions const *options_;
+    uvgrtp::context ctx_;
+    uvgrtp::session *sess_ = nullptr;
+    uvgrtp::media_stream *stream_ = nullptr;
+    // Random start of the RTP timeline, as RFC 3550 asks for
+    uint32_t timestampOffset_;
+    // uvgRTP takes one contiguous buffer per frame, so fragments are gathered here. It only grows
+    // until it fits the largest frame and is reused afterwards.
+    std::vector<uint8_t> staging_;
+
+    // Paced sending, in place of uvgRTP
+    std::unique_ptr<H264Packetizer> packetizer_;
+    std::unique_ptr<SendPacer> pacer_;
+    int rtpSocket_ = -1;
+    int rtcpSocket_ = -1;
+    bool txTime_ = false;
+    uint32_t packetsSent_ = 0;
+    uint32_t octetsSent_ = 0;
+    int64_t lastSenderReportUs_ = 0;
+    int64_t lastPacingDelayUs_ = 0;
+    size_t lastPacketCount_ = 0;
+
+public:
+    explicit RtpOutput(OutputOptions const *options);
+    ~RtpOutput() override;
+
+    // Sends one access unit captured at the given CLOCK_MONOTONIC time
+    bool SendFrame(uint8_t *data, size_t size, int64_t captureTimestampUs, int flags);
+    bool SendFrame(FrameFragment const *fragments, size_t count, int64_t captureTimestampUs) override;
+    // Recreates the session or socket, continuing the RTP timeline
+    void Reconnect() override;
+
+    size_t LastPacketCount() const override { return lastPacketCount_; }
+    int64_t LastPacingDelayUs() const override { return lastPacingDelayUs_; }
+    size_t HeapBytes() const override { return staging_.capacity(); }
+
+    uint32_t RtpTimestamp(int64_t captureTimestampUs) const;
+    static size_t EstimatedPackets(size_t bytes);
+    // 32.32 fixed point NTP time of a CLOCK_MONOTONIC timestamp
+    static uint64_t NtpTimestamp(int64_t monotonicTimestampUs);
+
+private:
+    void open();
+    void openSockets();
+    void close();
+    bool sendPaced(const uint8_t *data, size_t size, int64_t captureTimestampUs);
+    bool sendPacket(RtpPacket const &packet, int64_t departureUs) const;
+    void sendSenderReport(int64_t nowUs);
+};
+
+#endif
@@ -0,0 +1,706 @@
+#include "rtsp_server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <optional>
+#include <poll.h>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "clock_conversion.h"
+#include "rtp_output.h"
+
+namespace
+{
+    // Sessions, and connections without one, end after this long without a request or RTCP from
+    // the client, as announced in the Session header
+    constexpr int SessionTimeoutS = 60;
+    constexpr int PollIntervalMs = 200;
+    // How soon a response held up by a sender thread mid-frame is tried again
+    constexpr int RetryIntervalMs = 10;
+    // Responses a client may leave unread before it is dropped
+    constexpr size_t MaxOutgoingBytes = 64 * 1024;
+    // Bound on a request still being received, against clients sending garbage
+    constexpr size_t MaxRequestBytes = 16 * 1024;
+    constexpr size_t MaxConnections = 32;
+    // A connection taking interleaved packets slower than this is given up on
+    constexpr int ConnectionSendTimeoutMs = 2000;
+    // Frames any client may still be sending, beyond which they are allocated afresh
+    constexpr size_t FramePoolSize = 8;
+    // Across all clients and PLAY requests, the encoder is asked for a keyframe at most this often
+    constexpr int64_t KeyframeRequestIntervalUs = 500000;
+
+    int listenOn(std::string const &host, uint16_t port)
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo *addresses = nullptr;
+        if (getaddrinfo(host.empty() ? nullptr : host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0
+            || !addresses)
+        {
+            throw std::runtime_error("failed to resolve RTSP address " + host);
+        }
+        const int fd = socket(addresses->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const int reuse = 1;
+        if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0
+            || bind(fd, addresses->ai_addr, addresses->ai_addrlen) < 0 || listen(fd, 8) < 0)
+        {
+            freeaddrinfo(addresses);
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            throw std::runtime_error("failed to listen for RTSP on " + host + ":" + std::to_string(port));
+        }
+        freeaddrinfo(addresses);
+        return fd;
+    }
+
+    // Value of a header of the request, empty when it is missing
+    std::string header(std::string const &request, const char *name)
+    {
+        const size_t nameSize = strlen(name);
+        size_t line = request.find("\r\n");
+        while (line != std::string::npos && line + 2 < request.size())
+        {
+            line += 2;
+            const size_t end = request.find("\r\n", line);
+            const size_t colon = request.find(':', line);
+            if (colon < end && colon - line == nameSize && strncasecmp(request.data() + line, name, nameSize) == 0)
+            {
+                const size_t value = request.find_first_not_of(' ', colon + 1);
+                return value < end ? request.substr(value, end - value) : "";
+            }
+            line = end;
+        }
+        return "";
+    }
+
+    // The number following key in a transport specification such as "client_port=5000-5001"
+    std::optional<unsigned long> parameter(std::string const &transport, const char *key, size_t offset = 0)
+    {
+        const size_t position = transport.find(key);
+        if (position == std::string::npos)
+        {
+            return std::nullopt;
+        }
+        const char *value = transport.c_str() + position + strlen(key);
+        for (size_t i = 0; i < offset; i++)
+        {
+            value = strchr(value, '-');
+            if (!value)
+            {
+                return std::nullopt;
+            }
+            value++;
+        }
+        char *end;
+        const unsigned long number = std::strtoul(value, &end, 10);
+        return end != value ? std::optional(number) : std::nullopt;
+    }
+
+    std::string base64(std::vector<uint8_t> const &data)
+    {
+        static constexpr char Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string text;
+        for (size_t i = 0; i < data.size(); i += 3)
+        {
+            const uint32_t chunk = data[i] << 16 | (i + 1 < data.size() ? data[i + 1] << 8 : 0)
+                                   | (i + 2 < data.size() ? data[i + 2] : 0);
+            text += Alphabet[chunk >> 18];
+            text += Alphabet[(chunk >> 12) & 63];
+            text += i + 1 < data.size() ? Alphabet[(chunk >> 6) & 63] : '=';
+            text += i + 2 < data.size() ? Alphabet[chunk & 63] : '=';
+        }
+        return text;
+    }
+
+    std::string hex(uint32_t value, int width)
+    {
+        std::ostringstream text;
+        text << std::uppercase << std::hex << std::setfill('0') << std::setw(width) << value;
+        return text.str();
+    }
+
+    void appendPacket(RtpFrame &frame, RtpPacket const &packet)
+    {
+        frame.Packets.emplace_back(frame.Data.size(), packet.Size());
+        frame.Data.insert(frame.Data.end(), packet.Header.data(), packet.Header.data() + packet.HeaderSize);
+        frame.Data.insert(frame.Data.end(), packet.Payload, packet.Payload + packet.PayloadSize);
+    }
+
+    // A UDP socket connected to the given port at the far end of the RTSP connection
+    int udpSocketToPeer(int connectionFd, uint16_t port, uint16_t &localPort)
+    {
+        sockaddr_storage address = {};
+        socklen_t length = sizeof(address);
+        if (getpeername(connectionFd, reinterpret_cast<sockaddr *>(&address), &length) < 0)
+        {
+            return -1;
+        }
+        if (address.ss_family == AF_INET6)
+        {
+            reinterpret_cast<sockaddr_in6 *>(&address)->sin6_port = htons(port);
+        }
+        else
+        {
+            reinterpret_cast<sockaddr_in *>(&address)->sin_port = htons(port);
+        }
+        const int fd = socket(address.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        // Connecting binds the socket to an ephemeral port, the server port the client is told
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&address), length) < 0
+            || getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length) < 0)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return -1;
+        }
+        localPort = ntohs(address.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6 *>(&address)->sin6_port
+                                                        : reinterpret_cast<sockaddr_in *>(&address)->sin_port);
+        return fd;
+    }
+}
+
+RtspServer::RtspServer(OutputOptions const *options, ParameterSetCache const *parameterSets,
+                       std::function<void()> requestKeyframe) :
+    options_(options)
+    , parameterSets_(parameterSets)
+    , requestKeyframe_(std::move(requestKeyframe))
+    , timestampOffset_(std::random_device()())
+    , packetizer_(RtpOutput::Mtu)
+{
+    listenFd_ = listenOn(options_->Ip, options_->Port);
+    serverThread_ = std::thread(&RtspServer::serve, this);
+    spdlog::info("Serving RTSP on {}:{}", options_->Ip.empty() ? "*" : options_->Ip, options_->Port);
+}
+
+RtspServer::~RtspServer()
+{
+    stop_requested = true;
+    if (serverThread_.joinable())
+    {
+        serverThread_.join();
+    }
+    for (auto &connection : connections_)
+    {
+        closeConnection(*connection);
+    }
+    close(listenFd_);
+}
+
+void RtspServer::Reconnect()
+{
+    spdlog::debug("RtspServer: nothing to reconnect, clients come back by themselves");
+}
+
+bool RtspServer::SendFrame(FrameFragment const *fragments, size_t count, int64_t captureTimestampUs)
+{
+    lastPacketCount_ = 0;
+    {
+        const std::lock_guard lock(sessionsMutex_);
+        if (playing_.empty())
+        {
+            return true;
+        }
+    }
+    const uint8_t *data = fragments[0].Data;
+    size_t size = fragments[0].Size;
+    if (count > 1)
+    {
+        size = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            size += fragments[i].Size;
+        }
+        if (staging_.size() < size)
+        {
+            staging_.resize(size);
+        }
+        size_t offset = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            std::memcpy(staging_.data() + offset, fragments[i].Data, fragments[i].Size);
+            offset += fragments[i].Size;
+        }
+        data = staging_.data();
+    }
+
+    nalIndex_.Build(data, size);
+    const bool keyframe = nalIndex_.Find(NalUnitTypeIdr) != nullptr;
+    const uint32_t timestamp = rtpTimestamp(captureTimestampUs);
+    // Copied once for all clients, which may each still be sending it when the next frame arrives
+    const auto frame = takeFrame();
+    frame->Keyframe = keyframe;
+    // A client starting on a keyframe the encoder sent without parameter sets gets the cached ones
+    // ahead of it, numbered in the shared sequence like any other packet
+    if (keyframe && !nalIndex_.Find(NalUnitTypeSps) && waitingForKeyframe())
+    {
+        const std::vector<uint8_t> stapA = parameterSets_->StapA();
+        if (!stapA.empty())
+        {
+            appendPacket(*frame, packetizer_.PacketizeNalUnit(stapA.data(), stapA.size(), timestamp, false));
+        }
+    }
+    std::vector<RtpPacket> const &packets = packetizer_.Packetize(data, size, timestamp);
+    if (packets.empty())
+    {
+        return true;
+    }
+    frame->Data.reserve(frame->Data.size() + size + packets.size() * (H264Packetizer::RtpHeaderSize + 2));
+    for (RtpPacket const &packet : packets)
+    {
+        appendPacket(*frame, packet);
+    }
+    lastPacketCount_ = frame->Packets.size();
+
+    bool keyframeWanted = false;
+    {
+        const std::lock_guard lock(sessionsMutex_);
+        for (auto const &session : playing_)
+        {
+            keyframeWanted |= session->Push(frame);
+        }
+    }
+    if (keyframeWanted)
+    {
+        keyframeNeeded();
+    }
+    return true;
+}
+
+size_t RtspServer::HeapBytes() const
+{
+    size_t bytes = staging_.capacity();
+    for (auto const &frame : framePool_)
+    {
+        bytes += frame->Data.capacity() + frame->Packets.capacity() * sizeof(frame->Packets[0]);
+    }
+    return bytes;
+}
+
+std::shared_ptr<RtpFrame> RtspServer::takeFrame()
+{
+    for (auto &frame : framePool_)
+    {
+        if (frame.use_count() == 1)
+        {
+            // Pairs with the release of the last client's reference, after its last read
+            std::atomic_thread_fence(std::memory_order_acquire);
+            frame->Data.clear();
+            frame->Packets.clear();
+            frame->Keyframe = false;
+            return frame;
+        }
+    }
+    auto frame = std::make_shared<RtpFrame>();
+    if (framePool_.size() < FramePoolSize)
+    {
+        framePool_.push_back(frame);
+    }
+    return frame;
+}
+
+bool RtspServer::waitingForKeyframe()
+{
+    const std::lock_guard lock(sessionsMutex_);
+    return std::any_of(playing_.begin(), playing_.end(),
+                       [](auto const &session) { return session->WaitingForKeyframe(); });
+}
+
+uint32_t RtspServer::rtpTimestamp(int64_t timestampUs) const
+{
+    return MonotonicToRtp(timestampUs, RtpOutput::ClockRate, timestampOffset_);
+}
+
+void RtspServer::serve()
+{
+    std::vector<pollfd> fds;
+    while (!stop_requested)
+    {
+        fds.assign(1, {listenFd_, POLLIN, 0});
+        int timeoutMs = PollIntervalMs;
+        for (auto const &connection : connections_)
+        {
+            const bool writing = !connection->Outgoing.empty();
+            fds.push_back({connection->Fd, static_cast<short>(POLLIN | (writing ? POLLOUT : 0)), 0});
+            // Waiting for the socket only helps once the lock is taken
+            if (writing && !connection->OutgoingLock.owns_lock())
+            {
+                timeoutMs = RetryIntervalMs;
+            }
+        }
+        const int ready = poll(fds.data(), fds.size(), timeoutMs);
+        std::vector<bool> closing(connections_.size(), false);
+        for (size_t i = 0; i < connections_.size(); i++)
+        {
+            if (ready > 0 && (fds[i + 1].revents & ~POLLOUT))
+            {
+                closing[i] = !receive(*connections_[i]);
+            }
+            closing[i] = closing[i] || !flush(*connections_[i]);
+        }
+        if (ready > 0 && (fds[0].revents & POLLIN))
+        {
+            const int fd = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0 && connections_.size() >= MaxConnections)
+            {
+                close(fd);
+            }
+            else if (fd >= 0)
+            {
+                const timeval sendTimeout = {ConnectionSendTimeoutMs / 1000, ConnectionSendTimeoutMs % 1000 * 1000};
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+                const int noDelay = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+                auto connection = std::make_unique<Connection>();
+                connection->Fd = fd;
+                connection->LastActivityUs = MonotonicNowUs();
+                connections_.push_back(std::move(connection));
+                closing.push_back(false);
+            }
+        }
+
+        const int64_t nowUs = MonotonicNowUs();
+        for (size_t i = connections_.size(); i-- > 0;)
+        {
+            Connection &connection = *connections_[i];
+            auto &retired = connection.Retired;
+            const auto finished = [](auto const &session) { return session->Finished(); };
+            retired.erase(std::remove_if(retired.begin(), retired.end(), finished), retired.end());
+            const bool expired = nowUs - connection.LastActivityUs > SessionTimeoutS * 1000000ll;
+            if (closing[i] || expired || (connection.Session && connection.Session->Failed()))
+            {
+                closeConnection(connection);
+                connections_.erase(connections_.begin() + i);
+            }
+        }
+    }
+}
+
+bool RtspServer::receive(Connection &connection)
+{
+    char buffer[4096];
+    const ssize_t received = recv(connection.Fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (received <= 0)
+    {
+        return received < 0 && (errno == EAGAIN || errno == EINTR);
+    }
+    connection.Received.append(buffer, received);
+    connection.LastActivityUs = MonotonicNowUs();
+
+    std::string &pending = connection.Received;
+    while (!pending.empty())
+    {
+        if (pending[0] == '$')
+        {
+            // RTCP interleaved by the client, only taken as a sign of life
+            if (pending.size() < 4)
+            {
+                break;
+            }
+            const size_t length = 4 + (static_cast<uint8_t>(pending[2]) << 8 | static_cast<uint8_t>(pending[3]));
+            if (pending.size() < length)
+            {
+                break;
+            }
+            pending.erase(0, length);
+            continue;
+        }
+        const size_t end = pending.find("\r\n\r\n");
+        if (end == std::string::npos)
+        {
+            return pending.size() <= MaxRequestBytes;
+        }
+        const std::string request = pending.substr(0, end + 2);
+        // Bodies, such as GET_PARAMETER's, are skipped
+        const size_t length = end + 4 + std::strtoul(header(request, "Content-Length").c_str(), nullptr, 10);
+        if (pending.size() < length)
+        {
+            return length <= MaxRequestBytes;
+        }
+        pending.erase(0, length);
+        if (!handleRequest(connection, request))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RtspServer::handleRequest(Connection &connection, std::string const &request)
+{
+    std::istringstream requestLine(request.substr(0, request.find("\r\n")));
+    std::string method;
+    std::string url;
+    requestLine >> method >> url;
+    const std::string sessionHeader = header(request, "Session");
+    const std::string sessionId = sessionHeader.substr(0, sessionHeader.find(';'));
+    const bool sessionMatches = connection.Session && sessionId == connection.Session->Id();
+
+    std::string status = "200 OK";
+    std::ostringstream headers;
+    std::string body;
+    if (method == "OPTIONS")
+    {
+        headers << "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER\r\n";
+    }
+    else if (method == "DESCRIBE")
+    {
+        body = describe();
+        headers << "Content-Base: " << url << (!url.empty() && url.back() == '/' ? "" : "/") << "\r\n"
+                << "Content-Type: application/sdp\r\n";
+    }
+    else if (method == "SETUP")
+    {
+        // A single track, so one session per connection
+        const size_t sessions = std::count_if(connections_.begin(), connections_.end(),
+                                              [](auto const &other) { return other->Session != nullptr; });
+        if (connection.Session)
+        {
+            status = "455 Method Not Valid in This State";
+        }
+        else if (sessions >= options_->RtspMaxClients)
+        {
+            status = "453 Not Enough Bandwidth";
+        }
+        else if (const std::string transport = setup(connection, header(request, "Transport")); transport.empty())
+        {
+            status = "461 Unsupported Transport";
+        }
+        else
+        {
+            headers << "Transport: " << transport << "\r\n"
+                    << "Session: " << connection.Session->Id() << ";timeout=" << SessionTimeoutS << "\r\n";
+        }
+    }
+    else if (method == "PLAY")
+    {
+        if (!sessionMatches)
+        {
+            status = "454 Session Not Found";
+        }
+        else
+        {
+            play(connection);
+            // No seq: the client is sent packets from the next keyframe on, whose sequence number is
+            // not known yet, and clients take it from the first packet they get
+            headers << "Session: " << sessionId << "\r\n"
+                    << "Range: npt=0.000-\r\n"
+                    << "RTP-Info: url=" << url << ";rtptime=" << rtpTimestamp(MonotonicNowUs()) << "\r\n";
+        }
+    }
+    else if (method == "TEARDOWN")
+    {
+        if (!sessionMatches)
+        {
+            status = "454 Session Not Found";
+        }
+        else
+        {
+            endSession(connection);
+            headers << "Session: " << sessionId << "\r\n";
+        }
+    }
+    else if (method == "GET_PARAMETER")
+    {
+        // Keep-alive, the activity has been noted already
+        if (sessionMatches)
+        {
+            headers << "Session: " << sessionId << "\r\n";
+        }
+    }
+    else
+    {
+        status = "501 Not Implemented";
+    }
+    spdlog::debug("RTSP {} {}: {}", method, url, status);
+
+    std::ostringstream response;
+    response << "RTSP/1.0 " << status << "\r\n"
+             << "CSeq: " << header(request, "CSeq") << "\r\n"
+             << "Server: libcamera-streamer\r\n"
+             << headers.str();
+    if (!body.empty())
+    {
+        response << "Content-Length: " << body.size() << "\r\n";
+    }
+    response << "\r\n" << body;
+    connection.Outgoing += response.str();
+    return connection.Outgoing.size() <= MaxOutgoingBytes && flush(connection);
+}
+
+bool RtspServer::flush(Connection &connection)
+{
+    if (connection.Outgoing.empty())
+    {
+        return true;
+    }
+    // A sender thread holds it while writing a frame, the response follows that frame
+    if (!connection.OutgoingLock.owns_lock() && !connection.OutgoingLock.try_lock())
+    {
+        return true;
+    }
+    while (!connection.Outgoing.empty())
+    {
+        const ssize_t result = send(connection.Fd, connection.Outgoing.data(), connection.Outgoing.size(),
+                                    MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            // Kept locked, no packet may land in the middle of a response
+            return true;
+        }
+        if (result <= 0)
+        {
+            return false;
+        }
+        connection.Outgoing.erase(0, result);
+    }
+    connection.OutgoingLock.unlock();
+    return true;
+}
+
+std::string RtspServer::describe() const
+{
+    const auto sps = parameterSets_->Sps();
+    const auto pps = parameterSets_->Pps();
+    std::ostringstream sdp;
+    sdp << "v=0\r\n"
+        << "o=- " << timestampOffset_ << " 1 IN IP4 0.0.0.0\r\n"
+        << "s=libcamera-streamer\r\n"
+        << "c=IN IP4 0.0.0.0\r\n"
+        << "t=0 0\r\n"
+        << "a=control:*\r\n"
+        << "m=video 0 RTP/AVP 96\r\n"
+        << "a=rtpmap:96 H264/90000\r\n"
+        << "a=fmtp:96 packetization-mode=1";
+    // Known once the first frame came out of the encoder; until then clients take them in-band
+    if (sps.size() >= 4 && !pps.empty())
+    {
+        sdp << ";profile-level-id=" << hex(sps[1] << 16 | sps[2] << 8 | sps[3], 6)
+            << ";sprop-parameter-sets=" << base64(sps) << "," << base64(pps);
+    }
+    sdp << "\r\n"
+        << "a=control:track0\r\n";
+    return sdp.str();
+}
+
+std::string RtspServer::setup(Connection &connection, std::string const &transport)
+{
+    const std::string ssrc = hex(packetizer_.Ssrc(), 8);
+    const size_t queueBytes = options_->RtspClientQueueBytes;
+    std::istringstream choices(transport);
+    std::string choice;
+    // The client lists the transports it takes in order of preference
+    while (std::getline(choices, choice, ','))
+    {
+        if (choice.find("multicast") != std::string::npos)
+        {
+            continue;
+        }
+        std::ostringstream id;
+        std::random_device random;
+        id << std::uppercase << std::hex << random() << random();
+        if (choice.rfind("RTP/AVP/TCP", 0) == 0)
+        {
+            const uint8_t channel = static_cast<uint8_t>(parameter(choice, "interleaved=").value_or(0));
+            connection.Session = std::make_shared<RtspSession>(id.str(), connection.Fd, &connection.WriteMutex,
+                                                               channel, queueBytes);
+            return "RTP/AVP/TCP;unicast;interleaved=" + std::to_string(channel) + "-" + std::to_string(channel + 1)
+                   + ";ssrc=" + ssrc;
+        }
+        if (choice.rfind("RTP/AVP", 0) == 0)
+        {
+            const auto rtpPort = parameter(choice, "client_port=");
+            uint16_t serverPort = 0;
+            const int fd = rtpPort ? udpSocketToPeer(connection.Fd, static_cast<uint16_t>(*rtpPort), serverPort) : -1;
+            if (fd < 0)
+            {
+                continue;
+            }
+            const auto rtcpPort = parameter(choice, "client_port=", 1).value_or(*rtpPort + 1);
+            connection.Session = std::make_shared<RtspSession>(id.str(), fd, queueBytes);
+            // RTCP from the client goes unanswered, the session lives on RTSP requests
+            return "RTP/AVP;unicast;client_port=" + std::to_string(*rtpPort) + "-" + std::to_string(rtcpPort)
+                   + ";server_port=" + std::to_string(serverPort) + "-" + std::to_string(serverPort + 1)
+                   + ";ssrc=" + ssrc;
+        }
+    }
+    return "";
+}
+
+void RtspServer::play(Connection &connection)
+{
+    connection.Session->Play();
+    {
+        const std::lock_guard lock(sessionsMutex_);
+        if (std::find(playing_.begin(), playing_.end(), connection.Session) == playing_.end())
+        {
+            playing_.push_back(connection.Session);
+        }
+    }
+    spdlog::info("RTSP session {} playing over {}", connection.Session->Id(),
+                 connection.Session->Interleaved() ? "TCP" : "UDP");
+    keyframeNeeded();
+}
+
+void RtspServer::endSession(Connection &connection)
+{
+    if (!connection.Session)
+    {
+        return;
+    }
+    {
+        const std::lock_guard lock(sessionsMutex_);
+        playing_.erase(std::remove(playing_.begin(), playing_.end(), connection.Session), playing_.end());
+    }
+    // Its sender thread may be blocked on a slow client, joined once it has finished
+    connection.Session->Stop();
+    connection.Retired.push_back(std::move(connection.Session));
+}
+
+void RtspServer::keyframeNeeded()
+{
+    // Whichever thread claims the interval asks, a keyframe on its way serves every waiting client
+    const int64_t nowUs = MonotonicNowUs();
+    int64_t lastUs = lastKeyframeRequestUs_.load(std::memory_order_relaxed);
+    if (nowUs - lastUs < KeyframeRequestIntervalUs
+        || !lastKeyframeRequestUs_.compare_exchange_strong(lastUs, nowUs, std::memory_order_relaxed))
+    {
+        return;
+    }
+    requestKeyframe_();
+}
+
+void RtspServer::closeConnection(Connection &connection)
+{
+    // Unblocks sender threads writing interleaved packets, which are joined before the descriptor
+    // can be reused
+    if (connection.OutgoingLock.owns_lock())
+    {
+        connection.OutgoingLock.unlock();
+    }
+    shutdown(connection.Fd, SHUT_RDWR);
+    endSession(connection);
+    connection.Retired.clear();
+    close(connection.Fd);
+}
@@ -0,0 +1,109 @@
+#ifndef RTSP_SERVER_H
+#define RTSP_SERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_output.hpp"
+#include "h264_packetizer.h"
+#include "nal_index.h"
+#include "parameter_set_cache.h"
+#include "rtsp_session.h"
+#include "libcamera-streamer/output_options.hpp"
+
+// Serves the stream over RTSP (RFC 2326) on Ip:Port, so several viewers pull the one encoded
+// stream without a relay process in between. Answers OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN
+// and GET_PARAMETER for a single H.264 track, with RTP over UDP or interleaved on the RTSP
+// connection.
+//
+// Each frame is packetized once and the packets shared by the queues of all playing clients, see
+// RtspSession. The SDP carries the cached SPS and PPS, and a client starting to play, or starting
+// to drop frames, asks for a keyframe, which the streamer sends with its parameter sets, so it
+// resumes decoding straight away. Requests are rate-limited, one serves every waiting client.
+// A keyframe reaching waiting clients without in-band parameter sets is preceded by a STAP-A of
+// the cached ones.
+class RtspServer : public FrameOutput
+{
+private:
+    // An RTSP connection, with the session it set up
+    struct Connection
+    {
+        int Fd;
+        std::string Received;
+        int64_t LastActivityUs;
+        // Responses and interleaved packets are written under it
+        std::mutex WriteMutex;
+        // Responses not written yet. The server thread only ever tries the lock and writes without
+        // blocking, holding the lock until they are out, so a client slow to take its interleaved
+        // packets never holds up the others.
+        std::string Outgoing;
+        std::unique_lock<std::mutex> OutgoingLock{WriteMutex, std::defer_lock};
+        std::shared_ptr<RtspSession> Session;
+        // Torn down, destroyed once their sender thread has finished the frame it was sending
+        std::vector<std::shared_ptr<RtspSession>> Retired;
+    };
+
+    OutputOptions const *options_;
+    ParameterSetCache const *parameterSets_;
+    std::function<void()> requestKeyframe_;
+    std::atomic<int64_t> lastKeyframeRequestUs_{0};
+    // Random start of the RTP timeline, as RFC 3550 asks for
+    uint32_t timestampOffset_;
+    int listenFd_ = -1;
+
+    // Server thread
+    std::vector<std::unique_ptr<Connection>> connections_;
+    std::thread serverThread_;
+    std::atomic<bool> stop_requested{false};
+
+    std::mutex sessionsMutex_;
+    std::vector<std::shared_ptr<RtspSession>> playing_;
+
+    // Output thread
+    H264Packetizer packetizer_;
+    NalIndex nalIndex_;
+    std::vector<uint8_t> staging_;
+    // Frames handed out before, taken again once no client holds them any more
+    std::vector<std::shared_ptr<RtpFrame>> framePool_;
+    size_t lastPacketCount_ = 0;
+
+public:
+    // requestKeyframe is called from the server thread when a client starts playing, and from the
+    // output thread when a client starts dropping frames
+    RtspServer(OutputOptions const *options, ParameterSetCache const *parameterSets,
+               std::function<void()> requestKeyframe);
+    ~RtspServer() override;
+
+    // Queues the frame for every playing client, succeeding without any
+    bool SendFrame(FrameFragment const *fragments, size_t count, int64_t captureTimestampUs) override;
+    // Clients reconnect by themselves, the server keeps listening
+    void Reconnect() override;
+
+    size_t LastPacketCount() const override { return lastPacketCount_; }
+    size_t HeapBytes() const override;
+
+private:
+    void serve();
+    // Returns false once the connection is to be closed
+    bool receive(Connection &connection);
+    bool handleRequest(Connection &connection, std::string const &request);
+    // Writes what it can of the pending responses, returns false once the connection failed
+    bool flush(Connection &connection);
+    std::string describe() const;
+    std::string setup(Connection &connection, std::string const &transport);
+    void play(Connection &connection);
+    void endSession(Connection &connection);
+    void closeConnection(Connection &connection);
+    void keyframeNeeded();
+    std::shared_ptr<RtpFrame> takeFrame();
+    bool waitingForKeyframe();
+    uint32_t rtpTimestamp(int64_t timestampUs) const;
+};
+
+#endif
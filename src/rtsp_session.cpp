@@ -0,0 +1,247 @@
+#include "rtsp_session.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+
+#include "clock_conversion.h"
+
+namespace
+{
+    // A client dropping frames again soon after its last keyframe asks twice as late each time, up
+    // to the longest backoff, and starts over once it has kept up for that long
+    constexpr int64_t KeyframeBackoffMinUs = 500000;
+    constexpr int64_t KeyframeBackoffMaxUs = 8000000;
+}
+
+RtspSession::RtspSession(std::string id, int rtpSocket, size_t queueLimitBytes) :
+    id_(std::move(id))
+    , rtpSocket_(rtpSocket)
+    , queueLimitBytes_(queueLimitBytes)
+{
+}
+
+RtspSession::RtspSession(std::string id, int connectionFd, std::mutex *connectionWriteMutex, uint8_t channel,
+                         size_t queueLimitBytes) :
+    id_(std::move(id))
+    , connectionFd_(connectionFd)
+    , connectionWriteMutex_(connectionWriteMutex)
+    , channel_(channel)
+    , queueLimitBytes_(queueLimitBytes)
+{
+}
+
+RtspSession::~RtspSession()
+{
+    Stop();
+    if (senderThread_.joinable())
+    {
+        senderThread_.join();
+    }
+    if (rtpSocket_ >= 0)
+    {
+        close(rtpSocket_);
+    }
+    spdlog::info("RTSP session {} ended: {} frames sent, {} dropped", id_, framesSent_, framesDropped_);
+}
+
+void RtspSession::Play()
+{
+    const std::lock_guard lock(mutex_);
+    if (playing_)
+    {
+        return;
+    }
+    playing_ = true;
+    senderThread_ = std::thread(&RtspSession::sendLoop, this);
+}
+
+bool RtspSession::Push(std::shared_ptr<const RtpFrame> const &frame)
+{
+    {
+        const std::lock_guard lock(mutex_);
+        if (!playing_ || stop_requested)
+        {
+            return false;
+        }
+        if (waitingForKeyframe_ && !frame->Keyframe)
+        {
+            framesDropped_++;
+            return false;
+        }
+        // An empty queue takes any frame, however large, so a client is never starved
+        if (!queue_.empty() && queuedBytes_ + frame->Data.size() > queueLimitBytes_)
+        {
+            if (!frame->Keyframe)
+            {
+                framesDropped_++;
+                waitingForKeyframe_ = true;
+                return keyframeRequestDue();
+            }
+            framesDropped_ += queue_.size();
+            queue_.clear();
+            queuedBytes_ = 0;
+        }
+        waitingForKeyframe_ = false;
+        queue_.push_back(frame);
+        queuedBytes_ += frame->Data.size();
+    }
+    condition_.notify_one();
+    return false;
+}
+
+void RtspSession::Stop()
+{
+    {
+        const std::lock_guard lock(mutex_);
+        stop_requested = true;
+    }
+    condition_.notify_one();
+}
+
+bool RtspSession::WaitingForKeyframe()
+{
+    const std::lock_guard lock(mutex_);
+    return playing_ && waitingForKeyframe_;
+}
+
+uint64_t RtspSession::FramesDropped()
+{
+    const std::lock_guard lock(mutex_);
+    return framesDropped_;
+}
+
+bool RtspSession::keyframeRequestDue()
+{
+    const int64_t nowUs = MonotonicNowUs();
+    const int64_t sinceUs = nowUs - keyframeRequestUs_;
+    if (keyframeRequestUs_ != 0 && sinceUs < keyframeBackoffUs_)
+    {
+        return false;
+    }
+    keyframeBackoffUs_ = keyframeRequestUs_ == 0 || sinceUs >= KeyframeBackoffMaxUs
+                             ? KeyframeBackoffMinUs
+                             : std::min(2 * keyframeBackoffUs_, KeyframeBackoffMaxUs);
+    keyframeRequestUs_ = nowUs;
+    return true;
+}
+
+void RtspSession::sendLoop()
+{
+    sendFrames();
+    finished_.store(true, std::memory_order_release);
+}
+
+void RtspSession::sendFrames()
+{
+    while (true)
+    {
+        std::shared_ptr<const RtpFrame> frame;
+        {
+            std::unique_lock lock(mutex_);
+            condition_.wait(lock, [this] { return stop_requested || !queue_.empty(); });
+            if (stop_requested)
+            {
+                return;
+            }
+            frame = std::move(queue_.front());
+            queue_.pop_front();
+            queuedBytes_ -= frame->Data.size();
+        }
+        if (Interleaved())
+        {
+            if (!sendInterleaved(*frame))
+            {
+                // Part of a packet may have gone out, nothing after it would parse on the connection
+                spdlog::warn("RTSP session {}: connection failed while sending, errno {}", id_, errno);
+                failed_ = true;
+                return;
+            }
+        }
+        else if (!sendUdp(*frame))
+        {
+            // The client may come back, or the session times out
+            spdlog::debug("RTSP session {}: frame not sent, errno {}", id_, errno);
+            continue;
+        }
+        framesSent_++;
+    }
+}
+
+bool RtspSession::sendUdp(RtpFrame const &frame)
+{
+    const size_t packets = frame.Packets.size();
+    parts_.resize(packets);
+    messages_.resize(packets);
+    for (size_t i = 0; i < packets; i++)
+    {
+        parts_[i] = {const_cast<uint8_t *>(frame.Data.data() + frame.Packets[i].first), frame.Packets[i].second};
+        messages_[i] = {};
+        messages_[i].msg_hdr.msg_iov = &parts_[i];
+        messages_[i].msg_hdr.msg_iovlen = 1;
+    }
+    size_t sent = 0;
+    while (sent < packets)
+    {
+        const int result = sendmmsg(rtpSocket_, messages_.data() + sent, packets - sent, 0);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        sent += result;
+    }
+    return true;
+}
+
+bool RtspSession::sendInterleaved(RtpFrame const &frame)
+{
+    // Each packet behind a '$', the channel and its length (RFC 2326 10.12)
+    const size_t packets = frame.Packets.size();
+    prefixes_.resize(packets);
+    parts_.resize(2 * packets);
+    for (size_t i = 0; i < packets; i++)
+    {
+        const size_t size = frame.Packets[i].second;
+        prefixes_[i] = {'$', channel_, static_cast<uint8_t>(size >> 8), static_cast<uint8_t>(size & 0xff)};
+        parts_[2 * i] = {prefixes_[i].data(), prefixes_[i].size()};
+        parts_[2 * i + 1] = {const_cast<uint8_t *>(frame.Data.data() + frame.Packets[i].first), size};
+    }
+
+    const std::lock_guard lock(*connectionWriteMutex_);
+    iovec *next = parts_.data();
+    iovec *end = parts_.data() + parts_.size();
+    while (next != end)
+    {
+        msghdr message = {};
+        message.msg_iov = next;
+        message.msg_iovlen = std::min<size_t>(end - next, IOV_MAX);
+        ssize_t result = sendmsg(connectionFd_, &message, MSG_NOSIGNAL);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        // Skips what was written, resuming a partly written part where it stopped
+        while (next != end && static_cast<size_t>(result) >= next->iov_len)
+        {
+            result -= next->iov_len;
+            next++;
+        }
+        if (next != end)
+        {
+            next->iov_base = static_cast<uint8_t *>(next->iov_base) + result;
+            next->iov_len -= result;
+        }
+    }
+    return true;
+}
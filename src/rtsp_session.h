@@ -0,0 +1,104 @@
+#ifndef RTSP_SESSION_H
+#define RTSP_SESSION_H
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+
+// One access unit's RTP packets, built once by RtspServer and shared by the queues of all clients
+struct RtpFrame
+{
+    // The packets back to back
+    std::vector<uint8_t> Data;
+    // Offset and size of each packet in Data
+    std::vector<std::pair<size_t, size_t>> Packets;
+    bool Keyframe = false;
+};
+
+// A client playing the stream served by RtspServer, with a sender thread of its own so a slow
+// client never holds up the others or the output thread. Packets go to the client's RTP port over
+// UDP, or interleaved on its RTSP connection.
+//
+// Frames wait in a queue bounded in bytes. A frame that does not fit is dropped, and so is every
+// frame after it up to the next keyframe, as they could not be decoded anyway; a keyframe that
+// does not fit replaces the frames the client has not been sent yet. A keyframe is asked for once
+// per run of drops, backing off for a client that keeps falling behind, which otherwise picks up
+// the stream at the encoder's next periodic one.
+class RtspSession
+{
+private:
+    std::string id_;
+    // Connected to the client's RTP port, -1 when interleaved
+    int rtpSocket_ = -1;
+    // The RTSP connection and the lock its responses are written under, when interleaved
+    int connectionFd_ = -1;
+    std::mutex *connectionWriteMutex_ = nullptr;
+    uint8_t channel_ = 0;
+    size_t queueLimitBytes_;
+
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::deque<std::shared_ptr<const RtpFrame>> queue_;
+    size_t queuedBytes_ = 0;
+    bool playing_ = false;
+    bool waitingForKeyframe_ = true;
+    bool stop_requested = false;
+    uint64_t framesDropped_ = 0;
+    // When this client last asked for a keyframe, and how long until it may ask again
+    int64_t keyframeRequestUs_ = 0;
+    int64_t keyframeBackoffUs_ = 0;
+
+    std::thread senderThread_;
+    std::atomic<bool> failed_{false};
+    std::atomic<bool> finished_{false};
+    uint64_t framesSent_ = 0;
+    // Reused from frame to frame by the sender thread
+    std::vector<std::array<uint8_t, 4>> prefixes_;
+    std::vector<iovec> parts_;
+    std::vector<mmsghdr> messages_;
+
+public:
+    // Over UDP, taking ownership of the socket
+    RtspSession(std::string id, int rtpSocket, size_t queueLimitBytes);
+    // Interleaved on the RTSP connection, which must outlive the session
+    RtspSession(std::string id, int connectionFd, std::mutex *connectionWriteMutex, uint8_t channel,
+                size_t queueLimitBytes);
+    // Joins the sender thread, which Stop() lets the caller avoid waiting on
+    ~RtspSession();
+
+    std::string const &Id() const { return id_; }
+    bool Interleaved() const { return rtpSocket_ < 0; }
+
+    // Starts sending, from the next keyframe on
+    void Play();
+    // Queues the frame or drops it, never blocking. Returns true when the frame started a run of
+    // drops and the client's backoff lets it ask for a keyframe. Output thread.
+    bool Push(std::shared_ptr<const RtpFrame> const &frame);
+    // Nothing is queued until the next keyframe, as at the start or after a drop
+    bool WaitingForKeyframe();
+    // Stops sending after the frame being sent, without waiting for it
+    void Stop();
+    // The sender thread has exited or never started, destroying the session does not block
+    bool Finished() const { return !senderThread_.joinable() || finished_.load(std::memory_order_acquire); }
+    // The interleaved connection broke mid-frame, the session has stopped sending
+    bool Failed() const { return failed_.load(std::memory_order_relaxed); }
+    uint64_t FramesDropped();
+
+private:
+    bool keyframeRequestDue();
+    void sendLoop();
+    void sendFrames();
+    bool sendUdp(RtpFrame const &frame);
+    bool sendInterleaved(RtpFrame const &frame);
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "send_pacer.h"
+
+#include <algorithm>
+
+namespace
+{
+    // Until two frames have been seen
+    constexpr int64_t DefaultIntervalUs = 33333;
+    // Gaps from dropped frames or a stopped camera only nudge the measured interval
+    constexpr int64_t MaxIntervalUs = 1000000;
+}
+
+SendPacer::SendPacer(float fraction, size_t burstBytes) :
+    fraction_(fraction)
+    , burstBytes_(burstBytes)
+    , tokens_(static_cast<double>(burstBytes))
+    , intervalUs_(DefaultIntervalUs)
+{
+}
+
+void SendPacer::BeginFrame(size_t frameBytes, int64_t captureUs)
+{
+    if (lastCaptureUs_ != 0 && captureUs > lastCaptureUs_)
+    {
+        const int64_t sample = std::min(captureUs - lastCaptureUs_, MaxIntervalUs);
+        intervalUs_ += (sample - intervalUs_) / 8;
+    }
+    lastCaptureUs_ = captureUs;
+    // The bucket refills within the spread even after frames smaller than the burst
+    const double spreadUs = std::max<double>(1.0, fraction_ * intervalUs_);
+    bytesPerUs_ = static_cast<double>(std::max(frameBytes, burstBytes_)) / spreadUs;
+}
+
+int64_t SendPacer::Schedule(size_t packetBytes, int64_t nowUs)
+{
+    // Tokens accrue in real time, but never ahead of the packet scheduled before
+    const int64_t startUs = std::max(nowUs, lastUs_);
+    tokens_ = std::min<double>(burstBytes_, tokens_ + (startUs - lastUs_) * bytesPerUs_);
+    lastUs_ = startUs;
+    if (tokens_ >= packetBytes)
+    {
+        tokens_ -= packetBytes;
+        return startUs;
+    }
+    const int64_t waitUs = static_cast<int64_t>((packetBytes - tokens_) / bytesPerUs_) + 1;
+    // What accrues while it waits covers the packet exactly
+    tokens_ = 0;
+    lastUs_ = startUs + waitUs;
+    return lastUs_;
+}
@@ -0,0 +1,32 @@
+#ifndef SEND_PACER_H
+#define SEND_PACER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Token bucket giving each packet of a frame its departure time. The bucket holds up to
+// BurstBytes, so small frames leave at once; larger ones drain at the rate that spreads them
+// over the given fraction of the frame interval. Times are CLOCK_MONOTONIC microseconds.
+class SendPacer
+{
+private:
+    float fraction_;
+    size_t burstBytes_;
+    double tokens_;
+    double bytesPerUs_ = 0;
+    int64_t lastUs_ = 0;
+    // Frame interval measured between capture timestamps
+    int64_t intervalUs_ = 0;
+    int64_t lastCaptureUs_ = 0;
+
+public:
+    SendPacer(float fraction, size_t burstBytes);
+
+    // Sets the drain rate for a frame of frameBytes captured at captureUs
+    void BeginFrame(size_t frameBytes, int64_t captureUs);
+    // When the next packet of the frame may leave, no earlier than nowUs
+    int64_t Schedule(size_t packetBytes, int64_t nowUs);
+    int64_t FrameIntervalUs() const { return intervalUs_; }
+};
+
+#endif
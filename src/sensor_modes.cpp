@@ -0,0 +1,176 @@
+#include "sensor_modes.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+#include <spdlog/spdlog.h>
+
+namespace
+{
+    // Raw formats are named like SRGGB10_CSI2P or R12: the digits are the bit depth and the
+    // CSI2P suffix marks the packed variant.
+    void parseRawFormat(std::string const &name, unsigned int &bitDepth, bool &packed)
+    {
+        const auto digits = std::find_if(name.begin(), name.end(), [](char c) { return std::isdigit(c); });
+        bitDepth = 0;
+        for (auto it = digits; it != name.end() && std::isdigit(*it); ++it)
+        {
+            bitDepth = bitDepth * 10 + (*it - '0');
+        }
+        const std::string packedSuffix = "_CSI2P";
+        packed = name.size() >= packedSuffix.size()
+                 && name.compare(name.size() - packedSuffix.size(), packedSuffix.size(), packedSuffix) == 0;
+    }
+}
+
+std::string SensorMode::ToString() const
+{
+    std::stringstream ss;
+    ss << Width << ":" << Height << ":" << BitDepth << ":" << (Packed ? "P" : "U") << " " << PixelFormat
+       << " crop " << Crop.width << "x" << Crop.height << "+" << Crop.x << "+" << Crop.y << " max " << MaxFramerate()
+       << " fps";
+    return ss.str();
+}
+
+std::vector<SensorMode> EnumerateSensorModes(libcamera::Camera &camera)
+{
+    std::vector<SensorMode> modes;
+    auto configuration = camera.generateConfiguration({libcamera::StreamRole::Raw});
+    if (!configuration)
+    {
+        throw std::runtime_error("failed to generate raw configuration");
+    }
+
+    const libcamera::StreamFormats formats = configuration->at(0).formats();
+    for (const auto &pixelFormat : formats.pixelformats())
+    {
+        for (const auto &size : formats.sizes(pixelFormat))
+        {
+            configuration->at(0).pixelFormat = pixelFormat;
+            configuration->at(0).size = size;
+            configuration->validate();
+            if (camera.configure(configuration.get()) < 0)
+            {
+                spdlog::warn("Failed to configure sensor mode {} {}", pixelFormat.toString(), size.toString());
+                continue;
+            }
+
+            const auto frameDurationLimits = camera.controls().find(&libcamera::controls::FrameDurationLimits);
+            const auto scalerCrop = camera.controls().find(&libcamera::controls::ScalerCrop);
+            if (frameDurationLimits == camera.controls().end() || scalerCrop == camera.controls().end())
+            {
+                continue;
+            }
+
+            SensorMode mode;
+            mode.PixelFormat = pixelFormat.toString();
+            mode.Width = size.width;
+            mode.Height = size.height;
+            parseRawFormat(mode.PixelFormat, mode.BitDepth, mode.Packed);
+            mode.Crop = scalerCrop->second.max().get<libcamera::Rectangle>();
+            mode.MinFrameDurationUs = frameDurationLimits->second.min().get<int64_t>();
+            modes.push_back(mode);
+        }
+    }
+    return modes;
+}
+
+std::optional<std::vector<SensorMode>> LoadSensorModeCache(std::string const &path, std::string const &cameraId)
+{
+    std::ifstream file(path);
+    std::string key;
+    std::string id;
+    if (!file || !(file >> key) || key != "camera" || !std::getline(file >> std::ws, id) || id != cameraId)
+    {
+        return std::nullopt;
+    }
+
+    std::vector<SensorMode> modes;
+    SensorMode mode;
+    while (file >> mode.PixelFormat >> mode.Width >> mode.Height >> mode.BitDepth >> mode.Packed >> mode.Crop.x
+           >> mode.Crop.y >> mode.Crop.width >> mode.Crop.height >> mode.MinFrameDurationUs)
+    {
+        modes.push_back(mode);
+    }
+    if (!file.eof() || modes.empty())
+    {
+        spdlog::warn("Ignoring malformed sensor mode cache {}", path);
+        return std::nullopt;
+    }
+    return modes;
+}
+
+void SaveSensorModeCache(std::string const &path, std::string const &cameraId, std::vector<SensorMode> const &modes)
+{
+    std::ofstream file(path, std::ios::trunc);
+    file << "camera " << cameraId << "\n";
+    for (const auto &mode : modes)
+    {
+        file << mode.PixelFormat << " " << mode.Width << " " << mode.Height << " " << mode.BitDepth << " "
+             << mode.Packed << " " << mode.Crop.x << " " << mode.Crop.y << " " << mode.Crop.width << " "
+             << mode.Crop.height << " " << mode.MinFrameDurationUs << "\n";
+    }
+    if (!file)
+    {
+        spdlog::warn("Failed to save sensor mode cache to {}", path);
+    }
+}
+
+std::optional<SensorMode> FindSensorMode(std::vector<SensorMode> const &modes, Mode const &mode)
+{
+    for (const auto &sensorMode : modes)
+    {
+        if (sensorMode.Width == mode.width && sensorMode.Height == mode.height && sensorMode.BitDepth == mode.bit_depth
+            && sensorMode.Packed == mode.packed)
+        {
+            return sensorMode;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<SensorMode> ChooseSensorMode(std::vector<SensorMode> const &modes, unsigned int width,
+                                           unsigned int height, unsigned int framerate)
+{
+    const auto fieldOfView = [](SensorMode const &mode) {
+        return static_cast<uint64_t>(mode.Crop.width) * mode.Crop.height;
+    };
+    // Faster readout first, then wider field of view, then more bits per pixel
+    const auto better = [&](SensorMode const &a, SensorMode const &b) {
+        if (a.MinFrameDurationUs != b.MinFrameDurationUs)
+        {
+            return a.MinFrameDurationUs < b.MinFrameDurationUs;
+        }
+        if (fieldOfView(a) != fieldOfView(b))
+        {
+            return fieldOfView(a) > fieldOfView(b);
+        }
+        return a.BitDepth > b.BitDepth;
+    };
+
+    std::optional<SensorMode> best;
+    std::optional<SensorMode> fallback;
+    for (const auto &mode : modes)
+    {
+        if (mode.Width < width || mode.Height < height)
+        {
+            continue;
+        }
+        // Without a mode fast enough, fall back to the fastest one covering the output size
+        if (!fallback || better(mode, *fallback))
+        {
+            fallback = mode;
+        }
+        if (mode.MaxFramerate() < framerate)
+        {
+            continue;
+        }
+        if (!best || better(mode, *best))
+        {
+            best = mode;
+        }
+    }
+    return best ? best : fallback;
+}
@@ -0,0 +1,44 @@
+#ifndef SENSOR_MODES_H
+#define SENSOR_MODES_H
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "libcamera-streamer/camera_options.hpp"
+
+struct SensorMode
+{
+    std::string PixelFormat;
+    unsigned int Width;
+    unsigned int Height;
+    unsigned int BitDepth;
+    bool Packed;
+    // Area of the pixel array read out in this mode; smaller than the mode size means binning
+    libcamera::Rectangle Crop;
+    // Shortest frame the sensor can deliver, which bounds the readout time
+    int64_t MinFrameDurationUs;
+
+    double MaxFramerate() const { return 1e6 / MinFrameDurationUs; }
+    std::string ToString() const;
+};
+
+// Configures the camera in every raw mode to learn its crop and frame rate limits. This is slow
+// (each mode is a full sensor configuration), hence the cache below. The camera must be acquired.
+std::vector<SensorMode> EnumerateSensorModes(libcamera::Camera &camera);
+
+// The cache is keyed by camera id and ignored when it was written for another camera
+std::optional<std::vector<SensorMode>> LoadSensorModeCache(std::string const &path, std::string const &cameraId);
+void SaveSensorModeCache(std::string const &path, std::string const &cameraId, std::vector<SensorMode> const &modes);
+
+// Returns the mode matching an explicit W:H:bit-depth:packing request
+std::optional<SensorMode> FindSensorMode(std::vector<SensorMode> const &modes, Mode const &mode);
+
+// Picks the mode with the shortest readout that still covers the output size and reaches the
+// framerate, preferring the widest field of view among equally fast modes.
+std::optional<SensorMode> ChooseSensorMode(std::vector<SensorMode> const &modes, unsigned int width,
+                                           unsigned int height, unsigned int framerate);
+
+#endif
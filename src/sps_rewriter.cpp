@@ -0,0 +1,287 @@
+#include "sps_rewriter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "bit_reader.hpp"
+#include "bit_writer.hpp"
+#include "nal_index.h"
+
+namespace
+{
+    bool hasChromaFormat(uint32_t profileIdc)
+    {
+        switch (profileIdc)
+        {
+            case 100: case 110: case 122: case 244: case 44: case 83:
+            case 86: case 118: case 128: case 138: case 139: case 134: case 135:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    void skipScalingList(BitReader &reader, unsigned int size)
+    {
+        int32_t lastScale = 8;
+        int32_t nextScale = 8;
+        for (unsigned int i = 0; i < size && nextScale != 0; i++)
+        {
+            nextScale = (lastScale + reader.ReadSe() + 256) % 256;
+            lastScale = nextScale == 0 ? lastScale : nextScale;
+        }
+    }
+
+    void skipHrdParameters(BitReader &reader)
+    {
+        const uint32_t cpbCount = reader.ReadUe() + 1;
+        reader.Skip(4 + 4); // bit_rate_scale, cpb_size_scale
+        for (uint32_t i = 0; i < cpbCount; i++)
+        {
+            reader.ReadUe(); // bit_rate_value_minus1
+            reader.ReadUe(); // cpb_size_value_minus1
+            reader.ReadBit(); // cbr_flag
+        }
+        reader.Skip(5 + 5 + 5 + 5); // the delay and offset field lengths
+    }
+
+    // Copies the bits [from, to) of the RBSP
+    void copyBits(std::vector<uint8_t> const &rbsp, size_t from, size_t to, BitWriter &writer)
+    {
+        BitReader source(rbsp);
+        source.Skip(from);
+        for (size_t i = from; i < to; i++)
+        {
+            writer.WriteBit(source.ReadBit());
+        }
+    }
+}
+
+SpsRewriter::SpsRewriter(float framerate) : framerate_(framerate)
+{
+}
+
+void SpsRewriter::SetFramerate(float framerate)
+{
+    framerate_ = framerate;
+    // The next SPS seen is rewritten again, even when the encoder's did not change
+    originalSps_.clear();
+}
+
+size_t SpsRewriter::Rewrite(const uint8_t *data, size_t size, NalIndex const &index, FrameFragment *fragments)
+{
+    if (NalUnit const *sps = index.Find(NalUnitTypeSps))
+    {
+        fragments[0] = {data, sps->HeaderPosition};
+        fragments[1] = Substitute(data + sps->HeaderPosition, sps->End - sps->HeaderPosition);
+        fragments[2] = {data + sps->End, size - sps->End};
+        return 3;
+    }
+    fragments[0] = {data, size};
+    return 1;
+}
+
+FrameFragment SpsRewriter::Substitute(const uint8_t *nal, size_t size)
+{
+    if (size != originalSps_.size() || std::memcmp(originalSps_.data(), nal, size) != 0)
+    {
+        originalSps_.assign(nal, nal + size);
+        try
+        {
+            rewrittenSps_ = RewriteSps(nal, size, framerate_);
+            spdlog::debug("SpsRewriter: SPS rewritten from {} to {} bytes", size, rewrittenSps_.size());
+        }
+        catch (std::exception const &e)
+        {
+            spdlog::warn("SpsRewriter: leaving SPS unchanged, {}", e.what());
+            rewrittenSps_ = originalSps_;
+        }
+    }
+    return {rewrittenSps_.data(), rewrittenSps_.size()};
+}
+
+std::vector<uint8_t> SpsRewriter::RewriteSps(const uint8_t *nal, size_t size, float framerate)
+{
+    if (size < 2 || (nal[0] & 0x1f) != NalUnitTypeSps)
+    {
+        throw std::runtime_error("not an SPS");
+    }
+    std::vector<uint8_t> rbsp;
+    NalUnitToRbsp(nal + 1, size - 1, rbsp);
+    BitReader reader(rbsp);
+
+    const uint32_t profileIdc = reader.ReadBits(8);
+    reader.Skip(8 + 8); // constraint flags, level_idc
+    reader.ReadUe(); // seq_parameter_set_id
+    if (hasChromaFormat(profileIdc))
+    {
+        const uint32_t chromaFormatIdc = reader.ReadUe();
+        if (chromaFormatIdc == 3)
+        {
+            reader.ReadBit(); // separate_colour_plane_flag
+        }
+        reader.ReadUe(); // bit_depth_luma_minus8
+        reader.ReadUe(); // bit_depth_chroma_minus8
+        reader.ReadBit(); // qpprime_y_zero_transform_bypass_flag
+        if (reader.ReadBit()) // seq_scaling_matrix_present_flag
+        {
+            for (unsigned int i = 0; i < (chromaFormatIdc != 3 ? 8u : 12u); i++)
+            {
+                if (reader.ReadBit())
+                {
+                    skipScalingList(reader, i < 6 ? 16 : 64);
+                }
+            }
+        }
+    }
+    reader.ReadUe(); // log2_max_frame_num_minus4
+    const uint32_t picOrderCntType = reader.ReadUe();
+    if (picOrderCntType == 0)
+    {
+        reader.ReadUe(); // log2_max_pic_order_cnt_lsb_minus4
+    }
+    else if (picOrderCntType == 1)
+    {
+        reader.ReadBit(); // delta_pic_order_always_zero_flag
+        reader.ReadSe(); // offset_for_non_ref_pic
+        reader.ReadSe(); // offset_for_top_to_bottom_field
+        const uint32_t cycleLength = reader.ReadUe();
+        for (uint32_t i = 0; i < cycleLength; i++)
+        {
+            reader.ReadSe(); // offset_for_ref_frame
+        }
+    }
+    const uint32_t maxNumRefFrames = reader.ReadUe();
+    reader.ReadBit(); // gaps_in_frame_num_value_allowed_flag
+    reader.ReadUe(); // pic_width_in_mbs_minus1
+    reader.ReadUe(); // pic_height_in_map_units_minus1
+    if (!reader.ReadBit()) // frame_mbs_only_flag
+    {
+        reader.ReadBit(); // mb_adaptive_frame_field_flag
+    }
+    reader.ReadBit(); // direct_8x8_inference_flag
+    if (reader.ReadBit()) // frame_cropping_flag
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            reader.ReadUe();
+        }
+    }
+    const size_t vuiFlagPosition = reader.Position();
+
+    // Bit ranges of the existing VUI which are kept. Any bitstream_restriction is replaced.
+    const bool hasVui = reader.ReadBit();
+    size_t keptBegin = 0, keptEnd = 0, timingBegin = 0, timingEnd = 0, hrdBegin = 0, hrdEnd = 0;
+    if (hasVui)
+    {
+        keptBegin = reader.Position();
+        if (reader.ReadBit()) // aspect_ratio_info_present_flag
+        {
+            if (reader.ReadBits(8) == 255) // Extended_SAR
+            {
+                reader.Skip(16 + 16);
+            }
+        }
+        if (reader.ReadBit()) // overscan_info_present_flag
+        {
+            reader.ReadBit();
+        }
+        if (reader.ReadBit()) // video_signal_type_present_flag
+        {
+            reader.Skip(3 + 1); // video_format, video_full_range_flag
+            if (reader.ReadBit()) // colour_description_present_flag
+            {
+                reader.Skip(8 + 8 + 8);
+            }
+        }
+        if (reader.ReadBit()) // chroma_loc_info_present_flag
+        {
+            reader.ReadUe();
+            reader.ReadUe();
+        }
+        keptEnd = reader.Position();
+
+        timingBegin = reader.Position();
+        if (reader.ReadBit()) // timing_info_present_flag
+        {
+            reader.Skip(32 + 32 + 1);
+        }
+        timingEnd = reader.Position();
+
+        hrdBegin = reader.Position();
+        const bool nalHrd = reader.ReadBit();
+        if (nalHrd)
+        {
+            skipHrdParameters(reader);
+        }
+        const bool vclHrd = reader.ReadBit();
+        if (vclHrd)
+        {
+            skipHrdParameters(reader);
+        }
+        if (nalHrd || vclHrd)
+        {
+            reader.ReadBit(); // low_delay_hrd_flag
+        }
+        reader.ReadBit(); // pic_struct_present_flag
+        hrdEnd = reader.Position();
+    }
+    const bool hasTiming = hasVui && timingEnd - timingBegin > 1;
+
+    BitWriter writer;
+    copyBits(rbsp, 0, vuiFlagPosition, writer);
+    writer.WriteBit(true); // vui_parameters_present_flag
+    if (hasVui)
+    {
+        copyBits(rbsp, keptBegin, keptEnd, writer);
+    }
+    else
+    {
+        writer.WriteBits(0, 4); // aspect ratio, overscan, video signal type, chroma location
+    }
+    if (hasTiming)
+    {
+        copyBits(rbsp, timingBegin, timingEnd, writer);
+    }
+    else if (framerate > 0)
+    {
+        // time_scale / num_units_in_tick counts fields, so twice the frame rate
+        const uint32_t numUnitsInTick = 1000;
+        writer.WriteBit(true);
+        writer.WriteBits(numUnitsInTick, 32);
+        writer.WriteBits(static_cast<uint32_t>(std::lround(framerate * 2 * numUnitsInTick)), 32);
+        writer.WriteBit(false); // fixed_frame_rate_flag, the sensor may drop or stretch frames
+    }
+    else
+    {
+        writer.WriteBit(false);
+    }
+    if (hasVui)
+    {
+        copyBits(rbsp, hrdBegin, hrdEnd, writer);
+    }
+    else
+    {
+        writer.WriteBits(0, 3); // nal_hrd, vcl_hrd, pic_struct_present
+    }
+
+    writer.WriteBit(true); // bitstream_restriction_flag
+    writer.WriteBit(true); // motion_vectors_over_pic_boundaries_flag
+    writer.WriteUe(2); // max_bytes_per_pic_denom
+    writer.WriteUe(1); // max_bits_per_mb_denom
+    writer.WriteUe(16); // log2_max_mv_length_horizontal
+    writer.WriteUe(16); // log2_max_mv_length_vertical
+    writer.WriteUe(0); // max_num_reorder_frames
+    writer.WriteUe(std::max<uint32_t>(maxNumRefFrames, 1)); // max_dec_frame_buffering
+    writer.WriteTrailingBits();
+
+    std::vector<uint8_t> out;
+    AppendNalUnit(out, (nal[0] >> 5) & 3, NalUnitTypeSps, writer.Bytes());
+    // The caller keeps the original start code
+    out.erase(out.begin(), out.begin() + 4);
+    return out;
+}
@@ -0,0 +1,46 @@
+#ifndef SPS_REWRITER_H
+#define SPS_REWRITER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "frame_fragment.hpp"
+#include "nal_index.h"
+
+// Rewrites the VUI of the encoder's SPS to declare that frames are never reordered
+// (bitstream_restriction with max_num_reorder_frames 0 and max_dec_frame_buffering at its
+// minimum) and to carry timing info, so hardware decoders output each frame as soon as it is
+// decoded instead of filling their DPB first. Every other SPS and VUI field is kept.
+//
+// The rewritten SPS is cached and substituted by reference into every access unit carrying
+// the same original SPS, so only a change of SPS costs a parse and allocations.
+class SpsRewriter
+{
+public:
+    // Data before the SPS, the rewritten SPS and data after it
+    static constexpr size_t MaxFragments = 3;
+
+private:
+    float framerate_;
+    // NAL units without their start code, header byte included
+    std::vector<uint8_t> originalSps_;
+    std::vector<uint8_t> rewrittenSps_;
+
+public:
+    explicit SpsRewriter(float framerate);
+    // Timing info for SPSs rewritten from now on, the cached one included
+    void SetFramerate(float framerate);
+
+    // Splits an Annex-B access unit into fragments with its SPS replaced, returns how many were
+    // written. Access units without an SPS come back as a single fragment.
+    size_t Rewrite(const uint8_t *data, size_t size, NalIndex const &index, FrameFragment *fragments);
+    // The rewritten version of an SPS NAL unit given without its start code. Valid until an
+    // access unit with a different SPS is processed.
+    FrameFragment Substitute(const uint8_t *nal, size_t size);
+
+    // Returns the SPS NAL unit (header byte and escaped payload) with the VUI rewritten, throws on
+    // a malformed SPS
+    static std::vector<uint8_t> RewriteSps(const uint8_t *nal, size_t size, float framerate);
+};
+
+#endif
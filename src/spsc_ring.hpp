@@ -0,0 +1,172 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <thread>
+#include <type_traits>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// How a consumer waits on an empty ring: polls SpinIterations times, then sleeps on a futex.
+// Spinning covers the common case of a frame arriving within a few microseconds of the last
+// one being taken without a syscall; 0 always sleeps straight away. Single core systems never
+// spin, the producer cannot run while the consumer does.
+struct WaitStrategy
+{
+    unsigned int SpinIterations = 2000;
+};
+
+// Bounded single producer, single consumer ring for the descriptors handed between pipeline
+// threads (buffer indices, cookies, encoded frame descriptions). Slots are preallocated and
+// elements copied by value, so nothing is allocated once constructed. The producer only makes
+// a syscall when the consumer is actually asleep.
+template <typename T, size_t Capacity>
+class SpscRing
+{
+    static_assert(std::is_trivially_copyable_v<T>, "ring elements are copied as plain descriptors");
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+private:
+    // Producer and consumer positions on their own cache lines, so neither side's writes
+    // invalidate the line the other one polls
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    // Futex word bumped by the producer to wake a sleeping consumer
+    alignas(64) std::atomic<uint32_t> wakeups_{0};
+    std::atomic<bool> sleeping_{false};
+    std::atomic<bool> interrupted_{false};
+    unsigned int spinIterations_ = 0;
+    std::array<T, Capacity> slots_;
+
+public:
+    explicit SpscRing(WaitStrategy strategy = {})
+    {
+        SetWaitStrategy(strategy);
+    }
+    SpscRing(SpscRing const &) = delete;
+    SpscRing &operator=(SpscRing const &) = delete;
+
+    // Set before either thread uses the ring
+    void SetWaitStrategy(WaitStrategy strategy)
+    {
+        spinIterations_ = std::thread::hardware_concurrency() > 1 ? strategy.SpinIterations : 0;
+    }
+
+    // Producer side, returns false when the ring is full
+    bool TryPush(T const &value)
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+        slots_[tail % Capacity] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        // Pairs with the fence in WaitPop(): either the consumer sees the new tail before
+        // sleeping or this sees it asleep
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_.load(std::memory_order_relaxed))
+        {
+            wakeups_.fetch_add(1, std::memory_order_release);
+            syscall(SYS_futex, &wakeups_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+        return true;
+    }
+
+    // Consumer side, returns false when the ring is empty
+    bool TryPop(T &value)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        value = slots_[head % Capacity];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, blocks until an element is available. Empty once Interrupt() was called,
+    // until Resume().
+    std::optional<T> WaitPop()
+    {
+        T value;
+        for (unsigned int i = 0; i < spinIterations_; i++)
+        {
+            if (interrupted_.load(std::memory_order_acquire))
+            {
+                return std::nullopt;
+            }
+            if (TryPop(value))
+            {
+                return value;
+            }
+            cpuRelax();
+        }
+        while (true)
+        {
+            sleeping_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const uint32_t wakeups = wakeups_.load(std::memory_order_acquire);
+            if (interrupted_.load(std::memory_order_acquire))
+            {
+                sleeping_.store(false, std::memory_order_relaxed);
+                return std::nullopt;
+            }
+            if (TryPop(value))
+            {
+                sleeping_.store(false, std::memory_order_relaxed);
+                return value;
+            }
+            // Returns straight away if a push or an interrupt bumped the word since it was read
+            syscall(SYS_futex, &wakeups_, FUTEX_WAIT_PRIVATE, wakeups, nullptr, nullptr, 0);
+            sleeping_.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // From any thread: wakes the consumer and makes WaitPop() return empty, now and on every call
+    // until Resume(). Elements stay in the ring.
+    void Interrupt()
+    {
+        interrupted_.store(true, std::memory_order_release);
+        wakeups_.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, &wakeups_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+    // Once the consumer has stopped waiting
+    void Resume() { interrupted_.store(false, std::memory_order_release); }
+
+    // Discards every element; only while neither side is using the ring
+    void Clear() { head_.store(tail_.load(std::memory_order_relaxed), std::memory_order_relaxed); }
+
+    size_t SizeApprox() const
+    {
+        // Head first: it never passes the tail read after it
+        const size_t head = head_.load(std::memory_order_acquire);
+        return tail_.load(std::memory_order_acquire) - head;
+    }
+
+    static constexpr size_t Size() { return Capacity; }
+
+private:
+    static void cpuRelax()
+    {
+#if defined(__SSE2__)
+        _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield" ::: "memory");
+#endif
+    }
+};
+
+#endif
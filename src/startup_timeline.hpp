@@ -0,0 +1,73 @@
+#ifndef STARTUP_TIMELINE_H
+#define STARTUP_TIMELINE_H
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+struct StartupPhase
+{
+    std::string Name;
+    // Offsets from the moment the streamer started to be constructed
+    double BeginMs;
+    double EndMs;
+    std::thread::id ThreadId;
+};
+
+// Collects the duration of every startup step, including the ones running in parallel, so
+// time-to-first-packet can be broken down per phase.
+class StartupTimeline
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    Clock::time_point origin_ = Clock::now();
+    mutable std::mutex mutex_;
+    std::vector<StartupPhase> phases_;
+
+public:
+    Clock::time_point Origin() const { return origin_; }
+
+    // Records a phase which began at `begin` and ends now
+    void Record(std::string name, Clock::time_point begin)
+    {
+        const auto end = Clock::now();
+        const std::lock_guard lock(mutex_);
+        phases_.push_back({std::move(name), toMs(begin), toMs(end), std::this_thread::get_id()});
+    }
+
+    // Records an instantaneous event such as the first packet sent
+    void Mark(std::string name)
+    {
+        Record(std::move(name), Clock::now());
+    }
+
+    std::vector<StartupPhase> Phases() const
+    {
+        const std::lock_guard lock(mutex_);
+        return phases_;
+    }
+
+    void Log() const
+    {
+        const std::lock_guard lock(mutex_);
+        for (const auto &phase : phases_)
+        {
+            spdlog::info("Startup: {:<24} {:8.1f} ms -> {:8.1f} ms ({:.1f} ms)",
+                         phase.Name, phase.BeginMs, phase.EndMs, phase.EndMs - phase.BeginMs);
+        }
+    }
+
+private:
+    double toMs(Clock::time_point time) const
+    {
+        return std::chrono::duration<double, std::milli>(time - origin_).count();
+    }
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include "v4l2_device.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "v4l2_ioctl.hpp"
+
+KernelV4l2Device::KernelV4l2Device(std::string const &path) : path_(path)
+{
+    fd_ = open(path.c_str(), O_RDWR, 0);
+    if (fd_ < 0)
+    {
+        throw std::runtime_error("failed to open " + path);
+    }
+}
+
+KernelV4l2Device::~KernelV4l2Device()
+{
+    close(fd_);
+}
+
+int KernelV4l2Device::Ioctl(unsigned long request, void *arg)
+{
+    return Xioctl(fd_, request, arg);
+}
+
+int KernelV4l2Device::Poll(short events, short *revents, int timeoutMs)
+{
+    pollfd p = {fd_, events, 0};
+    const int result = poll(&p, 1, timeoutMs);
+    *revents = p.revents;
+    return result;
+}
+
+void *KernelV4l2Device::Mmap(size_t length, off_t offset)
+{
+    return mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, offset);
+}
+
+void KernelV4l2Device::Munmap(void *address, size_t length)
+{
+    munmap(address, length);
+}
+
+std::unique_ptr<V4l2Device> KernelV4l2Device::Reopen() const
+{
+    return std::make_unique<KernelV4l2Device>(path_);
+}
@@ -0,0 +1,44 @@
+#ifndef V4L2_DEVICE_H
+#define V4L2_DEVICE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+
+// The calls H264Encoder makes on its V4L2 memory-to-memory device, so the buffer handling can run
+// against FakeM2mEncoder as well as the kernel driver. Results and errno follow the syscalls.
+class V4l2Device
+{
+public:
+    virtual ~V4l2Device() = default;
+
+    // ioctl(), retried when interrupted by a signal
+    virtual int Ioctl(unsigned long request, void *arg) = 0;
+    // poll() on the device: the returned events in revents, 0 on timeout, -1 and errno on failure
+    virtual int Poll(short events, short *revents, int timeoutMs) = 0;
+    virtual void *Mmap(size_t length, off_t offset) = 0;
+    virtual void Munmap(void *address, size_t length) = 0;
+    // A fresh handle on the same device, for recovering a codec that stopped responding
+    virtual std::unique_ptr<V4l2Device> Reopen() const = 0;
+};
+
+// A V4L2 device node such as /dev/video11
+class KernelV4l2Device : public V4l2Device
+{
+private:
+    std::string path_;
+    int fd_;
+
+public:
+    explicit KernelV4l2Device(std::string const &path);
+    ~KernelV4l2Device() override;
+
+    int Ioctl(unsigned long request, void *arg) override;
+    int Poll(short events, short *revents, int timeoutMs) override;
+    void *Mmap(size_t length, off_t offset) override;
+    void Munmap(void *address, size_t length) override;
+    std::unique_ptr<V4l2Device> Reopen() const override;
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef V4L2_IOCTL_H
+#define V4L2_IOCTL_H
+
+#include <cerrno>
+#include <sys/ioctl.h>
+
+// ioctl() retried when interrupted by a signal
+inline int Xioctl(int fd, unsigned long request, void *arg)
+{
+    int ret, tries = 10;
+    do
+    {
+        ret = ioctl(fd, request, arg);
+    }
+    while (ret == -1 && errno == EINTR && tries-- > 0);
+    return ret;
+}
+
+#endif
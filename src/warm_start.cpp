@@ -0,0 +1,116 @@
+#include "warm_start.h"
+
+#include <cmath>
+#include <fstream>
+
+#include <spdlog/spdlog.h>
+
+std::optional<WarmStartState> LoadWarmStartState(std::string const &path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        return std::nullopt;
+    }
+
+    WarmStartState state;
+    std::string key;
+    while (file >> key)
+    {
+        if (key == "exposure_time")
+        {
+            file >> state.ExposureTime;
+        }
+        else if (key == "analogue_gain")
+        {
+            file >> state.AnalogueGain;
+        }
+        else if (key == "colour_gains")
+        {
+            file >> state.ColourGainRed >> state.ColourGainBlue;
+        }
+        else
+        {
+            spdlog::warn("Ignoring unknown warm start key {} in {}", key, path);
+            std::getline(file, key);
+        }
+    }
+    if (file.bad() || state.ExposureTime <= 0 || state.AnalogueGain <= 0)
+    {
+        spdlog::warn("Ignoring incomplete warm start state in {}", path);
+        return std::nullopt;
+    }
+    return state;
+}
+
+void SaveWarmStartState(std::string const &path, WarmStartState const &state)
+{
+    std::ofstream file(path, std::ios::trunc);
+    file << "exposure_time " << state.ExposureTime << "\n"
+         << "analogue_gain " << state.AnalogueGain << "\n"
+         << "colour_gains " << state.ColourGainRed << " " << state.ColourGainBlue << "\n";
+    if (!file)
+    {
+        spdlog::warn("Failed to save warm start state to {}", path);
+    }
+}
+
+void ConvergenceTracker::Reset(bool warmStarted)
+{
+    stats_ = ConvergenceStats();
+    stats_.WarmStarted = warmStarted;
+    frames_ = 0;
+    awbStableCount_ = 0;
+}
+
+void ConvergenceTracker::Update(libcamera::ControlList const &metadata)
+{
+    frames_++;
+
+    const auto exposureTime = metadata.get(libcamera::controls::ExposureTime);
+    const auto analogueGain = metadata.get(libcamera::controls::AnalogueGain);
+    const auto colourGains = metadata.get(libcamera::controls::ColourGains);
+    if (!exposureTime || !analogueGain)
+    {
+        return;
+    }
+
+    WarmStartState state;
+    state.ExposureTime = *exposureTime;
+    state.AnalogueGain = *analogueGain;
+    if (colourGains)
+    {
+        state.ColourGainRed = (*colourGains)[0];
+        state.ColourGainBlue = (*colourGains)[1];
+    }
+
+    const bool aeLocked = metadata.get(libcamera::controls::AeLocked).value_or(false);
+    if (stats_.AeFrames < 0 && aeLocked)
+    {
+        stats_.AeFrames = frames_;
+        spdlog::info("AE converged after {} frames (warm start: {})", frames_, stats_.WarmStarted);
+    }
+
+    // Followed for the whole run, not only until the first convergence, as it decides what is persisted
+    if (colourGains && latest_)
+    {
+        const bool stable = std::abs(state.ColourGainRed - latest_->ColourGainRed)
+                                <= AwbStableTolerance * latest_->ColourGainRed
+                            && std::abs(state.ColourGainBlue - latest_->ColourGainBlue)
+                                <= AwbStableTolerance * latest_->ColourGainBlue;
+        awbStableCount_ = stable ? awbStableCount_ + 1 : 0;
+        if (stats_.AwbFrames < 0 && awbStableCount_ == AwbStableFrames)
+        {
+            stats_.AwbFrames = frames_ - AwbStableFrames;
+            spdlog::info("AWB converged after {} frames (warm start: {})", stats_.AwbFrames, stats_.WarmStarted);
+        }
+    }
+
+    latest_ = state;
+    // Without colour gains in the metadata there is no AWB to wait for
+    const bool awbSettled = !colourGains || awbStableCount_ >= AwbStableFrames;
+    if (aeLocked && awbSettled)
+    {
+        converged_ = state;
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef WARM_START_H
+#define WARM_START_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include <libcamera/libcamera.h>
+
+// Last exposure and white balance reported by the camera, persisted so the next start can
+// seed AE/AWB close to where they converged instead of from the defaults.
+struct WarmStartState
+{
+    int32_t ExposureTime = 0; // us
+    float AnalogueGain = 0;
+    float ColourGainRed = 0;
+    float ColourGainBlue = 0;
+};
+
+std::optional<WarmStartState> LoadWarmStartState(std::string const &path);
+void SaveWarmStartState(std::string const &path, WarmStartState const &state);
+
+struct ConvergenceStats
+{
+    bool WarmStarted = false;
+    // Frames from the first completed request until convergence, -1 while not converged
+    int AeFrames = -1;
+    int AwbFrames = -1;
+};
+
+// Follows the request metadata to count frames until AE locks and the AWB gains settle,
+// and keeps the values of the last frame at which both had settled to persist on shutdown.
+// Frames taken mid scene change are never persisted.
+class ConvergenceTracker
+{
+private:
+    static constexpr int AwbStableFrames = 5;
+    static constexpr float AwbStableTolerance = 0.01f;
+
+    ConvergenceStats stats_;
+    std::optional<WarmStartState> latest_;
+    // Kept across Reset(), so a run stopped before converging leaves the previous values
+    std::optional<WarmStartState> converged_;
+    int frames_ = 0;
+    int awbStableCount_ = 0;
+
+public:
+    void Reset(bool warmStarted);
+    void Update(libcamera::ControlList const &metadata);
+
+    ConvergenceStats const &Stats() const { return stats_; }
+    std::optional<WarmStartState> const &Converged() const { return converged_; }
+};
+
+#endif